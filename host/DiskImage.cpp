@@ -0,0 +1,314 @@
+#include "DiskImage.h"
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "PriamCrc32.h"
+
+namespace Priam
+{
+
+static const char MAGIC[8] = {'P', 'R', 'I', 'A', 'M', 'I', 'M', 'G'};
+static const size_t HEADERFIELDS = 68;
+static const uint64_t PAGESIZE = 4096;
+
+static uint64_t RoundToPage(uint64_t val)
+{
+  return (val + PAGESIZE - 1) & ~(PAGESIZE - 1);
+}
+
+static uint64_t GetLE(const uint8_t *p, uint8_t bytes)
+{
+  uint64_t val = 0;
+  for (uint8_t i = bytes; i > 0; i--)
+    val = (val << 8) | p[i - 1];
+  return val;
+}
+
+static void PutLE(uint8_t *p, uint64_t val, uint8_t bytes)
+{
+  for (uint8_t i = 0; i < bytes; i++)
+  {
+    p[i] = (uint8_t) (val & 0xFF);
+    val >>= 8;
+  }
+}
+
+static uint32_t HeaderCrc(const uint8_t *header)
+{
+  uint32_t crc = CRC32_INIT;
+  for (size_t i = 0; i < HEADERFIELDS; i++)
+    crc = Crc32Update(crc, header[i]);
+  return ~crc;
+}
+
+DiskImage::DiskImage() :
+fd_(-1), writable_(false), map_(nullptr), mapSize_(0), drive_(0), cylinders_(0), heads_(0), sectorsPerTrack_(0),
+sectorSize_(0), sectors_(0), chunkSectors_(0), chunks_(0), chunkBytes_(0), tableOffset_(0), indexOffset_(0),
+dataOffset_(0), dataEnd_(0)
+{
+}
+
+bool DiskImage::Create(const char *path, uint8_t drive, uint16_t cylinders, uint8_t heads, uint8_t sectorsPerTrack, uint16_t sectorSize)
+{
+  Close();
+  if (!cylinders || !heads || !sectorsPerTrack || !sectorSize)
+  {
+    fprintf(stderr, "%s: no geometry\n", path);
+    return false;
+  }
+
+  fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0)
+  {
+    perror(path);
+    return false;
+  }
+  writable_ = true;
+
+  drive_ = drive;
+  cylinders_ = cylinders;
+  heads_ = heads;
+  sectorsPerTrack_ = sectorsPerTrack;
+  sectorSize_ = sectorSize;
+  sectors_ = (uint32_t) cylinders * heads * sectorsPerTrack;
+  chunkSectors_ = sectorsPerTrack;
+  chunks_ = (sectors_ + chunkSectors_ - 1) / chunkSectors_;
+  chunkBytes_ = (uint32_t) RoundToPage((uint64_t) chunkSectors_ * sectorSize_);
+  tableOffset_ = HEADERSIZE;
+  indexOffset_ = tableOffset_ + (uint64_t) chunks_ * 8;
+  dataOffset_ = RoundToPage(indexOffset_ + sectors_);
+  dataEnd_ = dataOffset_;
+
+  if (!Reserve(dataOffset_))
+  {
+    Close();
+    return false;
+  }
+  WriteHeader();
+  return true;
+}
+
+bool DiskImage::Open(const char *path, bool writable)
+{
+  Close();
+  fd_ = open(path, writable ? O_RDWR : O_RDONLY);
+  struct stat st;
+  if (fd_ < 0 || fstat(fd_, &st))
+  {
+    perror(path);
+    Close();
+    return false;
+  }
+  writable_ = writable;
+
+  if ((uint64_t) st.st_size < HEADERSIZE || !Map((size_t) st.st_size))
+  {
+    fprintf(stderr, "%s: not a disk image\n", path);
+    Close();
+    return false;
+  }
+
+  const uint8_t *h = map_;
+  if (memcmp(h, MAGIC, sizeof(MAGIC)) || GetLE(h + 8, 2) != VERSION || GetLE(h + 68, 4) != HeaderCrc(h))
+  {
+    fprintf(stderr, "%s: not a disk image or unsupported version\n", path);
+    Close();
+    return false;
+  }
+
+  sectorSize_ = (uint16_t) GetLE(h + 10, 2);
+  cylinders_ = (uint16_t) GetLE(h + 12, 2);
+  heads_ = h[14];
+  sectorsPerTrack_ = h[15];
+  drive_ = h[16];
+  chunkSectors_ = (uint32_t) GetLE(h + 20, 4);
+  chunks_ = (uint32_t) GetLE(h + 24, 4);
+  sectors_ = (uint32_t) GetLE(h + 28, 4);
+  tableOffset_ = GetLE(h + 32, 8);
+  indexOffset_ = GetLE(h + 40, 8);
+  dataOffset_ = GetLE(h + 48, 8);
+  dataEnd_ = GetLE(h + 56, 8);
+  chunkBytes_ = (uint32_t) GetLE(h + 64, 4);
+
+  bool valid = sectorSize_ && chunkSectors_ && sectors_ == (uint32_t) cylinders_ * heads_ * sectorsPerTrack_ &&
+               chunks_ == (sectors_ + chunkSectors_ - 1) / chunkSectors_ &&
+               chunkBytes_ >= (uint64_t) chunkSectors_ * sectorSize_ && chunkBytes_ % PAGESIZE == 0 &&
+               tableOffset_ >= HEADERSIZE && indexOffset_ >= tableOffset_ + (uint64_t) chunks_ * 8 &&
+               dataOffset_ >= indexOffset_ + sectors_ && dataOffset_ % PAGESIZE == 0 &&
+               dataEnd_ >= dataOffset_ && dataEnd_ <= mapSize_;
+
+  for (uint32_t chunk = 0; valid && chunk < chunks_; chunk++)
+  {
+    uint64_t offset = GetLE(map_ + tableOffset_ + (uint64_t) chunk * 8, 8);
+    valid = !offset || (offset >= dataOffset_ && offset + chunkBytes_ <= dataEnd_ && offset % PAGESIZE == 0);
+  }
+
+  if (!valid)
+  {
+    fprintf(stderr, "%s: damaged disk image\n", path);
+    Close();
+    return false;
+  }
+  return true;
+}
+
+bool DiskImage::Close()
+{
+  bool ok = true;
+  if (map_)
+  {
+    if (writable_)
+    {
+      WriteHeader();
+      ok = !msync(map_, mapSize_, MS_SYNC);
+    }
+    munmap(map_, mapSize_);
+    map_ = nullptr;
+    mapSize_ = 0;
+  }
+
+  if (fd_ >= 0)
+  {
+    if (writable_ && ftruncate(fd_, (off_t) dataEnd_))
+      ok = false;
+    if (close(fd_))
+      ok = false;
+    fd_ = -1;
+  }
+  return ok;
+}
+
+bool DiskImage::SameGeometry(DiskImage &other)
+{
+  return cylinders_ == other.cylinders_ && heads_ == other.heads_ && sectorsPerTrack_ == other.sectorsPerTrack_ &&
+         sectorSize_ == other.sectorSize_;
+}
+
+void DiskImage::Chs(uint32_t lba, uint8_t &head, uint16_t &cylinder, uint8_t &sector)
+{
+  sector = (uint8_t) (lba % sectorsPerTrack_);
+  head = (uint8_t) (lba / sectorsPerTrack_ % heads_);
+  cylinder = (uint16_t) (lba / ((uint32_t) heads_ * sectorsPerTrack_));
+}
+
+uint32_t DiskImage::Count(SectorState state)
+{
+  uint32_t count = 0;
+  for (uint32_t lba = 0; lba < sectors_; lba++)
+    if (State(lba) == state)
+      count++;
+  return count;
+}
+
+const uint8_t *DiskImage::Sector(uint32_t lba)
+{
+  uint64_t offset = GetLE(map_ + tableOffset_ + (uint64_t) (lba / chunkSectors_) * 8, 8);
+  if (!offset)
+    return nullptr;
+  return map_ + offset + (uint64_t) (lba % chunkSectors_) * sectorSize_;
+}
+
+void DiskImage::ReadSector(uint32_t lba, uint8_t *out)
+{
+  const uint8_t *data = Sector(lba);
+  if (data)
+    memcpy(out, data, sectorSize_);
+  else
+    memset(out, 0, sectorSize_);
+}
+
+bool DiskImage::WriteSector(uint32_t lba, const uint8_t *data, SectorState state, uint8_t status)
+{
+  uint8_t *entry = map_ + tableOffset_ + (uint64_t) (lba / chunkSectors_) * 8;
+  uint64_t offset = GetLE(entry, 8);
+
+  if (!offset)
+  {
+    bool zero = true;
+    for (uint16_t i = 0; i < sectorSize_ && zero; i++)
+      zero = !data[i];
+
+    if (!zero)
+    {
+      //New chunks go to the end, the file grows in big steps so the mapping rarely moves
+      if (!Reserve(dataEnd_ + chunkBytes_))
+        return false;
+      entry = map_ + tableOffset_ + (uint64_t) (lba / chunkSectors_) * 8;
+      offset = dataEnd_;
+      dataEnd_ += chunkBytes_;
+      PutLE(entry, offset, 8);
+      //The image stays consistent when the program is killed, the mapping is written back anyway
+      WriteHeader();
+    }
+  }
+
+  if (offset)
+    memcpy(map_ + offset + (uint64_t) (lba % chunkSectors_) * sectorSize_, data, sectorSize_);
+  SetState(lba, state, status);
+  return true;
+}
+
+void DiskImage::SetState(uint32_t lba, SectorState state, uint8_t status)
+{
+  map_[indexOffset_ + lba] = (uint8_t) ((state << 6) | (status & 0x3F));
+}
+
+bool DiskImage::Map(size_t size)
+{
+  void *map;
+  if (map_)
+    map = mremap(map_, mapSize_, size, MREMAP_MAYMOVE);
+  else
+    map = mmap(nullptr, size, writable_ ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd_, 0);
+
+  if (map == MAP_FAILED)
+  {
+    perror("mmap");
+    return false;
+  }
+  map_ = (uint8_t *) map;
+  mapSize_ = size;
+  return true;
+}
+
+bool DiskImage::Reserve(uint64_t size)
+{
+  if (size <= mapSize_)
+    return true;
+
+  uint64_t grow = size < 2 * (uint64_t) mapSize_ ? 2 * (uint64_t) mapSize_ : size;
+  grow = RoundToPage(grow);
+  if (ftruncate(fd_, (off_t) grow))
+  {
+    perror("ftruncate");
+    return false;
+  }
+  return Map((size_t) grow);
+}
+
+void DiskImage::WriteHeader()
+{
+  uint8_t *h = map_;
+  memcpy(h, MAGIC, sizeof(MAGIC));
+  PutLE(h + 8, VERSION, 2);
+  PutLE(h + 10, sectorSize_, 2);
+  PutLE(h + 12, cylinders_, 2);
+  h[14] = heads_;
+  h[15] = sectorsPerTrack_;
+  h[16] = drive_;
+  memset(h + 17, 0, 3);
+  PutLE(h + 20, chunkSectors_, 4);
+  PutLE(h + 24, chunks_, 4);
+  PutLE(h + 28, sectors_, 4);
+  PutLE(h + 32, tableOffset_, 8);
+  PutLE(h + 40, indexOffset_, 8);
+  PutLE(h + 48, dataOffset_, 8);
+  PutLE(h + 56, dataEnd_, 8);
+  PutLE(h + 64, chunkBytes_, 4);
+  PutLE(h + 68, HeaderCrc(h), 4);
+}
+
+}
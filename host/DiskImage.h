@@ -0,0 +1,103 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+
+namespace Priam
+{
+
+//Disk image container that keeps what a flat dump loses: the geometry from ResultDriveParams and the
+//status of every sector. The whole file is memory mapped, sector data is read in place
+//
+//File layout, all values little endian:
+//  header     HEADERSIZE bytes
+//    0  magic "PRIAMIMG"          8  version (16)           10 sector size (16)
+//    12 cylinders (16)            14 heads (8)              15 sectors per track (8)
+//    16 drive (8)                 17 reserved (3 bytes)     20 sectors per chunk (32)
+//    24 chunks (32)               28 sectors (32)           32 chunk table offset (64)
+//    40 sector index offset (64)  48 data offset (64)       56 end of data (64)
+//    64 chunk size in bytes (32)  68 CRC32 of bytes 0-67 (see PriamCrc32.h)
+//  chunk table  one 64 bit file offset per chunk, 0 for a chunk that was never written (reads as zeros)
+//  sector index one byte per sector in LBA order (see Lba()): state in bits 7-6, completion type and
+//               code of the controller status in bits 5-0 (TransactionStatus raw value without the drive)
+//  data       chunks of sectors per chunk * sector size bytes, page aligned, in the order they were written
+//
+//A chunk is one track, so a track of zeros or one that never read takes no space
+class DiskImage
+{
+  public:
+  static const uint16_t VERSION = 1;
+  static const size_t HEADERSIZE = 4096;
+
+  enum SectorState {
+    UNREAD = 0,
+    GOOD = 1,
+    RETRIED = 2,  //read only after a controller error on the first read
+    FAILED = 3
+    };
+
+  DiskImage();
+  ~DiskImage() {Close();}
+  DiskImage(const DiskImage &) = delete;
+  DiskImage &operator=(const DiskImage &) = delete;
+
+  //New image, replaces an existing file
+  bool Create(const char *path, uint8_t drive, uint16_t cylinders, uint8_t heads, uint8_t sectorsPerTrack, uint16_t sectorSize);
+  bool Open(const char *path, bool writable);
+  //Writes back the mapping and trims the file to the end of data
+  bool Close();
+  bool IsOpen() {return map_ != nullptr;}
+
+  uint8_t Drive() {return drive_;}
+  uint16_t Cylinders() {return cylinders_;}
+  uint8_t Heads() {return heads_;}
+  uint8_t SectorsPerTrack() {return sectorsPerTrack_;}
+  uint16_t SectorSize() {return sectorSize_;}
+  uint32_t Sectors() {return sectors_;}
+  bool SameGeometry(DiskImage &other);
+
+  uint32_t Lba(uint8_t head, uint16_t cylinder, uint8_t sector)
+  {
+    return ((uint32_t) cylinder * heads_ + head) * sectorsPerTrack_ + sector;
+  }
+  void Chs(uint32_t lba, uint8_t &head, uint16_t &cylinder, uint8_t &sector);
+
+  SectorState State(uint32_t lba) {return (SectorState) (map_[indexOffset_ + lba] >> 6);}
+  //Completion type and code of the controller status that set the state
+  uint8_t Status(uint32_t lba) {return map_[indexOffset_ + lba] & 0x3F;}
+  uint32_t Count(SectorState state);
+
+  //Sector data in the mapping, nullptr when its chunk was never written and it reads as zeros
+  //Only valid until the next WriteSector()
+  const uint8_t *Sector(uint32_t lba);
+  void ReadSector(uint32_t lba, uint8_t *out);
+
+  //Store a sector that was read, all zero sectors only go into the index unless their chunk exists
+  bool WriteSector(uint32_t lba, const uint8_t *data, SectorState state, uint8_t status = 0);
+  void SetState(uint32_t lba, SectorState state, uint8_t status = 0);
+
+  private:
+  bool Map(size_t size);
+  bool Reserve(uint64_t size);
+  void WriteHeader();
+
+  int fd_;
+  bool writable_;
+  uint8_t *map_;
+  size_t mapSize_;
+
+  uint8_t drive_;
+  uint16_t cylinders_;
+  uint8_t heads_;
+  uint8_t sectorsPerTrack_;
+  uint16_t sectorSize_;
+  uint32_t sectors_;
+  uint32_t chunkSectors_;
+  uint32_t chunks_;
+  uint32_t chunkBytes_;
+  uint64_t tableOffset_;
+  uint64_t indexOffset_;
+  uint64_t dataOffset_;
+  uint64_t dataEnd_;
+};
+
+}
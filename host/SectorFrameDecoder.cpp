@@ -0,0 +1,279 @@
+#include "SectorFrameDecoder.h"
+#include "Arduino.h"
+#include "PriamSectorStream.h"
+#include "PriamCrc32.h"
+
+using namespace Priam;
+
+SectorFrameDecoder::SectorFrameDecoder() :
+state_(SYNC0), crc_(0), rxCrc_(0), crcBytes_(0), rxSectorCrc_(0), size_(0), method_(0), rleLast_(-1), rleCount_(0),
+rleWantCount_(false), prevValid_(false), transferValid_(false), transferDrive_(0), transferHead_(0), transferCylinder_(0),
+sectorsGood_(256, false), frames_(0), badFrames_(0), sectorCrcErrors_(0), sectorsLost_(0)
+{
+}
+
+//Header bytes from TYPE on, including the method byte of PACKED frames
+size_t SectorFrameDecoder::HeaderSize(uint8_t type)
+{
+  switch (type)
+  {
+    case SectorStream::FRAME_DATA:
+      return 8;
+    case SectorStream::FRAME_STATUS:
+      return 9;
+    case SectorStream::FRAME_CHECKPOINT:
+      return 5;
+    case SectorStream::FRAME_PACKED:
+      return 9;
+    case SectorStream::FRAME_RESPONSE:
+      return 10;
+    case SectorStream::FRAME_EVENT:
+      return 8;
+    default:
+      return 0;
+  }
+}
+
+//DATA and PACKED frames carry a sector and its CRC32
+bool SectorFrameDecoder::SectorFrame()
+{
+  return header_[0] == SectorStream::FRAME_DATA || header_[0] == SectorStream::FRAME_PACKED;
+}
+
+void SectorFrameDecoder::Feed(const uint8_t *data, size_t len)
+{
+  while (len--)
+    Feed(*data++);
+}
+
+void SectorFrameDecoder::Feed(uint8_t val)
+{
+  switch (state_)
+  {
+    case SYNC0:
+      if (val == SectorStream::SYNC0)
+        state_ = SYNC1;
+      return;
+
+    case SYNC1:
+      if (val == SectorStream::SYNC1)
+      {
+        header_.clear();
+        crc_ = 0xFFFF;
+        state_ = HEADER;
+      }
+      else if (val != SectorStream::SYNC0)
+        state_ = SYNC0;
+      return;
+
+    case HEADER:
+    {
+      crc_ = Crc16Update(crc_, val);
+      header_.push_back(val);
+
+      size_t need = HeaderSize(header_[0]);
+      if (!need)
+      {
+        badFrames_++;
+        OnBadFrame();
+        Reset();
+        return;
+      }
+      if (header_.size() < need)
+        return;
+
+      crcBytes_ = 0;
+      rxCrc_ = 0;
+      rxSectorCrc_ = 0;
+      uint8_t type = header_[0];
+      if (type == SectorStream::FRAME_DATA || type == SectorStream::FRAME_PACKED)
+      {
+        size_ = (uint16_t) ((header_[6] << 8) | header_[7]);
+        method_ = (type == SectorStream::FRAME_PACKED) ? header_[8] : 0;
+        sector_.clear();
+        rleLast_ = -1;
+        rleCount_ = 0;
+        rleWantCount_ = false;
+
+        bool payload = size_ && !(type == SectorStream::FRAME_PACKED && method_ == SectorStream::PACK_SAME);
+        state_ = payload ? PAYLOAD : SECTORCRC;
+      }
+      else if (type == SectorStream::FRAME_RESPONSE)
+      {
+        size_ = header_[9];
+        sector_.clear();
+        state_ = size_ ? PAYLOAD : CRC;
+      }
+      else
+        state_ = CRC;
+      return;
+    }
+
+    case PAYLOAD:
+      crc_ = Crc16Update(crc_, val);
+      if (PayloadByte(val))
+        state_ = SectorFrame() ? SECTORCRC : CRC;
+      return;
+
+    case SECTORCRC:
+      crc_ = Crc16Update(crc_, val);
+      rxSectorCrc_ = (rxSectorCrc_ << 8) | val;
+      if (++crcBytes_ >= 4)
+      {
+        crcBytes_ = 0;
+        state_ = CRC;
+      }
+      return;
+
+    case CRC:
+      rxCrc_ = (uint16_t) ((rxCrc_ << 8) | val);
+      if (++crcBytes_ < 2)
+        return;
+      Reset();
+      if (rxCrc_ != crc_)
+      {
+        //A SAME frame after a lost frame would refer to the wrong sector
+        prevValid_ = false;
+        badFrames_++;
+        OnBadFrame();
+        return;
+      }
+      FrameDone();
+      return;
+  }
+}
+
+//Returns true when the payload is complete
+bool SectorFrameDecoder::PayloadByte(uint8_t val)
+{
+  if (header_[0] == SectorStream::FRAME_DATA || header_[0] == SectorStream::FRAME_RESPONSE)
+  {
+    sector_.push_back(val);
+    return sector_.size() >= size_;
+  }
+
+  switch (method_)
+  {
+    case SectorStream::PACK_UNIFORM:
+      sector_.assign(size_, val);
+      return true;
+
+    case SectorStream::PACK_RLE:
+      if (rleWantCount_)
+      {
+        sector_.insert(sector_.end(), val, (uint8_t) rleLast_);
+        rleWantCount_ = false;
+        rleLast_ = -1;
+        rleCount_ = 0;
+      }
+      else
+      {
+        sector_.push_back(val);
+        if (val == rleLast_)
+          rleWantCount_ = true;
+        else
+          rleLast_ = val;
+      }
+      //A run at the end of the sector is still followed by its count byte
+      return sector_.size() >= size_ && !rleWantCount_;
+
+    default:
+      return true;
+  }
+}
+
+void SectorFrameDecoder::FrameDone()
+{
+  uint8_t type = header_[0];
+  uint8_t drive = header_[1];
+  uint8_t head = header_[2];
+  uint16_t cylinder = (uint16_t) ((header_[3] << 8) | header_[4]);
+
+  switch (type)
+  {
+    case SectorStream::FRAME_STATUS:
+      TransferDone(drive, head, cylinder, header_[5], header_[6]);
+      OnStatus(drive, head, cylinder, header_[5], header_[6], header_[7], header_[8]);
+      break;
+
+    case SectorStream::FRAME_RESPONSE:
+      OnResponse(drive, head, cylinder, header_[5], header_[6], header_[7], header_[8], sector_.data(), (uint8_t) size_);
+      break;
+
+    case SectorStream::FRAME_CHECKPOINT:
+      prevValid_ = false;
+      OnCheckpoint(drive, head, cylinder);
+      break;
+
+    case SectorStream::FRAME_EVENT:
+      OnEvent(drive, head, cylinder, header_[5], header_[6], header_[7]);
+      break;
+
+    case SectorStream::FRAME_DATA:
+    case SectorStream::FRAME_PACKED:
+      if (type == SectorStream::FRAME_PACKED && method_ == SectorStream::PACK_SAME)
+      {
+        if (!prevValid_ || prevSector_.size() != size_)
+        {
+          badFrames_++;
+          OnBadFrame();
+          return;
+        }
+        sector_ = prevSector_;
+      }
+      if (sector_.size() != size_)
+      {
+        badFrames_++;
+        OnBadFrame();
+        return;
+      }
+      {
+        uint32_t crc = CRC32_INIT;
+        for (uint8_t val : sector_)
+          crc = Crc32Update(crc, val);
+        if ((crc ^ CRC32_INIT) != rxSectorCrc_)
+        {
+          prevValid_ = false;
+          sectorCrcErrors_++;
+          OnBadFrame();
+          return;
+        }
+      }
+      prevSector_ = sector_;
+      prevValid_ = true;
+      SectorDone(drive, head, cylinder, header_[5]);
+      OnSector(drive, head, cylinder, header_[5], sector_.data(), size_);
+      break;
+  }
+
+  frames_++;
+}
+
+void SectorFrameDecoder::SectorDone(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector)
+{
+  //Frames carry the address of the transfer start, a new address is a new transfer
+  if (!transferValid_ || drive != transferDrive_ || head != transferHead_ || cylinder != transferCylinder_)
+  {
+    sectorsGood_.assign(sectorsGood_.size(), false);
+    transferValid_ = true;
+    transferDrive_ = drive;
+    transferHead_ = head;
+    transferCylinder_ = cylinder;
+  }
+  sectorsGood_[sector] = true;
+}
+
+void SectorFrameDecoder::TransferDone(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t firstSector, uint8_t count)
+{
+  bool same = transferValid_ && drive == transferDrive_ && head == transferHead_ && cylinder == transferCylinder_;
+
+  for (unsigned sector = firstSector; sector < (unsigned) firstSector + count && sector < sectorsGood_.size(); sector++)
+  {
+    if (same && sectorsGood_[sector])
+      continue;
+    sectorsLost_++;
+    OnSectorLost(drive, head, cylinder, (uint8_t) sector);
+  }
+
+  transferValid_ = false;
+}
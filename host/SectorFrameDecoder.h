@@ -0,0 +1,111 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+namespace Priam
+{
+
+//Host side parser for the SectorStream binary frames (see src/PriamSectorStream.h)
+//Feed it the byte stream from the sketch, it checks the CRCs, unpacks PACKED frames and reports
+//frames through the virtual On... methods. Text between frames (menu output) is skipped
+//Sectors are only reported when the sector CRC32 matches the unpacked data. The sectors of a transfer
+//that did not arrive intact are reported by OnSectorLost() when its STATUS frame arrives
+class SectorFrameDecoder
+{
+  public:
+  SectorFrameDecoder();
+  virtual ~SectorFrameDecoder() {}
+
+  void Feed(uint8_t val);
+  void Feed(const uint8_t *data, size_t len);
+
+  //Frame counters
+  uint64_t Frames() {return frames_;}
+  uint64_t BadFrames() {return badFrames_;}
+  uint64_t SectorCrcErrors() {return sectorCrcErrors_;}
+  uint64_t SectorsLost() {return sectorsLost_;}
+
+  protected:
+  //A DATA or PACKED frame, data holds the unpacked sector
+  virtual void OnSector(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, const uint8_t *data, uint16_t size)
+  {
+    (void) drive; (void) head; (void) cylinder; (void) sector; (void) data; (void) size;
+  }
+
+  virtual void OnStatus(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t firstSector, uint8_t count, uint8_t status, uint8_t flags)
+  {
+    (void) drive; (void) head; (void) cylinder; (void) firstSector; (void) count; (void) status; (void) flags;
+  }
+
+  virtual void OnCheckpoint(uint8_t drive, uint8_t head, uint16_t cylinder)
+  {
+    (void) drive; (void) head; (void) cylinder;
+  }
+
+  //A sector the sketch sent that failed the frame CRC or the sector CRC32, read it again
+  virtual void OnSectorLost(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector)
+  {
+    (void) drive; (void) head; (void) cylinder; (void) sector;
+  }
+
+  //A RESPONSE frame to a host protocol request, data holds len bytes
+  virtual void OnResponse(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t seq, uint8_t op, uint8_t status, uint8_t flags,
+                          const uint8_t *data, uint8_t len)
+  {
+    (void) drive; (void) head; (void) cylinder; (void) seq; (void) op; (void) status; (void) flags; (void) data; (void) len;
+  }
+
+  //An EVENT frame, library diagnostic message (see Priam::Log in src/PriamLog.h)
+  virtual void OnEvent(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t level, uint8_t event, uint8_t value)
+  {
+    (void) drive; (void) head; (void) cylinder; (void) level; (void) event; (void) value;
+  }
+
+  //Frame with a bad CRC, unknown type or a PACK_SAME without a previous sector, dropped
+  virtual void OnBadFrame() {}
+
+  private:
+  enum ParseState {SYNC0, SYNC1, HEADER, PAYLOAD, SECTORCRC, CRC};
+
+  void Reset() {state_ = SYNC0;}
+  size_t HeaderSize(uint8_t type);
+  bool PayloadByte(uint8_t val);
+  bool SectorFrame();
+  void FrameDone();
+  void SectorDone(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector);
+  void TransferDone(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t firstSector, uint8_t count);
+
+  ParseState state_;
+  std::vector<uint8_t> header_;
+  uint16_t crc_;
+  uint16_t rxCrc_;
+  uint8_t crcBytes_;
+  uint32_t rxSectorCrc_;
+
+  //Payload of DATA/PACKED/RESPONSE frames
+  uint16_t size_;
+  uint8_t method_;
+  std::vector<uint8_t> sector_;
+  int rleLast_;
+  uint8_t rleCount_;
+  bool rleWantCount_;
+
+  //Last good sector, for PACK_SAME
+  std::vector<uint8_t> prevSector_;
+  bool prevValid_;
+
+  //Sectors of the current transfer that arrived intact
+  bool transferValid_;
+  uint8_t transferDrive_;
+  uint8_t transferHead_;
+  uint16_t transferCylinder_;
+  std::vector<bool> sectorsGood_;
+
+  uint64_t frames_;
+  uint64_t badFrames_;
+  uint64_t sectorCrcErrors_;
+  uint64_t sectorsLost_;
+};
+
+}
@@ -0,0 +1,526 @@
+#include "SimulatedPriamSmart.h"
+#include <algorithm>
+
+using namespace Priam;
+
+SimulatedDrive::SimulatedDrive() :
+attached_(false), image_(nullptr), cylinders_(0), heads_(0), sectorsPerTrack_(0), sectorSize_(0),
+rpm_(3600), seekSettle_us_(3000), seekPerCylinder_us_(50), spinup_ms_(20000),
+spinning_(true), readyAt_ns_(0), cylinder_(0)
+{
+}
+
+SimulatedDrive::~SimulatedDrive()
+{
+  if (image_)
+    fclose(image_);
+}
+
+bool SimulatedDrive::Attach(const char *imagePath, uint16_t cylinders, uint8_t heads, uint8_t sectorsPerTrack, uint16_t sectorSize)
+{
+  if (!cylinders || cylinders > 4095 || !heads || heads > 7 || !sectorsPerTrack || !sectorSize)
+    return false;
+
+  if (image_)
+    fclose(image_);
+  image_ = nullptr;
+
+  if (imagePath)
+  {
+    image_ = fopen(imagePath, "rb");
+    if (!image_)
+      return false;
+  }
+
+  cylinders_ = cylinders;
+  heads_ = heads;
+  sectorsPerTrack_ = sectorsPerTrack;
+  sectorSize_ = sectorSize;
+  attached_ = true;
+  return true;
+}
+
+void SimulatedDrive::SetTiming(uint32_t rpm, uint32_t seekSettle_us, uint32_t seekPerCylinder_us, uint32_t spinup_ms)
+{
+  rpm_ = rpm ? rpm : 3600;
+  seekSettle_us_ = seekSettle_us;
+  seekPerCylinder_us_ = seekPerCylinder_us;
+  spinup_ms_ = spinup_ms;
+}
+
+uint32_t SimulatedDrive::SectorIndex(uint8_t head, uint16_t cylinder, uint8_t sector)
+{
+  return ((uint32_t) cylinder * heads_ + head) * sectorsPerTrack_ + sector;
+}
+
+void SimulatedDrive::AddWeakSector(uint8_t head, uint16_t cylinder, uint8_t sector)
+{
+  weak_.push_back(SectorIndex(head, cylinder, sector));
+}
+
+void SimulatedDrive::AddBadSector(uint8_t head, uint16_t cylinder, uint8_t sector)
+{
+  bad_.push_back(SectorIndex(head, cylinder, sector));
+}
+
+void SimulatedDrive::AddLateErrorSector(uint8_t head, uint16_t cylinder, uint8_t sector)
+{
+  late_.push_back(SectorIndex(head, cylinder, sector));
+}
+
+SimulatedDrive::SectorHealth SimulatedDrive::Health(uint8_t head, uint16_t cylinder, uint8_t sector)
+{
+  uint32_t idx = SectorIndex(head, cylinder, sector);
+
+  if (std::find(bad_.begin(), bad_.end(), idx) != bad_.end())
+    return SECTOR_BAD;
+  if (std::find(weak_.begin(), weak_.end(), idx) != weak_.end())
+    return SECTOR_WEAK;
+  if (std::find(late_.begin(), late_.end(), idx) != late_.end())
+    return SECTOR_LATEERROR;
+  return SECTOR_GOOD;
+}
+
+void SimulatedDrive::ReadSector(uint8_t head, uint16_t cylinder, uint8_t sector, uint8_t *buffer)
+{
+  memset(buffer, 0, sectorSize_);
+
+  if (!image_)
+    return;
+
+  long offset = (long) SectorIndex(head, cylinder, sector) * sectorSize_;
+  if (fseek(image_, offset, SEEK_SET) == 0)
+  {
+    size_t n = fread(buffer, 1, sectorSize_, image_);
+    (void) n;
+  }
+}
+
+uint64_t SimulatedDrive::NextSectorStart(uint8_t sector, uint64_t t_ns)
+{
+  uint64_t rev = RevolutionNanos();
+  uint64_t start = t_ns - (t_ns % rev) + (uint64_t) sector * SectorNanos();
+  if (start < t_ns)
+    start += rev;
+  return start;
+}
+
+uint64_t SimulatedDrive::Seek(uint16_t cylinder)
+{
+  uint16_t distance = (uint16_t) (cylinder > cylinder_ ? cylinder - cylinder_ : cylinder_ - cylinder);
+  cylinder_ = cylinder;
+
+  if (!distance)
+    return 0;
+
+  return ((uint64_t) seekSettle_us_ + (uint64_t) seekPerCylinder_us_ * distance) * 1000ULL;
+}
+
+SimulatedPriamSmart::SimulatedPriamSmart() :
+busCycle_ns_(2000), minBusSetup_(1), minBusPulse_(2), cmdOverhead_us_(200), pinRead_ns_(250), simState_(SIM_IDLE), readyAt_ns_(0),
+params_{0}, results_{0},
+readDrive_(0), readHead_(0), readCylinder_(0), readSector_(0), sectorsLeft_(0), readWithRetry_(false),
+sectorLoaded_(false), sectorPos_(0), prevSectorReady_ns_(0), hostDone_ns_(2, 0),
+registerCycles_(0), commands_(0), dataBytes_(0)
+{
+  instance_ = this;
+  ShimSetDigitalReadHook(DigitalReadHook);
+
+  //Power up state: the controller issues an initial completion request
+  ResetController();
+}
+
+SimulatedPriamSmart *SimulatedPriamSmart::instance_ = nullptr;
+
+int SimulatedPriamSmart::DigitalReadHook(uint8_t pin)
+{
+  if (!instance_ || pin != Board::DTREQ)
+    return LOW;
+
+  ShimAdvanceNanos(instance_->pinRead_ns_);
+  instance_->Update();
+  bool request = instance_->simState_ == SIM_DATAIN && instance_->sectorLoaded_;
+  return request ? Board::DTREQ_ACTIVE : !Board::DTREQ_ACTIVE;
+}
+
+void SimulatedPriamSmart::ResetController()
+{
+  memset(results_, 0, sizeof(results_));
+  sectorLoaded_ = false;
+  simState_ = SIM_EXECUTING;
+  readyAt_ns_ = ShimNowNanos() + (uint64_t) cmdOverhead_us_ * 1000ULL;
+}
+
+bool SimulatedPriamSmart::PulseReset(unsigned long pulseLength_ms)
+{
+  ResetController();
+  return PriamSmart::PulseReset(pulseLength_ms);
+}
+
+bool SimulatedPriamSmart::DriveUsable(uint8_t driveno)
+{
+  SimulatedDrive &drv = Drive(driveno);
+  return drv.Attached() && drv.spinning_ && ShimNowNanos() >= drv.readyAt_ns_;
+}
+
+void SimulatedPriamSmart::Complete(uint64_t at_ns, uint8_t driveno, TransactionStatus::CompletionType type, uint8_t code)
+{
+  results_[0] = (uint8_t) (((driveno & 3) << 6) | ((type & 3) << 4) | (code & 0xF));
+  simState_ = SIM_EXECUTING;
+  readyAt_ns_ = at_ns;
+}
+
+void SimulatedPriamSmart::Update()
+{
+  uint64_t now = ShimNowNanos();
+
+  if (simState_ == SIM_EXECUTING && now >= readyAt_ns_)
+  {
+    simState_ = SIM_COMPLETION;
+  }
+  else if (simState_ == SIM_DATAIN && !sectorLoaded_ && now >= readyAt_ns_)
+  {
+    SimulatedDrive &drv = Drive(readDrive_);
+    SimulatedDrive::SectorHealth health = drv.Health(readHead_, readCylinder_, readSector_);
+
+    if (health == SimulatedDrive::SECTOR_BAD || (health == SimulatedDrive::SECTOR_WEAK && !readWithRetry_))
+    {
+      Complete(readyAt_ns_, readDrive_, TransactionStatus::CompletionType::CMDDRIVEERROR, SIMCODE_DATAERROR);
+      results_[1] = (uint8_t) (((readHead_ & 7) << 4) | ((readCylinder_ >> 8) & 0xF));
+      results_[2] = (uint8_t) (readCylinder_ & 0xFF);
+      results_[3] = readSector_;
+      simState_ = SIM_COMPLETION;
+      return;
+    }
+
+    sectorBuf_.resize(drv.SectorSize());
+    drv.ReadSector(readHead_, readCylinder_, readSector_, sectorBuf_.data());
+    sectorPos_ = 0;
+    sectorLoaded_ = true;
+  }
+}
+
+uint8_t SimulatedPriamSmart::StatusRegister()
+{
+  Update();
+
+  switch (simState_)
+  {
+    case SIM_IDLE:
+      return InterfaceStatus::DATABUSENABLE;
+    case SIM_DATAIN:
+      if (sectorLoaded_)
+        return InterfaceStatus::DATABUSENABLE | InterfaceStatus::READWRITEREQUEST | InterfaceStatus::DATAXFERREQUEST;
+      return InterfaceStatus::INTERFACEBUSY;
+    case SIM_COMPLETION:
+      return InterfaceStatus::DATABUSENABLE | InterfaceStatus::COMPLETIONREQUEST;
+    case SIM_REJECTED:
+      return InterfaceStatus::DATABUSENABLE | InterfaceStatus::COMMANDREJECT;
+    case SIM_EXECUTING:
+    default:
+      return InterfaceStatus::INTERFACEBUSY;
+  }
+}
+
+bool SimulatedPriamSmart::BusCycle()
+{
+  //Bus delay units are 250 ns, see PriamSmart::BusDelay
+  ShimAdvanceNanos(busCycle_ns_ + ((uint64_t) BusDelaySetup() + BusDelayPulse()) * 250ULL);
+  registerCycles_++;
+
+  return BusDelaySetup() >= minBusSetup_ && BusDelayPulse() >= minBusPulse_;
+}
+
+//Bit errors on a bus cycle with too short timing
+static const uint8_t BUSTIMING_CORRUPTION = 0x24;
+
+bool SimulatedPriamSmart::RegisterRead(PriamSmart::ReadRegister address, uint8_t &value)
+{
+  if (!BusCycle())
+  {
+    //Value on the bus not yet valid
+    value = (uint8_t) (StatusRegister() ^ BUSTIMING_CORRUPTION);
+    return true;
+  }
+
+  switch (address)
+  {
+    case PriamSmart::ReadRegister::IFACESTATUS:
+      value = StatusRegister();
+      break;
+
+    case PriamSmart::ReadRegister::READDISCDATA:
+      Update();
+      if (simState_ != SIM_DATAIN || !sectorLoaded_)
+      {
+        value = 0;
+        break;
+      }
+      value = sectorBuf_[sectorPos_++];
+      dataBytes_++;
+      if (sectorPos_ >= sectorBuf_.size())
+        FinishSector();
+      break;
+
+    default:
+      value = results_[address - PriamSmart::ReadRegister::RESULT0];
+      break;
+  }
+
+  return true;
+}
+
+bool SimulatedPriamSmart::RegisterWrite(PriamSmart::WriteRegister address, uint8_t value)
+{
+  if (!BusCycle())
+    value = (uint8_t) (value ^ BUSTIMING_CORRUPTION);
+
+  switch (address)
+  {
+    case PriamSmart::WriteRegister::COMMAND:
+      Update();
+      if (value == PriamCommandsByteValues::COMPLETIONACK)
+      {
+        if (simState_ == SIM_COMPLETION)
+          simState_ = SIM_IDLE;
+      }
+      else if (simState_ == SIM_IDLE || simState_ == SIM_REJECTED)
+      {
+        StartCommand(value);
+      }
+      else
+      {
+        simState_ = SIM_REJECTED;
+      }
+      break;
+
+    case PriamSmart::WriteRegister::WRITEDISCDATA:
+      //No write commands are modelled
+      break;
+
+    default:
+      params_[address - PriamSmart::WriteRegister::PARAM0] = value;
+      break;
+  }
+
+  return true;
+}
+
+void SimulatedPriamSmart::StartCommand(uint8_t cmd)
+{
+  uint64_t now = ShimNowNanos();
+  uint64_t done = now + (uint64_t) cmdOverhead_us_ * 1000ULL;
+  uint8_t driveno = params_[0] & 3;
+  SimulatedDrive &drv = Drive(driveno);
+
+  commands_++;
+  memset(results_, 0, sizeof(results_));
+
+  switch (cmd)
+  {
+    case PriamCommandsByteValues::SOFTWARERESET:
+      ResetController();
+      break;
+
+    case PriamCommandsByteValues::INTERNALSTATUS:
+    case PriamCommandsByteValues::READDRIVETYPE:
+      if (!DriveUsable(driveno))
+        Complete(done, driveno, TransactionStatus::CompletionType::OPERATORINTERVENTION, SIMCODE_NOTREADY);
+      else
+        Complete(done, driveno, TransactionStatus::CompletionType::GOOD, 0);
+      break;
+
+    case PriamCommandsByteValues::SEQUENCEUPANDWAIT:
+    case PriamCommandsByteValues::SEQUENCEUPANDRETURN:
+      if (!drv.Attached())
+      {
+        Complete(done, driveno, TransactionStatus::CompletionType::OPERATORINTERVENTION, SIMCODE_NOTREADY);
+        break;
+      }
+      if (!drv.spinning_)
+      {
+        drv.spinning_ = true;
+        drv.readyAt_ns_ = now + (uint64_t) drv.spinup_ms_ * 1000000ULL;
+        drv.cylinder_ = 0;
+      }
+      if (cmd == PriamCommandsByteValues::SEQUENCEUPANDWAIT)
+        done = std::max(done, drv.readyAt_ns_);
+      Complete(done, driveno, TransactionStatus::CompletionType::GOOD, 0);
+      break;
+
+    case PriamCommandsByteValues::SEQUENCEDOWN:
+      drv.spinning_ = false;
+      Complete(done, driveno, TransactionStatus::CompletionType::GOOD, 0);
+      break;
+
+    case PriamCommandsByteValues::READDRIVEPARAM:
+      if (!DriveUsable(driveno))
+      {
+        Complete(done, driveno, TransactionStatus::CompletionType::OPERATORINTERVENTION, SIMCODE_NOTREADY);
+        break;
+      }
+      Complete(done, driveno, TransactionStatus::CompletionType::GOOD, 0);
+      results_[1] = (uint8_t) (((drv.Heads() & 7) << 4) | ((drv.Cylinders() >> 8) & 0xF));
+      results_[2] = (uint8_t) (drv.Cylinders() & 0xFF);
+      results_[3] = drv.SectorsPerTrack();
+      results_[4] = (uint8_t) (drv.SectorSize() >> 8);
+      results_[5] = (uint8_t) (drv.SectorSize() & 0xFF);
+      break;
+
+    case PriamCommandsByteValues::SEEKWITHRETRY:
+    case PriamCommandsByteValues::SEEKNORETRY:
+    {
+      HeadAndCylinder hc(params_[1], params_[2]);
+      if (!DriveUsable(driveno))
+      {
+        Complete(done, driveno, TransactionStatus::CompletionType::OPERATORINTERVENTION, SIMCODE_NOTREADY);
+        break;
+      }
+      if (hc.Cylinder() >= drv.Cylinders() || hc.Head() >= drv.Heads())
+      {
+        Complete(done, driveno, TransactionStatus::CompletionType::CMDDRIVEERROR, SIMCODE_SEEKERROR);
+        break;
+      }
+      done += drv.Seek(hc.Cylinder());
+      Complete(done, driveno, TransactionStatus::CompletionType::GOOD, 0);
+      results_[1] = (uint8_t) (((hc.Head() & 7) << 4) | ((hc.Cylinder() >> 8) & 0xF));
+      results_[2] = (uint8_t) (hc.Cylinder() & 0xFF);
+    }
+      break;
+
+    case PriamCommandsByteValues::READDATAWITHRETRY:
+    case PriamCommandsByteValues::READDATANORETRY:
+      StartRead(driveno, cmd == PriamCommandsByteValues::READDATAWITHRETRY);
+      break;
+
+    case PriamCommandsByteValues::VERIFYDISK:
+    {
+      if (!DriveUsable(driveno))
+      {
+        Complete(done, driveno, TransactionStatus::CompletionType::OPERATORINTERVENTION, SIMCODE_NOTREADY);
+        break;
+      }
+
+      //Full scan, one revolution per track plus track to track seeks
+      uint32_t tracks = (uint32_t) drv.Cylinders() * drv.Heads();
+      done += drv.Seek(0);
+      done += tracks * drv.RevolutionNanos();
+      done += (uint64_t) drv.Cylinders() * ((uint64_t) drv.seekSettle_us_ + drv.seekPerCylinder_us_) * 1000ULL;
+      drv.cylinder_ = (uint16_t) (drv.Cylinders() - 1);
+
+      for (uint16_t c = 0; c < drv.Cylinders(); c++)
+        for (uint8_t h = 0; h < drv.Heads(); h++)
+          for (uint8_t s = 0; s < drv.SectorsPerTrack(); s++)
+            if (drv.Health(h, c, s) == SimulatedDrive::SECTOR_BAD)
+            {
+              Complete(done, driveno, TransactionStatus::CompletionType::CMDDRIVEERROR, SIMCODE_DATAERROR);
+              results_[1] = (uint8_t) (((h & 7) << 4) | ((c >> 8) & 0xF));
+              results_[2] = (uint8_t) (c & 0xFF);
+              results_[3] = s;
+              return;
+            }
+
+      Complete(done, driveno, TransactionStatus::CompletionType::GOOD, 0);
+    }
+      break;
+
+    default:
+      commands_--;
+      simState_ = SIM_REJECTED;
+      break;
+  }
+}
+
+void SimulatedPriamSmart::StartRead(uint8_t driveno, bool withRetry)
+{
+  uint64_t now = ShimNowNanos();
+  uint64_t done = now + (uint64_t) cmdOverhead_us_ * 1000ULL;
+  SimulatedDrive &drv = Drive(driveno);
+  HeadAndCylinder hc(params_[1], params_[2]);
+
+  if (!DriveUsable(driveno))
+  {
+    Complete(done, driveno, TransactionStatus::CompletionType::OPERATORINTERVENTION, SIMCODE_NOTREADY);
+    return;
+  }
+
+  if (hc.Cylinder() >= drv.Cylinders() || hc.Head() >= drv.Heads() || params_[3] >= drv.SectorsPerTrack())
+  {
+    Complete(done, driveno, TransactionStatus::CompletionType::CMDDRIVEERROR, SIMCODE_BADADDRESS);
+    return;
+  }
+
+  //Implied seek
+  done += drv.Seek(hc.Cylinder());
+
+  readDrive_ = driveno;
+  readHead_ = hc.Head();
+  readCylinder_ = hc.Cylinder();
+  readSector_ = params_[3];
+  sectorsLeft_ = params_[4] ? params_[4] : 1;
+  readWithRetry_ = withRetry;
+
+  prevSectorReady_ns_ = done;
+  std::fill(hostDone_ns_.begin(), hostDone_ns_.end(), done);
+
+  simState_ = SIM_DATAIN;
+  ScheduleNextSector();
+}
+
+void SimulatedPriamSmart::ScheduleNextSector()
+{
+  SimulatedDrive &drv = Drive(readDrive_);
+
+  //The next sector can be read from the disk as soon as the previous one has passed under the head
+  //and the host has emptied the oldest sector buffer
+  uint64_t earliest = std::max(prevSectorReady_ns_, hostDone_ns_.back());
+  uint64_t ready = drv.NextSectorStart(readSector_, earliest) + drv.SectorNanos();
+
+  if (readWithRetry_)
+  {
+    SimulatedDrive::SectorHealth health = drv.Health(readHead_, readCylinder_, readSector_);
+    if (health == SimulatedDrive::SECTOR_WEAK)
+      ready += 2 * drv.RevolutionNanos();
+    else if (health == SimulatedDrive::SECTOR_BAD)
+      ready += 8 * drv.RevolutionNanos();
+  }
+
+  readyAt_ns_ = ready;
+  prevSectorReady_ns_ = ready;
+  sectorLoaded_ = false;
+}
+
+void SimulatedPriamSmart::FinishSector()
+{
+  uint64_t now = ShimNowNanos();
+
+  sectorLoaded_ = false;
+  hostDone_ns_.pop_back();
+  hostDone_ns_.insert(hostDone_ns_.begin(), now);
+
+  //Error found after the data went out, the command stops at this sector
+  if (Drive(readDrive_).Health(readHead_, readCylinder_, readSector_) == SimulatedDrive::SECTOR_LATEERROR)
+  {
+    Complete(now + (uint64_t) cmdOverhead_us_ * 1000ULL, readDrive_, TransactionStatus::CompletionType::CMDDRIVEERROR, SIMCODE_DATAERROR);
+    results_[1] = (uint8_t) (((readHead_ & 7) << 4) | ((readCylinder_ >> 8) & 0xF));
+    results_[2] = (uint8_t) (readCylinder_ & 0xFF);
+    results_[3] = readSector_;
+    return;
+  }
+
+  sectorsLeft_--;
+  if (!sectorsLeft_)
+  {
+    Complete(now + (uint64_t) cmdOverhead_us_ * 1000ULL, readDrive_, TransactionStatus::CompletionType::GOOD, 0);
+    return;
+  }
+
+  readSector_++;
+  if (readSector_ >= Drive(readDrive_).SectorsPerTrack())
+  {
+    Complete(now, readDrive_, TransactionStatus::CompletionType::CMDDRIVEERROR, SIMCODE_BADADDRESS);
+    return;
+  }
+
+  ScheduleNextSector();
+}
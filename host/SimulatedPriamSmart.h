@@ -0,0 +1,192 @@
+#pragma once
+#include <stdio.h>
+#include <vector>
+#include "Arduino.h"
+#include "../src/PriamSmartInterface.h"
+
+namespace Priam
+{
+
+//Software model of one drive behind the simulated Smart Interface
+//The disk image is a flat file in cylinder, head, sector order. Missing or short images read as zeroes
+class SimulatedDrive
+{
+  public:
+  SimulatedDrive();
+  ~SimulatedDrive();
+
+  //Attach a disk image (nullptr for an all zero disk) and set the geometry
+  //heads is limited to 7 by the READ DRIVE PARAMETERS result format, cylinders to 4095
+  bool Attach(const char *imagePath, uint16_t cylinders, uint8_t heads, uint8_t sectorsPerTrack, uint16_t sectorSize);
+  bool Attached() {return attached_;}
+
+  //Timing model: rotational speed, seek time = settle + perCylinder * distance, spin up time
+  void SetTiming(uint32_t rpm, uint32_t seekSettle_us, uint32_t seekPerCylinder_us, uint32_t spinup_ms);
+
+  //Start spun down (needs a sequence up command before any access)
+  void SetSpunDown() {spinning_ = false; readyAt_ns_ = 0;}
+
+  //Fault injection
+  //Weak sectors fail reads without retry, and take a few extra revolutions with retry
+  //Bad sectors always fail
+  //Late error sectors are transferred, then the command ends with a data error on them
+  void AddWeakSector(uint8_t head, uint16_t cylinder, uint8_t sector);
+  void AddBadSector(uint8_t head, uint16_t cylinder, uint8_t sector);
+  void AddLateErrorSector(uint8_t head, uint16_t cylinder, uint8_t sector);
+
+  uint16_t Cylinders() {return cylinders_;}
+  uint8_t Heads() {return heads_;}
+  uint8_t SectorsPerTrack() {return sectorsPerTrack_;}
+  uint16_t SectorSize() {return sectorSize_;}
+
+  //Sector contents from the image, for checking what a dump received
+  void ReadSector(uint8_t head, uint16_t cylinder, uint8_t sector, uint8_t *buffer);
+
+  private:
+  friend class SimulatedPriamSmart;
+
+  enum SectorHealth {SECTOR_GOOD, SECTOR_WEAK, SECTOR_BAD, SECTOR_LATEERROR};
+
+  uint32_t SectorIndex(uint8_t head, uint16_t cylinder, uint8_t sector);
+  SectorHealth Health(uint8_t head, uint16_t cylinder, uint8_t sector);
+
+  uint64_t RevolutionNanos() {return 60000000000ULL / rpm_;}
+  uint64_t SectorNanos() {return RevolutionNanos() / sectorsPerTrack_;}
+
+  //Next time the start of sector passes under the head at or after t_ns
+  uint64_t NextSectorStart(uint8_t sector, uint64_t t_ns);
+
+  //Seek time from the current cylinder, moves the heads
+  uint64_t Seek(uint16_t cylinder);
+
+  bool attached_;
+  FILE *image_;
+  uint16_t cylinders_;
+  uint8_t heads_;
+  uint8_t sectorsPerTrack_;
+  uint16_t sectorSize_;
+
+  uint32_t rpm_;
+  uint32_t seekSettle_us_;
+  uint32_t seekPerCylinder_us_;
+  uint32_t spinup_ms_;
+
+  bool spinning_;
+  uint64_t readyAt_ns_;
+  uint16_t cylinder_;
+
+  std::vector<uint32_t> weak_;
+  std::vector<uint32_t> bad_;
+  std::vector<uint32_t> late_;
+};
+
+//Simulated Priam Smart Interface controller
+//Replaces the register level bus with a model of the interface status bits, command, parameter
+//and result registers and a data phase fed from SimulatedDrive disk images
+//Every register access advances the virtual clock by the bus cycle overhead plus the configured bus delays
+//Register accesses with delays below the configured minimum are corrupted, to exercise bus timing calibration
+class SimulatedPriamSmart : public PriamSmart
+{
+  public:
+
+  static const uint8_t MAXDRIVES = 4;
+
+  //Completion codes used by the model
+  enum SimCompletionCode {
+    SIMCODE_NOTREADY = 0x1,
+    SIMCODE_SEEKERROR = 0x2,
+    SIMCODE_DATAERROR = 0x4,
+    SIMCODE_BADADDRESS = 0x5
+    };
+
+  SimulatedPriamSmart();
+
+  SimulatedDrive &Drive(uint8_t driveno) {return drives_[driveno & 3];}
+
+  //Time charged for each register read or write on top of the bus delays
+  void SetBusCycleNanos(uint32_t ns) {busCycle_ns_ = ns;}
+
+  //Shortest bus delays (PriamSmart bus delay units) the simulated interface works with
+  void SetMinBusDelays(uint8_t setup, uint8_t pulse) {minBusSetup_ = setup; minBusPulse_ = pulse;}
+
+  //Number of sector buffers in the controller (default 2)
+  void SetSectorBuffers(uint8_t buffers) {hostDone_ns_.assign(buffers ? buffers : 1, 0);}
+
+  //Controller overhead for every command
+  void SetCommandOverheadMicros(uint32_t us) {cmdOverhead_us_ = us;}
+
+  //Time charged for reading the DTREQ pin
+  void SetPinReadNanos(uint32_t ns) {pinRead_ns_ = ns;}
+
+  virtual bool RegisterRead(PriamSmart::ReadRegister address, uint8_t &value) override;
+  virtual bool RegisterWrite(PriamSmart::WriteRegister address, uint8_t value) override;
+  virtual bool PulseReset(unsigned long pulseLength_ms = 100) override;
+
+  //Statistics
+  uint64_t RegisterCycles() {return registerCycles_;}
+  uint64_t Commands() {return commands_;}
+  uint64_t DataBytes() {return dataBytes_;}
+  void ResetStatistics() {registerCycles_ = 0; commands_ = 0; dataBytes_ = 0;}
+
+  private:
+
+  enum SimState {
+    SIM_IDLE,
+    SIM_EXECUTING,
+    SIM_DATAIN,
+    SIM_COMPLETION,
+    SIM_REJECTED
+    };
+
+  //Charge one register cycle, returns false if the bus timing is too short
+  bool BusCycle();
+
+  //digitalRead() hook, DTREQ is asserted while a data byte is ready, other pins read LOW
+  static int DigitalReadHook(uint8_t pin);
+  static SimulatedPriamSmart *instance_;
+
+  void ResetController();
+  void Update();
+  uint8_t StatusRegister();
+
+  void StartCommand(uint8_t cmd);
+  void Complete(uint64_t at_ns, uint8_t driveno, TransactionStatus::CompletionType type, uint8_t code);
+  bool DriveUsable(uint8_t driveno);
+
+  void StartRead(uint8_t driveno, bool withRetry);
+  void ScheduleNextSector();
+  void FinishSector();
+
+  SimulatedDrive drives_[MAXDRIVES];
+
+  uint32_t busCycle_ns_;
+  uint8_t minBusSetup_;
+  uint8_t minBusPulse_;
+  uint32_t cmdOverhead_us_;
+  uint32_t pinRead_ns_;
+
+  SimState simState_;
+  uint64_t readyAt_ns_;
+  uint8_t params_[6];
+  uint8_t results_[6];
+
+  //Data phase
+  uint8_t readDrive_;
+  uint8_t readHead_;
+  uint16_t readCylinder_;
+  uint8_t readSector_;
+  uint8_t sectorsLeft_;
+  bool readWithRetry_;
+  bool sectorLoaded_;
+  uint16_t sectorPos_;
+  std::vector<uint8_t> sectorBuf_;
+  uint64_t prevSectorReady_ns_;
+  //Times the host emptied the last sector buffers, most recent first
+  std::vector<uint64_t> hostDone_ns_;
+
+  uint64_t registerCycles_;
+  uint64_t commands_;
+  uint64_t dataBytes_;
+};
+
+}
@@ -0,0 +1,164 @@
+#pragma once
+//Minimal Arduino core shim for building the library and sketch natively on Linux
+//Only what the priamsmart code uses is provided
+//Time is simulated: micros()/millis() return a virtual clock that only advances through
+//delay(), delayMicroseconds(), ShimAdvanceNanos() and waits for room in the Serial transmit buffer
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define HIGH 0x1
+#define LOW 0x0
+
+#define DEC 10
+#define HEX 16
+
+#define bit(b) (1UL << (b))
+
+#define PROGMEM
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#define pgm_read_dword(addr) (*(const uint32_t *)(addr))
+#define strlen_P(s) strlen(s)
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(string_literal))
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+unsigned long micros();
+unsigned long millis();
+
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+//Shim control, not part of the Arduino core
+//Virtual clock in nanoseconds
+uint64_t ShimNowNanos();
+void ShimAdvanceNanos(uint64_t ns);
+
+//digitalRead() returns the value from this hook if set, LOW otherwise
+typedef int (*ShimDigitalReadHook)(uint8_t pin);
+void ShimSetDigitalReadHook(ShimDigitalReadHook hook);
+
+//Transmit timing of an interrupt driven UART with a 64 byte buffer, like the AVR HardwareSerial
+//Bytes leave the buffer at one character time (10 bits) each, a write only waits when the buffer is full
+class ShimUartTiming
+{
+  public:
+  static const int BUFFERSIZE = 64;
+
+  ShimUartTiming(unsigned long baud = 0) : baud_(baud), busyUntil_ns_(0) {}
+
+  void SetBaud(unsigned long baud) {baud_ = baud;}
+
+  //Queue bytes, advancing the virtual clock while the buffer is full
+  void Write(size_t bytes);
+
+  //Free space in the buffer, AVR HardwareSerial reports one less than the buffer size when empty
+  int AvailableForWrite();
+
+  //Wait until the last byte has been sent
+  void Flush();
+
+  private:
+  uint64_t CharNanos() {return 10ULL * 1000000000ULL / baud_;}
+  int Queued();
+
+  unsigned long baud_;
+  uint64_t busyUntil_ns_;
+};
+
+class Print
+{
+  public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buffer, size_t size);
+  virtual int availableForWrite() {return 0;}
+  virtual void flush() {}
+
+  size_t write(const char *str) {return str ? write((const uint8_t *) str, strlen(str)) : 0;}
+
+  size_t print(const __FlashStringHelper *s) {return write(reinterpret_cast<const char *>(s));}
+  size_t print(const char *s) {return write(s);}
+  size_t print(char c) {return write((uint8_t) c);}
+  size_t print(unsigned char n, int base = DEC) {return print((unsigned long) n, base);}
+  size_t print(int n, int base = DEC) {return print((long) n, base);}
+  size_t print(unsigned int n, int base = DEC) {return print((unsigned long) n, base);}
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(long long n, int base = DEC);
+  size_t print(unsigned long long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println() {return write("\r\n");}
+  template <typename T> size_t println(T v) {size_t n = print(v); return n + println();}
+  template <typename T> size_t println(T v, int base) {size_t n = print(v, base); return n + println();}
+};
+
+class Stream : public Print
+{
+  public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+//Serial port on a pair of file descriptors (stdin/stdout by default)
+//Output goes out at once, the virtual clock follows ShimUartTiming at the baud rate set with begin()
+class HardwareSerial : public Stream
+{
+  public:
+  HardwareSerial(int rxfd, int txfd);
+
+  void begin(unsigned long baud);
+  void end() {}
+
+  //Rebind to other file descriptors
+  void SetFds(int rxfd, int txfd) {rxfd_ = rxfd; txfd_ = txfd; peek_ = -1;}
+
+  //Do not charge character time to the virtual clock
+  void SetTimed(bool timed) {timed_ = timed;}
+
+  //Exit the program when input reaches end of file and the sketch waits for more
+  void SetExitOnEof(bool exitOnEof) {exitOnEof_ = exitOnEof;}
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buffer, size_t size) override;
+  using Print::write;
+  int availableForWrite() override;
+  void flush() override;
+
+  int available() override;
+  int read() override;
+  int peek() override;
+
+  operator bool() {return true;}
+
+  private:
+  int rxfd_;
+  int txfd_;
+  int peek_;
+  unsigned long baud_;
+  bool timed_;
+  bool exitOnEof_;
+  uint64_t emptyPoll_ns_;
+  uint32_t emptyPolls_;
+  ShimUartTiming txTiming_;
+};
+
+extern HardwareSerial Serial;
@@ -0,0 +1,255 @@
+#include "Arduino.h"
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+static uint64_t shimNanos = 0;
+static ShimDigitalReadHook digitalReadHook = nullptr;
+
+HardwareSerial Serial(0, 1);
+
+uint64_t ShimNowNanos()
+{
+  return shimNanos;
+}
+
+void ShimAdvanceNanos(uint64_t ns)
+{
+  shimNanos += ns;
+}
+
+void ShimSetDigitalReadHook(ShimDigitalReadHook hook)
+{
+  digitalReadHook = hook;
+}
+
+int ShimUartTiming::Queued()
+{
+  uint64_t now = ShimNowNanos();
+  if (!baud_ || busyUntil_ns_ <= now)
+    return 0;
+  return (int) ((busyUntil_ns_ - now + CharNanos() - 1) / CharNanos());
+}
+
+void ShimUartTiming::Write(size_t bytes)
+{
+  if (!baud_)
+    return;
+
+  while (bytes--)
+  {
+    //Buffer full, wait for the oldest byte to go out
+    if (Queued() >= BUFFERSIZE - 1)
+      ShimAdvanceNanos(busyUntil_ns_ - ShimNowNanos() - (uint64_t) (BUFFERSIZE - 2) * CharNanos());
+
+    uint64_t now = ShimNowNanos();
+    busyUntil_ns_ = (busyUntil_ns_ > now ? busyUntil_ns_ : now) + CharNanos();
+  }
+}
+
+int ShimUartTiming::AvailableForWrite()
+{
+  return BUFFERSIZE - 1 - Queued();
+}
+
+void ShimUartTiming::Flush()
+{
+  if (baud_ && busyUntil_ns_ > ShimNowNanos())
+    ShimAdvanceNanos(busyUntil_ns_ - ShimNowNanos());
+}
+
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  (void) pin; (void) mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val)
+{
+  (void) pin; (void) val;
+}
+
+int digitalRead(uint8_t pin)
+{
+  if (digitalReadHook)
+    return digitalReadHook(pin);
+  return LOW;
+}
+
+void delay(unsigned long ms)
+{
+  ShimAdvanceNanos((uint64_t) ms * 1000000ULL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  ShimAdvanceNanos((uint64_t) us * 1000ULL);
+}
+
+unsigned long micros()
+{
+  return (unsigned long) (shimNanos / 1000ULL);
+}
+
+unsigned long millis()
+{
+  return (unsigned long) (shimNanos / 1000000ULL);
+}
+
+size_t Print::write(const uint8_t *buffer, size_t size)
+{
+  size_t n = 0;
+  while (size--)
+    n += write(*buffer++);
+  return n;
+}
+
+static size_t PrintNumber(Print &p, const char *fmt, unsigned long long v)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), fmt, v);
+  return p.write(buf);
+}
+
+size_t Print::print(long n, int base)
+{
+  if (base == DEC)
+  {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", n);
+    return write(buf);
+  }
+  return print((unsigned long) n, base);
+}
+
+size_t Print::print(unsigned long n, int base)
+{
+  return PrintNumber(*this, base == HEX ? "%llX" : "%llu", n);
+}
+
+size_t Print::print(long long n, int base)
+{
+  if (base == DEC)
+  {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%lld", n);
+    return write(buf);
+  }
+  return print((unsigned long long) n, base);
+}
+
+size_t Print::print(unsigned long long n, int base)
+{
+  return PrintNumber(*this, base == HEX ? "%llX" : "%llu", n);
+}
+
+size_t Print::print(double n, int digits)
+{
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+HardwareSerial::HardwareSerial(int rxfd, int txfd) :
+rxfd_(rxfd), txfd_(txfd), peek_(-1), baud_(0), timed_(true), exitOnEof_(true), emptyPoll_ns_(~0ULL), emptyPolls_(0)
+{
+}
+
+void HardwareSerial::begin(unsigned long baud)
+{
+  baud_ = baud;
+  txTiming_.SetBaud(baud);
+}
+
+int HardwareSerial::availableForWrite()
+{
+  if (!timed_)
+    return ShimUartTiming::BUFFERSIZE - 1;
+  return txTiming_.AvailableForWrite();
+}
+
+void HardwareSerial::flush()
+{
+  if (timed_)
+    txTiming_.Flush();
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  return write(&c, 1);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  size_t done = 0;
+  emptyPolls_ = 0;
+  while (done < size)
+  {
+    ssize_t n = ::write(txfd_, buffer + done, size - done);
+    if (n < 0)
+    {
+      if (errno == EINTR || errno == EAGAIN)
+        continue;
+      break;
+    }
+    done += (size_t) n;
+  }
+  if (timed_)
+    txTiming_.Write(done);
+  return done;
+}
+
+int HardwareSerial::available()
+{
+  if (peek_ >= 0)
+    return 1;
+
+  struct pollfd pfd;
+  pfd.fd = rxfd_;
+  pfd.events = POLLIN;
+  pfd.revents = 0;
+
+  //Block a little so a sketch spinning on available() does not eat a whole CPU, but only after many
+  //empty polls with nothing written and no move of the virtual clock, so checking for input
+  //in between work stays cheap
+  //The wait passes on the virtual clock too, so background work polled meanwhile makes progress
+  if (ShimNowNanos() != emptyPoll_ns_)
+    emptyPolls_ = 0;
+  bool idle = emptyPolls_ >= 100;
+  if (poll(&pfd, 1, idle ? 10 : 0) <= 0)
+  {
+    if (idle)
+      ShimAdvanceNanos(10000000ULL);
+    emptyPoll_ns_ = ShimNowNanos();
+    emptyPolls_++;
+    return 0;
+  }
+
+  uint8_t c;
+  ssize_t n = ::read(rxfd_, &c, 1);
+  if (n == 1)
+  {
+    peek_ = c;
+    return 1;
+  }
+
+  if (n == 0 && exitOnEof_)
+    exit(0);
+
+  return 0;
+}
+
+int HardwareSerial::read()
+{
+  if (!available())
+    return -1;
+  int c = peek_;
+  peek_ = -1;
+  return c;
+}
+
+int HardwareSerial::peek()
+{
+  if (!available())
+    return -1;
+  return peek_;
+}
@@ -0,0 +1,35 @@
+#pragma once
+//EEPROM shim, 1 KB like an ATmega328P, erased to 0xFF
+//Contents live in RAM unless a backing file is set with ShimEepromFile()
+#include "Arduino.h"
+
+void ShimEepromFile(const char *path);
+
+class EEPROMClass
+{
+  public:
+  static const uint16_t SIZE = 1024;
+
+  uint8_t read(int idx);
+  void write(int idx, uint8_t val);
+  void update(int idx, uint8_t val) {if (read(idx) != val) write(idx, val);}
+  uint16_t length() {return SIZE;}
+
+  template <typename T> T &get(int idx, T &t)
+  {
+    uint8_t *p = (uint8_t *) &t;
+    for (size_t i = 0; i < sizeof(T); i++)
+      p[i] = read(idx + (int) i);
+    return t;
+  }
+
+  template <typename T> const T &put(int idx, const T &t)
+  {
+    const uint8_t *p = (const uint8_t *) &t;
+    for (size_t i = 0; i < sizeof(T); i++)
+      update(idx + (int) i, p[i]);
+    return t;
+  }
+};
+
+extern EEPROMClass EEPROM;
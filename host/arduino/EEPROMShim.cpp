@@ -0,0 +1,59 @@
+#include "EEPROM.h"
+
+EEPROMClass EEPROM;
+
+static uint8_t eepromData[EEPROMClass::SIZE];
+static bool eepromLoaded = false;
+static const char *eepromPath = nullptr;
+
+static void EepromLoad()
+{
+  if (eepromLoaded)
+    return;
+
+  memset(eepromData, 0xFF, sizeof(eepromData));
+  if (eepromPath)
+  {
+    FILE *f = fopen(eepromPath, "rb");
+    if (f)
+    {
+      size_t n = fread(eepromData, 1, sizeof(eepromData), f);
+      (void) n;
+      fclose(f);
+    }
+  }
+  eepromLoaded = true;
+}
+
+void ShimEepromFile(const char *path)
+{
+  eepromPath = path;
+  eepromLoaded = false;
+}
+
+uint8_t EEPROMClass::read(int idx)
+{
+  EepromLoad();
+  if (idx < 0 || idx >= SIZE)
+    return 0xFF;
+  return eepromData[idx];
+}
+
+void EEPROMClass::write(int idx, uint8_t val)
+{
+  EepromLoad();
+  if (idx < 0 || idx >= SIZE)
+    return;
+
+  eepromData[idx] = val;
+
+  if (eepromPath)
+  {
+    FILE *f = fopen(eepromPath, "wb");
+    if (f)
+    {
+      fwrite(eepromData, 1, sizeof(eepromData), f);
+      fclose(f);
+    }
+  }
+}
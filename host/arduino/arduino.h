@@ -0,0 +1,3 @@
+#pragma once
+//Some of the library sources include the core header in lower case
+#include "Arduino.h"
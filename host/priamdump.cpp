@@ -0,0 +1,801 @@
+//Dump a drive through the host protocol of the priamsmart sketch into a raw image
+//
+//  priamdump [options] device image
+//
+//The image is sized from the drive parameters and memory mapped, each sector lands at
+//((cylinder * heads + head) * sectors + sector) * size. Sectors that never read and all zero
+//sectors are not written, they stay holes in a sparse file
+//An image name ending in .pdi is written as a DiskImage container (see DiskImage.h) with the geometry
+//and the state of every sector. An existing container of the same drive geometry is continued, only
+//the sectors it does not hold yet are read
+//
+//Options:
+//  --drive N         drive to dump (default 0)
+//  --baud B          speed the sketch talks at now (default 115200)
+//  --link-speed B    switch the link to 500000, 1000000 or 2000000 first
+//  --spinup          spin the drive up and wait until it is ready first
+//  --no-compress     DATA frames instead of PACKED frames
+//  --passes N        read passes, the later ones read the missing sectors one by one (default 4)
+//
+//Without hardware run priamsim --pty and use the pty it prints as device
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <deque>
+#include <string>
+#include <vector>
+#include "PriamHostProtocol.h"
+#include "SectorFrameDecoder.h"
+#include "DiskImage.h"
+
+using namespace Priam;
+
+//Set by SIGINT/SIGTERM, the dump stops and the image is closed properly
+static volatile sig_atomic_t interrupted = 0;
+
+static void OnSignal(int sig)
+{
+  (void) sig;
+  interrupted = 1;
+}
+
+static uint64_t NowMicros()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000ULL + (uint64_t) ts.tv_nsec / 1000;
+}
+
+static speed_t BaudConstant(unsigned long baud)
+{
+  switch (baud)
+  {
+    case 9600: return B9600;
+    case 19200: return B19200;
+    case 38400: return B38400;
+    case 57600: return B57600;
+    case 115200: return B115200;
+    case 500000: return B500000;
+    case 1000000: return B1000000;
+    case 2000000: return B2000000;
+    default: return B0;
+  }
+}
+
+//Raw serial port, no flow control in the tty layer since the binary frames carry XON/XOFF values
+class SerialPort
+{
+  public:
+  SerialPort() : fd_(-1) {}
+  ~SerialPort()
+  {
+    if (fd_ >= 0)
+      close(fd_);
+  }
+
+  bool Open(const char *path, unsigned long baud)
+  {
+    fd_ = open(path, O_RDWR | O_NOCTTY);
+    if (fd_ < 0)
+    {
+      perror(path);
+      return false;
+    }
+    return SetBaud(baud);
+  }
+
+  bool SetBaud(unsigned long baud)
+  {
+    speed_t speed = BaudConstant(baud);
+    struct termios tio;
+    if (speed == B0 || tcgetattr(fd_, &tio))
+    {
+      fprintf(stderr, "priamdump: cannot set %lu baud\n", baud);
+      return false;
+    }
+
+    tcdrain(fd_);
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(tcflag_t) CRTSCTS;
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    cfsetispeed(&tio, speed);
+    cfsetospeed(&tio, speed);
+    if (tcsetattr(fd_, TCSANOW, &tio))
+    {
+      perror("priamdump: tcsetattr");
+      return false;
+    }
+    return true;
+  }
+
+  bool Write(const uint8_t *data, size_t len)
+  {
+    while (len)
+    {
+      ssize_t n = write(fd_, data, len);
+      if (n < 0)
+      {
+        if (errno == EINTR || errno == EAGAIN)
+          continue;
+        perror("priamdump: write");
+        return false;
+      }
+      data += n;
+      len -= (size_t) n;
+    }
+    return true;
+  }
+
+  //Bytes read, 0 when nothing arrived within timeout_ms, -1 on error
+  ssize_t Read(uint8_t *data, size_t len, int timeout_ms)
+  {
+    struct pollfd pfd;
+    pfd.fd = fd_;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    int ready = poll(&pfd, 1, timeout_ms);
+    if (ready < 0)
+      return errno == EINTR ? 0 : -1;
+    if (!ready)
+      return 0;
+
+    ssize_t n = read(fd_, data, len);
+    if (n < 0)
+      return (errno == EINTR || errno == EAGAIN) ? 0 : -1;
+    return n;
+  }
+
+  private:
+  int fd_;
+};
+
+static bool AllZero(const uint8_t *data, uint16_t size)
+{
+  for (uint16_t i = 0; i < size; i++)
+    if (data[i])
+      return false;
+  return true;
+}
+
+//Where the dumped sectors go
+class ImageTarget
+{
+  public:
+  virtual ~ImageTarget() {}
+  virtual bool Open(const char *path, uint8_t drive, uint16_t cylinders, uint8_t heads, uint8_t sectorsPerTrack,
+                    uint16_t sectorSize) = 0;
+  virtual bool Write(uint32_t lba, const uint8_t *data, DiskImage::SectorState state) = 0;
+  //status is the raw controller status of the failed read
+  virtual void Fail(uint32_t lba, uint8_t status) = 0;
+  //State of a sector when the image was opened, to continue a dump
+  virtual DiskImage::SectorState State(uint32_t lba) = 0;
+  virtual bool Close() = 0;
+};
+
+//Flat image of the drive size
+class RawTarget : public ImageTarget
+{
+  public:
+  RawTarget() : image_(nullptr), imageSize_(0), sectorSize_(0) {}
+  ~RawTarget() {Close();}
+
+  bool Open(const char *path, uint8_t drive, uint16_t cylinders, uint8_t heads, uint8_t sectorsPerTrack, uint16_t sectorSize) override
+  {
+    (void) drive;
+    sectorSize_ = sectorSize;
+    imageSize_ = (size_t) cylinders * heads * sectorsPerTrack * sectorSize;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, (off_t) imageSize_))
+    {
+      perror(path);
+      if (fd >= 0)
+        close(fd);
+      return false;
+    }
+
+    void *map = mmap(nullptr, imageSize_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+      perror("priamdump: mmap");
+      return false;
+    }
+    image_ = (uint8_t *) map;
+    return true;
+  }
+
+  bool Write(uint32_t lba, const uint8_t *data, DiskImage::SectorState state) override
+  {
+    (void) state;
+    if (!AllZero(data, sectorSize_))
+      memcpy(image_ + (size_t) lba * sectorSize_, data, sectorSize_);
+    return true;
+  }
+
+  void Fail(uint32_t lba, uint8_t status) override {(void) lba; (void) status;}
+  DiskImage::SectorState State(uint32_t lba) override {(void) lba; return DiskImage::UNREAD;}
+
+  bool Close() override
+  {
+    bool ok = true;
+    if (image_)
+    {
+      ok = !msync(image_, imageSize_, MS_SYNC);
+      munmap(image_, imageSize_);
+      image_ = nullptr;
+    }
+    return ok;
+  }
+
+  private:
+  uint8_t *image_;
+  size_t imageSize_;
+  uint16_t sectorSize_;
+};
+
+class ContainerTarget : public ImageTarget
+{
+  public:
+  bool Open(const char *path, uint8_t drive, uint16_t cylinders, uint8_t heads, uint8_t sectorsPerTrack, uint16_t sectorSize) override
+  {
+    if (!access(path, F_OK) && image_.Open(path, true))
+    {
+      if (image_.Drive() == drive && image_.Cylinders() == cylinders && image_.Heads() == heads &&
+          image_.SectorsPerTrack() == sectorsPerTrack && image_.SectorSize() == sectorSize)
+      {
+        fprintf(stderr, "Continuing %s, %u of %u sectors already read\n", path,
+                image_.Count(DiskImage::GOOD) + image_.Count(DiskImage::RETRIED), image_.Sectors());
+        return true;
+      }
+      fprintf(stderr, "%s holds another drive, starting over\n", path);
+    }
+    return image_.Create(path, drive, cylinders, heads, sectorsPerTrack, sectorSize);
+  }
+
+  bool Write(uint32_t lba, const uint8_t *data, DiskImage::SectorState state) override
+  {
+    return image_.WriteSector(lba, data, state);
+  }
+
+  void Fail(uint32_t lba, uint8_t status) override {image_.SetState(lba, DiskImage::FAILED, status);}
+  DiskImage::SectorState State(uint32_t lba) override {return image_.State(lba);}
+  bool Close() override {return image_.Close();}
+
+  private:
+  DiskImage image_;
+};
+
+//Sends requests and puts the sectors that come back into the image
+class ImageDumper : public SectorFrameDecoder
+{
+  public:
+  ImageDumper(SerialPort &port, ImageTarget &target, uint8_t drive, bool compress) :
+  port_(port), target_(target), drive_(drive), compress_(compress), nextSeq_(0), window_(1), responded_(false),
+  respStatus_(0), respFlags_(0), respLen_(0), heads_(0), cylinders_(0), sectorsPerTrack_(0), sectorSize_(0),
+  open_(false), goodCount_(0), failedCount_(0), zeroCount_(0), bytes_(0), start_us_(0), lastProgress_us_(0)
+  {
+  }
+
+  //Wait until text shows up between the frames, for the menu of the sketch. The text up to the
+  //match is used up
+  bool WaitForText(const char *text, int timeout_ms)
+  {
+    uint64_t start = NowMicros();
+    for (;;)
+    {
+      size_t pos = text_.find(text);
+      if (pos != std::string::npos)
+      {
+        text_.erase(0, pos + strlen(text));
+        return true;
+      }
+      if (NowMicros() - start >= (uint64_t) timeout_ms * 1000 || Pump(50) < 0)
+        return false;
+    }
+  }
+
+  //Switch the link speed with the l menu key, the sketch has to show its menu
+  bool NegotiateBaud(unsigned long baud)
+  {
+    static const unsigned long rates[] = {115200, 500000, 1000000, 2000000};
+
+    uint8_t key = 0;
+    for (uint8_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+      if (rates[i] == baud)
+        key = (uint8_t) ('1' + i);
+    if (!key)
+    {
+      fprintf(stderr, "priamdump: the sketch does not support %lu baud\n", baud);
+      return false;
+    }
+
+    if (!WaitForText("Your choice>", 3000))
+    {
+      fprintf(stderr, "priamdump: no menu from the sketch, check --baud\n");
+      return false;
+    }
+
+    uint8_t keys[2] = {'l', key};
+    text_.clear();
+    if (!port_.Write(keys, sizeof(keys)) || !WaitForText("BAUD ", 3000) || !WaitForText("\n", 1000))
+    {
+      fprintf(stderr, "priamdump: link speed change not started\n");
+      return false;
+    }
+
+    uint8_t confirm = SerialTransport::BAUD_CONFIRM;
+    if (!port_.SetBaud(baud) || !port_.Write(&confirm, 1) || !WaitForText("OK", 2000))
+    {
+      fprintf(stderr, "priamdump: link speed change not confirmed\n");
+      return false;
+    }
+    return true;
+  }
+
+  //Enter protocol mode, a HELLO from the menu does that
+  bool Hello()
+  {
+    for (uint8_t attempt = 0; attempt < 5; attempt++)
+    {
+      if (!Transact(Request(HostProtocol::OP_HELLO), 1000))
+        continue;
+      if (respLen_ < 3 || respData_[0] != HostProtocol::VERSION)
+      {
+        fprintf(stderr, "priamdump: sketch speaks protocol version %u, need %u\n", respLen_ ? respData_[0] : 0,
+                HostProtocol::VERSION);
+        return false;
+      }
+      window_ = respData_[1];
+      if (drive_ >= respData_[2])
+      {
+        fprintf(stderr, "priamdump: the sketch has %u drives\n", respData_[2]);
+        return false;
+      }
+      return true;
+    }
+    fprintf(stderr, "priamdump: no answer from the sketch\n");
+    return false;
+  }
+
+  bool Spinup()
+  {
+    fprintf(stderr, "Spinning up drive %u\n", drive_);
+    return Transact(Request(HostProtocol::OP_SPINUP), 120000) && CheckResponse("spin up");
+  }
+
+  bool ReadParams()
+  {
+    if (!Transact(Request(HostProtocol::OP_PARAMS), 10000) || !CheckResponse("reading drive parameters"))
+      return false;
+    if (respLen_ < 6)
+      return false;
+
+    heads_ = respData_[0];
+    cylinders_ = (uint16_t) ((respData_[1] << 8) | respData_[2]);
+    sectorsPerTrack_ = respData_[3];
+    sectorSize_ = (uint16_t) ((respData_[4] << 8) | respData_[5]);
+    if (!heads_ || !cylinders_ || !sectorsPerTrack_ || !sectorSize_)
+    {
+      fprintf(stderr, "priamdump: drive reports no geometry\n");
+      return false;
+    }
+
+    fprintf(stderr, "Drive %u: %u cylinders, %u heads, %u sectors of %u bytes\n", drive_, cylinders_, heads_, sectorsPerTrack_,
+            sectorSize_);
+    return true;
+  }
+
+  //Sectors the image already holds are not read again
+  bool OpenImage(const char *path)
+  {
+    if (!target_.Open(path, drive_, cylinders_, heads_, sectorsPerTrack_, sectorSize_))
+      return false;
+
+    good_.assign(Sectors(), false);
+    failed_.assign(Sectors(), false);
+    retried_.assign(Sectors(), false);
+    for (uint32_t lba = 0; lba < Sectors(); lba++)
+    {
+      DiskImage::SectorState state = target_.State(lba);
+      if (state == DiskImage::GOOD || state == DiskImage::RETRIED)
+      {
+        good_[lba] = true;
+        goodCount_++;
+      }
+    }
+    open_ = true;
+    return true;
+  }
+
+  bool CloseImage() {return target_.Close();}
+
+  //Like the tiered retry policy of the sketch (see PriamRetryPolicy.h) the first pass reads track by
+  //track without controller retries, the others read the sectors still missing one by one with retries
+  //and give up on the ones the controller fails
+  bool Dump(unsigned passes)
+  {
+    start_us_ = NowMicros();
+
+    for (unsigned pass = 0; pass < passes; pass++)
+    {
+      std::vector<HostRequest> requests;
+      for (uint32_t lba = 0; lba < Sectors(); lba++)
+      {
+        if (good_[lba] || failed_[lba])
+          continue;
+
+        HostRequest request = Request(HostProtocol::OP_READ);
+        request.cylinder = (uint16_t) (lba / ((uint32_t) heads_ * sectorsPerTrack_));
+        request.head = (uint8_t) (lba / sectorsPerTrack_ % heads_);
+        request.sector = (uint8_t) (lba % sectorsPerTrack_);
+        request.count = 1;
+        if (!pass)
+        {
+          request.count = (uint16_t) (sectorsPerTrack_ - request.sector);
+          request.flags |= HostProtocol::FLAG_NORETRY;
+          lba += request.count - 1;
+        }
+        if (compress_)
+          request.flags |= HostProtocol::FLAG_COMPRESS;
+        requests.push_back(request);
+      }
+
+      if (requests.empty())
+        break;
+      if (pass)
+        fprintf(stderr, "\nPass %u: %u sectors missing\n", pass + 1, (unsigned) requests.size());
+      if (!RunRequests(requests, 30000))
+        return false;
+    }
+
+    Progress(true);
+    fprintf(stderr, "\n");
+    return true;
+  }
+
+  void Exit()
+  {
+    HostRequest request = Request(HostProtocol::OP_EXIT);
+    uint8_t frame[HostProtocol::MAXFRAMESIZE];
+    port_.Write(frame, HostProtocol::EncodeRequest(request, frame));
+  }
+
+  void Report()
+  {
+    fprintf(stderr, "%u of %u sectors read, %u all zero left sparse, %u failed\n", goodCount_, Sectors(), zeroCount_,
+            failedCount_);
+    fprintf(stderr, "%llu frames, %llu bad frames, %llu sector CRC errors, %llu sectors lost\n", (unsigned long long) Frames(),
+            (unsigned long long) BadFrames(), (unsigned long long) SectorCrcErrors(), (unsigned long long) SectorsLost());
+
+    unsigned shown = 0;
+    for (uint32_t lba = 0; lba < Sectors(); lba++)
+    {
+      if (good_[lba])
+        continue;
+      if (shown++ == 20)
+      {
+        fprintf(stderr, "...\n");
+        break;
+      }
+      fprintf(stderr, "%s h:%u c:%u s:%u\n", failed_[lba] ? "Failed " : "Missing", (unsigned) (lba / sectorsPerTrack_ % heads_),
+              (unsigned) (lba / ((uint32_t) heads_ * sectorsPerTrack_)), (unsigned) (lba % sectorsPerTrack_));
+    }
+  }
+
+  bool Complete() {return goodCount_ == Sectors();}
+
+  protected:
+  void OnSector(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, const uint8_t *data, uint16_t size) override
+  {
+    if (!open_ || drive != drive_ || size != sectorSize_ || head >= heads_ || cylinder >= cylinders_ || sector >= sectorsPerTrack_)
+      return;
+
+    uint32_t lba = ((uint32_t) cylinder * heads_ + head) * sectorsPerTrack_ + sector;
+    bytes_ += size;
+    if (good_[lba])
+      return;
+
+    if (AllZero(data, size))
+      zeroCount_++;
+    if (!target_.Write(lba, data, retried_[lba] ? DiskImage::RETRIED : DiskImage::GOOD))
+      return;
+
+    good_[lba] = true;
+    goodCount_++;
+    if (failed_[lba])
+    {
+      failed_[lba] = false;
+      failedCount_--;
+    }
+  }
+
+  //Diagnostic from the sketch library, event codes are Priam::Log::Event
+  void OnEvent(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t level, uint8_t event, uint8_t value) override
+  {
+    static const char *levels[] = {"", "error", "warning", "info", "debug"};
+    fprintf(stderr, "\npriamdump: interface %s, event %u value 0x%02X (drive %u h:%u c:%u)\n",
+            level < 5 ? levels[level] : "message", event, value, drive, head, cylinder);
+  }
+
+  void OnResponse(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t seq, uint8_t op, uint8_t status, uint8_t flags,
+                  const uint8_t *data, uint8_t len) override
+  {
+    (void) drive; (void) head; (void) cylinder; (void) op;
+
+    //Requests run in order, the ones before this without a response lost it on the link
+    size_t i = 0;
+    while (i < outstanding_.size() && outstanding_[i].seq != seq)
+      i++;
+    if (i == outstanding_.size())
+      return;
+
+    HostRequest request = outstanding_[i];
+    outstanding_.erase(outstanding_.begin(), outstanding_.begin() + (long) i + 1);
+
+    responded_ = true;
+    respStatus_ = status;
+    respFlags_ = flags;
+    respLen_ = len;
+    memcpy(respData_, data, len);
+
+    if (request.op != HostProtocol::OP_READ || !(flags & HostProtocol::RESPONSEFLAG_ERROR) || len < 6 || !open_)
+      return;
+
+    //The read stopped at the command from head/cylinder/sector in the response, the sectors of that command
+    //before the failing one were transferred. A single sector read failed for good
+    uint32_t first = ((uint32_t) request.cylinder * heads_ + request.head) * sectorsPerTrack_ + request.sector;
+    uint32_t end = first + request.count;
+    uint32_t lba = ((uint32_t) ((data[3] << 8) | data[4]) * heads_ + data[2]) * sectorsPerTrack_ + data[5];
+    while (lba < end && lba < Sectors() && good_[lba])
+      lba++;
+    if (lba >= end || lba >= Sectors())
+      return;
+
+    retried_[lba] = true;
+    if (request.count == 1 && !failed_[lba])
+    {
+      failed_[lba] = true;
+      failedCount_++;
+      target_.Fail(lba, status);
+    }
+  }
+
+  private:
+  HostRequest Request(uint8_t op)
+  {
+    HostRequest request;
+    memset(&request, 0, sizeof(request));
+    request.op = op;
+    request.drive = drive_;
+    return request;
+  }
+
+  uint32_t Sectors() {return (uint32_t) cylinders_ * heads_ * sectorsPerTrack_;}
+
+  bool Submit(HostRequest request)
+  {
+    request.seq = nextSeq_++;
+    uint8_t frame[HostProtocol::MAXFRAMESIZE];
+    if (!port_.Write(frame, HostProtocol::EncodeRequest(request, frame)))
+      return false;
+    outstanding_.push_back(request);
+    return true;
+  }
+
+  //Read what arrived within timeout_ms and feed it to the decoder, -1 when the port failed
+  ssize_t Pump(int timeout_ms)
+  {
+    uint8_t buffer[4096];
+    ssize_t n = port_.Read(buffer, sizeof(buffer), timeout_ms);
+    if (n < 0)
+    {
+      perror("priamdump: read");
+      return -1;
+    }
+
+    Feed(buffer, (size_t) n);
+    text_.append((const char *) buffer, (size_t) n);
+    if (text_.size() > 256)
+      text_.erase(0, text_.size() - 256);
+    return n;
+  }
+
+  //One request, true when its response arrived
+  bool Transact(const HostRequest &request, int timeout_ms)
+  {
+    responded_ = false;
+    outstanding_.clear();
+    if (!Submit(request))
+      return false;
+
+    uint64_t start = NowMicros();
+    while (!responded_ && NowMicros() - start < (uint64_t) timeout_ms * 1000)
+      if (Pump(50) < 0)
+        return false;
+
+    outstanding_.clear();
+    return responded_;
+  }
+
+  bool CheckResponse(const char *what)
+  {
+    if (!(respFlags_ & (HostProtocol::RESPONSEFLAG_COMMSERROR | HostProtocol::RESPONSEFLAG_REJECTED | HostProtocol::RESPONSEFLAG_ERROR)))
+      return true;
+    fprintf(stderr, "priamdump: %s failed, status 0x%02X flags 0x%02X\n", what, respStatus_, respFlags_);
+    return false;
+  }
+
+  //Keep up to the queue size of the sketch outstanding. When nothing arrives for stall_ms the
+  //outstanding requests are given up, their sectors are read in the next pass
+  bool RunRequests(const std::vector<HostRequest> &requests, int stall_ms)
+  {
+    size_t next = 0;
+    uint64_t lastRx = NowMicros();
+
+    outstanding_.clear();
+    while (next < requests.size() || !outstanding_.empty())
+    {
+      if (interrupted)
+      {
+        fprintf(stderr, "\npriamdump: interrupted\n");
+        return false;
+      }
+
+      while (next < requests.size() && outstanding_.size() < window_)
+        if (!Submit(requests[next++]))
+          return false;
+
+      ssize_t n = Pump(100);
+      if (n < 0)
+        return false;
+      if (n)
+        lastRx = NowMicros();
+      else if (NowMicros() - lastRx > (uint64_t) stall_ms * 1000)
+      {
+        fprintf(stderr, "\npriamdump: no data for %d s, skipping %u requests\n", stall_ms / 1000, (unsigned) outstanding_.size());
+        outstanding_.clear();
+        lastRx = NowMicros();
+      }
+
+      Progress(false);
+    }
+    return true;
+  }
+
+  void Progress(bool force)
+  {
+    uint64_t now = NowMicros();
+    if (!force && now - lastProgress_us_ < 250000)
+      return;
+    lastProgress_us_ = now;
+
+    double seconds = (double) (now - start_us_) / 1e6;
+    double rate = seconds > 0 ? (double) bytes_ / seconds : 0;
+    uint32_t left = Sectors() - goodCount_ - failedCount_;
+    unsigned eta = rate > 0 ? (unsigned) ((double) left * sectorSize_ / rate) : 0;
+
+    fprintf(stderr, "\r%5.1f%%  %8.1f KiB/s  ETA %3u:%02u  failed %u  lost %llu   ",
+            100.0 * (goodCount_ + failedCount_) / Sectors(), rate / 1024, eta / 60, eta % 60, failedCount_,
+            (unsigned long long) SectorsLost());
+  }
+
+  SerialPort &port_;
+  ImageTarget &target_;
+  uint8_t drive_;
+  bool compress_;
+
+  uint8_t nextSeq_;
+  size_t window_;
+  std::deque<HostRequest> outstanding_;
+  std::string text_;
+
+  //Last response
+  bool responded_;
+  uint8_t respStatus_;
+  uint8_t respFlags_;
+  uint8_t respLen_;
+  uint8_t respData_[256];
+
+  uint8_t heads_;
+  uint16_t cylinders_;
+  uint8_t sectorsPerTrack_;
+  uint16_t sectorSize_;
+
+  bool open_;
+  std::vector<bool> good_;
+  std::vector<bool> failed_;
+  //Sectors the controller failed on at least once
+  std::vector<bool> retried_;
+  uint32_t goodCount_;
+  uint32_t failedCount_;
+  uint32_t zeroCount_;
+
+  uint64_t bytes_;
+  uint64_t start_us_;
+  uint64_t lastProgress_us_;
+};
+
+static void Usage()
+{
+  fprintf(stderr, "usage: priamdump [--drive N] [--baud B] [--link-speed B] [--spinup] [--no-compress] [--passes N] device image\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  const char *device = nullptr, *image = nullptr;
+  unsigned long baud = 115200, linkSpeed = 0;
+  unsigned drive = 0, passes = 4;
+  bool spinup = false, compress = true;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *a = argv[i];
+    const char *v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+    if (!strcmp(a, "--drive") && v)
+      drive = (unsigned) strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(a, "--baud") && v)
+      baud = strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(a, "--link-speed") && v)
+      linkSpeed = strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(a, "--spinup"))
+      spinup = true;
+    else if (!strcmp(a, "--no-compress"))
+      compress = false;
+    else if (!strcmp(a, "--passes") && v)
+      passes = (unsigned) strtoul(argv[++i], nullptr, 0);
+    else if (a[0] == '-')
+      Usage();
+    else if (!device)
+      device = a;
+    else if (!image)
+      image = a;
+    else
+      Usage();
+  }
+  if (!device || !image || drive > 255 || !passes)
+    Usage();
+
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+
+  SerialPort port;
+  if (!port.Open(device, baud))
+    return 1;
+
+  size_t nameLen = strlen(image);
+  RawTarget raw;
+  ContainerTarget container;
+  ImageTarget &target = (nameLen > 4 && !strcmp(image + nameLen - 4, ".pdi")) ? (ImageTarget &) container : (ImageTarget &) raw;
+
+  ImageDumper dumper(port, target, (uint8_t) drive, compress);
+  if (linkSpeed && linkSpeed != baud && !dumper.NegotiateBaud(linkSpeed))
+    return 1;
+
+  //Give the menu a moment so the request does not arrive while the sketch empties its input
+  dumper.WaitForText("Your choice>", 2000);
+  if (!dumper.Hello())
+    return 1;
+  if (spinup && !dumper.Spinup())
+    return 1;
+  if (!dumper.ReadParams() || !dumper.OpenImage(image))
+    return 1;
+
+  bool ok = dumper.Dump(passes);
+  dumper.Exit();
+  dumper.Report();
+  ok = dumper.CloseImage() && ok;
+  return ok && dumper.Complete() ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+//Look into and combine disk image containers written by priamdump (see DiskImage.h)
+//
+//  priamimg info image.pdi               geometry and how many sectors are in which state
+//  priamimg bad image.pdi                failed and unread regions
+//  priamimg read image.pdi cyl head sec  hex dump of one sector
+//  priamimg raw image.pdi out.img        flat image, unread and zero sectors stay holes
+//  priamimg merge out.pdi in.pdi...      best copy of every sector from several partial dumps
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+#include "DiskImage.h"
+
+using namespace Priam;
+
+static const char *StateName(DiskImage::SectorState state)
+{
+  switch (state)
+  {
+    case DiskImage::GOOD: return "good";
+    case DiskImage::RETRIED: return "retried";
+    case DiskImage::FAILED: return "failed";
+    default: return "unread";
+  }
+}
+
+//Which copy merge keeps
+static int Rank(DiskImage::SectorState state)
+{
+  switch (state)
+  {
+    case DiskImage::GOOD: return 3;
+    case DiskImage::RETRIED: return 2;
+    case DiskImage::FAILED: return 1;
+    default: return 0;
+  }
+}
+
+static int Info(DiskImage &image)
+{
+  printf("Drive %u: %u cylinders, %u heads, %u sectors of %u bytes, %u sectors\n", image.Drive(), image.Cylinders(),
+         image.Heads(), image.SectorsPerTrack(), image.SectorSize(), image.Sectors());
+  for (int state = DiskImage::UNREAD; state <= DiskImage::FAILED; state++)
+    printf("%-8s %u\n", StateName((DiskImage::SectorState) state), image.Count((DiskImage::SectorState) state));
+  return 0;
+}
+
+//Runs of sectors in the same state and with the same status
+static int Bad(DiskImage &image)
+{
+  uint32_t lba = 0;
+  while (lba < image.Sectors())
+  {
+    DiskImage::SectorState state = image.State(lba);
+    uint8_t status = image.Status(lba);
+    uint32_t end = lba + 1;
+    while (end < image.Sectors() && image.State(end) == state && image.Status(end) == status)
+      end++;
+
+    if (state == DiskImage::UNREAD || state == DiskImage::FAILED)
+    {
+      uint8_t head, sector, lastHead, lastSector;
+      uint16_t cylinder, lastCylinder;
+      image.Chs(lba, head, cylinder, sector);
+      image.Chs(end - 1, lastHead, lastCylinder, lastSector);
+      printf("%-7s h:%u c:%u s:%u - h:%u c:%u s:%u (%u sectors)", StateName(state), head, cylinder, sector, lastHead,
+             lastCylinder, lastSector, end - lba);
+      if (state == DiskImage::FAILED)
+        printf(" completion type %u code 0x%X", status >> 4, status & 0xF);
+      printf("\n");
+    }
+    lba = end;
+  }
+  return 0;
+}
+
+static int Read(DiskImage &image, const char *cyl, const char *head, const char *sec)
+{
+  unsigned long c = strtoul(cyl, nullptr, 0), h = strtoul(head, nullptr, 0), s = strtoul(sec, nullptr, 0);
+  if (c >= image.Cylinders() || h >= image.Heads() || s >= image.SectorsPerTrack())
+  {
+    fprintf(stderr, "priamimg: sector outside the disk\n");
+    return 1;
+  }
+
+  uint32_t lba = image.Lba((uint8_t) h, (uint16_t) c, (uint8_t) s);
+  std::vector<uint8_t> data(image.SectorSize());
+  image.ReadSector(lba, data.data());
+
+  printf("h:%lu c:%lu s:%lu %s\n", h, c, s, StateName(image.State(lba)));
+  for (size_t i = 0; i < data.size(); i += 16)
+  {
+    printf("%04zX ", i);
+    for (size_t j = i; j < i + 16 && j < data.size(); j++)
+      printf(" %02X", data[j]);
+    printf("\n");
+  }
+  return 0;
+}
+
+static int Raw(DiskImage &image, const char *path)
+{
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0 || ftruncate(fd, (off_t) image.Sectors() * image.SectorSize()))
+  {
+    perror(path);
+    return 1;
+  }
+
+  for (uint32_t lba = 0; lba < image.Sectors(); lba++)
+  {
+    const uint8_t *data = image.Sector(lba);
+    if (data && pwrite(fd, data, image.SectorSize(), (off_t) lba * image.SectorSize()) != image.SectorSize())
+    {
+      perror(path);
+      close(fd);
+      return 1;
+    }
+  }
+  return close(fd) ? 1 : 0;
+}
+
+static int Merge(const char *path, int count, char **inputs)
+{
+  std::vector<DiskImage> images(count);
+  for (int i = 0; i < count; i++)
+  {
+    if (!images[i].Open(inputs[i], false))
+      return 1;
+    if (!images[i].SameGeometry(images[0]))
+    {
+      fprintf(stderr, "priamimg: %s has another geometry than %s\n", inputs[i], inputs[0]);
+      return 1;
+    }
+  }
+
+  DiskImage out;
+  DiskImage &first = images[0];
+  if (!out.Create(path, first.Drive(), first.Cylinders(), first.Heads(), first.SectorsPerTrack(), first.SectorSize()))
+    return 1;
+
+  std::vector<uint8_t> data(first.SectorSize());
+  for (uint32_t lba = 0; lba < first.Sectors(); lba++)
+  {
+    int best = 0;
+    for (int i = 1; i < count; i++)
+      if (Rank(images[i].State(lba)) > Rank(images[best].State(lba)))
+        best = i;
+
+    DiskImage::SectorState state = images[best].State(lba);
+    if (state == DiskImage::GOOD || state == DiskImage::RETRIED)
+    {
+      images[best].ReadSector(lba, data.data());
+      if (!out.WriteSector(lba, data.data(), state, images[best].Status(lba)))
+        return 1;
+    }
+    else
+      out.SetState(lba, state, images[best].Status(lba));
+  }
+
+  Info(out);
+  return out.Close() ? 0 : 1;
+}
+
+static void Usage()
+{
+  fprintf(stderr, "usage: priamimg info|bad image.pdi\n"
+                  "       priamimg read image.pdi cylinder head sector\n"
+                  "       priamimg raw image.pdi out.img\n"
+                  "       priamimg merge out.pdi in.pdi...\n");
+  exit(2);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+    Usage();
+
+  const char *cmd = argv[1];
+  if (!strcmp(cmd, "merge"))
+  {
+    if (argc < 4)
+      Usage();
+    return Merge(argv[2], argc - 3, argv + 3);
+  }
+
+  DiskImage image;
+  if (!image.Open(argv[2], false))
+    return 1;
+
+  if (!strcmp(cmd, "info") && argc == 3)
+    return Info(image);
+  if (!strcmp(cmd, "bad") && argc == 3)
+    return Bad(image);
+  if (!strcmp(cmd, "read") && argc == 6)
+    return Read(image, argv[3], argv[4], argv[5]);
+  if (!strcmp(cmd, "raw") && argc == 4)
+    return Raw(image, argv[3]);
+  Usage();
+  return 2;
+}
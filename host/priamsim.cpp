@@ -0,0 +1,777 @@
+//Native Linux build of the priamsmart sketch against the simulated Smart Interface
+//
+//  priamsim [options] [sketch]   run the sketch, Serial on stdin/stdout
+//  priamsim [options] bench      dump benchmarks on simulated time
+//  priamsim [options] test       fault injection checks on drive 0, exit status 1 if one fails
+//
+//Options:
+//  --drive N=image:cylinders:heads:sectors:sectorsize   attach drive N (image may be empty for an all zero disk)
+//  --rpm R                 rotational speed (default 3600)
+//  --seek settle_us,percyl_us  seek time model (default 3000,50)
+//  --spinup ms             spin up time (default 20000)
+//  --spun-down             drives start spun down
+//  --weak N:head:cyl:sec   sector that only reads with retry
+//  --bad N:head:cyl:sec    sector that never reads
+//  --late N:head:cyl:sec   sector that is transferred, then the command ends with a data error on it
+//  --bus-ns ns             time per register cycle on top of the bus delays (default 2000)
+//  --buffers N             sector buffers in the controller (default 2)
+//  --bus-min setup,pulse   shortest working bus delays in 250 ns units (default 1,2)
+//  --eeprom file           keep the EEPROM contents in file
+//  --no-uart-time          do not charge Serial output to the simulated clock
+//  --dtreq                 start with the DTREQ data phase handshake on (validated on the first sector read)
+//  --no-dtreq              start with the DTREQ data phase handshake off (the default of the library)
+//  --pty                   sketch mode: Serial on a new pseudo terminal instead of stdin/stdout, for host programs
+//                          like priamdump. The name of the pty goes to stderr
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <termios.h>
+#include "Arduino.h"
+#include "EEPROM.h"
+#include "SectorFrameDecoder.h"
+#include "PriamBlockDevice.h"
+#include "PriamScatterRead.h"
+
+#include "../priamsmart.ino"
+
+//Discards output but charges character time at a baud rate, stands in for the serial link in benchmarks
+class TimedNullPrint : public Print
+{
+  public:
+  TimedNullPrint(unsigned long baud) : timing_(baud), bytes_(0) {}
+  size_t write(uint8_t c) override
+  {
+    (void) c;
+    bytes_++;
+    timing_.Write(1);
+    return 1;
+  }
+  using Print::write;
+  int availableForWrite() override {return timing_.AvailableForWrite();}
+  void flush() override {timing_.Flush();}
+  uint64_t Bytes() {return bytes_;}
+
+  private:
+  ShimUartTiming timing_;
+  uint64_t bytes_;
+};
+
+//Serial link into a frame decoder that checks every sector against the simulated disk of its drive
+class VerifyingLink : public Print, public SectorFrameDecoder
+{
+  public:
+  VerifyingLink(unsigned long baud, SimulatedPriamSmart &sim) :
+  timing_(baud), sim_(sim), sectors_(0), mismatches_(0), responses_(0), failedResponses_(0), corruptEvery_(0), written_(0)
+  {
+    for (uint8_t d = 0; d < SimulatedPriamSmart::MAXDRIVES; d++)
+    {
+      SimulatedDrive &drive = sim.Drive(d);
+      good_[d].assign((size_t) drive.Cylinders() * drive.Heads() * drive.SectorsPerTrack(), false);
+    }
+  }
+  size_t write(uint8_t c) override
+  {
+    timing_.Write(1);
+    if (corruptEvery_ && !(++written_ % corruptEvery_))
+      c ^= 0x10;
+    Feed(c);
+    return 1;
+  }
+
+  //Flip a bit in every nth byte sent, 0 for a clean link
+  void SetCorruptEvery(uint64_t n) {corruptEvery_ = n;}
+
+  //Sectors that arrived intact and matched the disk, by LBA
+  bool Good(size_t lba, uint8_t drive = 0) {return good_[drive][lba];}
+  using Print::write;
+  int availableForWrite() override {return timing_.AvailableForWrite();}
+  void flush() override {timing_.Flush();}
+
+  uint64_t Sectors() {return sectors_;}
+  uint64_t Mismatches() {return mismatches_;}
+  uint64_t Responses() {return responses_;}
+  uint64_t FailedResponses() {return failedResponses_;}
+
+  protected:
+  void OnSector(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, const uint8_t *data, uint16_t size) override
+  {
+    SimulatedDrive &disk = sim_.Drive(drive);
+    std::vector<uint8_t> expect(disk.SectorSize());
+    disk.ReadSector(head, cylinder, sector, expect.data());
+    sectors_++;
+    if (drive >= SimulatedPriamSmart::MAXDRIVES || size != expect.size() || memcmp(data, expect.data(), size))
+      mismatches_++;
+    else
+      good_[drive][((size_t) cylinder * disk.Heads() + head) * disk.SectorsPerTrack() + sector] = true;
+  }
+
+  void OnResponse(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t seq, uint8_t op, uint8_t status, uint8_t flags,
+                  const uint8_t *data, uint8_t len) override
+  {
+    (void) drive; (void) head; (void) cylinder; (void) seq; (void) op; (void) status; (void) data; (void) len;
+    responses_++;
+    if (flags)
+      failedResponses_++;
+  }
+
+  private:
+  ShimUartTiming timing_;
+  SimulatedPriamSmart &sim_;
+  uint64_t sectors_;
+  uint64_t mismatches_;
+  uint64_t responses_;
+  uint64_t failedResponses_;
+  uint64_t corruptEvery_;
+  uint64_t written_;
+  std::vector<bool> good_[SimulatedPriamSmart::MAXDRIVES];
+};
+
+//Host protocol requests, all sent at once. HostProtocol only reads them while its queue has room
+class RequestStream : public Stream
+{
+  public:
+  RequestStream() : pos_(0) {}
+
+  void Add(const HostRequest &request)
+  {
+    uint8_t frame[HostProtocol::MAXFRAMESIZE];
+    uint8_t len = HostProtocol::EncodeRequest(request, frame);
+    data_.insert(data_.end(), frame, frame + len);
+  }
+
+  size_t write(uint8_t c) override {(void) c; return 1;}
+  using Print::write;
+  int available() override {return (int) (data_.size() - pos_);}
+  int read() override {return pos_ < data_.size() ? data_[pos_++] : -1;}
+  int peek() override {return pos_ < data_.size() ? data_[pos_] : -1;}
+
+  private:
+  std::vector<uint8_t> data_;
+  size_t pos_;
+};
+
+//Serial on a pseudo terminal. The slave side stays open here too, so the sketch does not see a
+//hang up when a host program closes the port and the next one can connect
+static bool OpenPty()
+{
+  int master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master < 0 || grantpt(master) || unlockpt(master))
+  {
+    perror("priamsim: pty");
+    return false;
+  }
+
+  const char *name = ptsname(master);
+  int slave = open(name, O_RDWR | O_NOCTTY);
+  if (slave < 0)
+  {
+    perror(name);
+    return false;
+  }
+
+  struct termios tio;
+  tcgetattr(slave, &tio);
+  cfmakeraw(&tio);
+  tcsetattr(slave, TCSANOW, &tio);
+
+  fprintf(stderr, "priamsim: serial port on %s\n", name);
+  Serial.SetFds(master, master);
+  return true;
+}
+
+static void Usage()
+{
+  fprintf(stderr, "usage: priamsim [--drive N=image:cyl:heads:spt:size] [--rpm R] [--seek settle,percyl] [--spinup ms]\n"
+                  "                [--spun-down] [--weak N:h:c:s] [--bad N:h:c:s] [--late N:h:c:s] [--bus-ns ns]\n"
+                  "                [--buffers N] [--bus-min setup,pulse] [--eeprom file] [--no-uart-time]\n"
+                  "                [--dtreq|--no-dtreq] [--pty] [sketch|bench|test]\n");
+  exit(2);
+}
+
+static bool ParseDrive(const char *arg)
+{
+  char image[1024] = {0};
+  unsigned drive, cyl, heads, spt, size;
+  const char *eq = strchr(arg, '=');
+  if (!eq || sscanf(arg, "%u=", &drive) != 1 || drive >= SimulatedPriamSmart::MAXDRIVES)
+    return false;
+
+  const char *geom = strchr(eq + 1, ':');
+  if (!geom || (size_t) (geom - eq - 1) >= sizeof(image))
+    return false;
+  memcpy(image, eq + 1, (size_t) (geom - eq - 1));
+
+  if (sscanf(geom + 1, "%u:%u:%u:%u", &cyl, &heads, &spt, &size) != 4)
+    return false;
+
+  return smartInterface.Drive((uint8_t) drive).Attach(image[0] ? image : nullptr, (uint16_t) cyl, (uint8_t) heads, (uint8_t) spt, (uint16_t) size);
+}
+
+//option is --weak, --bad or --late
+static bool ParseSector(const char *arg, const char *option)
+{
+  unsigned drive, head, cyl, sec;
+  if (sscanf(arg, "%u:%u:%u:%u", &drive, &head, &cyl, &sec) != 4 || drive >= SimulatedPriamSmart::MAXDRIVES)
+    return false;
+  SimulatedDrive &drv = smartInterface.Drive((uint8_t) drive);
+  if (!strcmp(option, "--bad"))
+    drv.AddBadSector((uint8_t) head, (uint16_t) cyl, (uint8_t) sec);
+  else if (!strcmp(option, "--late"))
+    drv.AddLateErrorSector((uint8_t) head, (uint16_t) cyl, (uint8_t) sec);
+  else
+    drv.AddWeakSector((uint8_t) head, (uint16_t) cyl, (uint8_t) sec);
+  return true;
+}
+
+static void BenchReport(const char *name, uint64_t startNanos, uint64_t bytes)
+{
+  double secs = (double) (ShimNowNanos() - startNanos) / 1e9;
+  fprintf(stderr, "%-38s %10.2f s %10.1f KB/s  %8llu commands %12llu register cycles\n", name, secs,
+          secs > 0 ? (double) bytes / 1024.0 / secs : 0.0,
+          (unsigned long long) smartInterface.Commands(), (unsigned long long) smartInterface.RegisterCycles());
+}
+
+static uint32_t scatterDone = 0;
+static void CountScatterDone(uint16_t id, TransactionStatus status)
+{
+  (void) id;
+  if (!status.CommsError() && !status.IsErrorStatus())
+    scatterDone++;
+}
+
+static void Bench()
+{
+  SimulatedDrive &drv = smartInterface.Drive(0);
+  uint64_t diskBytes = (uint64_t) drv.Cylinders() * drv.Heads() * drv.SectorsPerTrack() * drv.SectorSize();
+  uint64_t start;
+
+  fprintf(stderr, "Drive 0: %u cylinders, %u heads, %u sectors/track, %u bytes/sector\n",
+          drv.Cylinders(), drv.Heads(), drv.SectorsPerTrack(), drv.SectorSize());
+
+  //One command per sector, like the original ReadAllSectors
+  {
+    NullDataSink sink;
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    for (uint16_t cyl = 0; cyl < drv.Cylinders(); cyl++)
+      for (uint8_t head = 0; head < drv.Heads(); head++)
+        for (uint8_t sector = 0; sector < drv.SectorsPerTrack(); sector++)
+          priamDrive.ReadData(0, head, cyl, sector, 1, sink);
+    BenchReport("per sector, no output", start, diskBytes);
+  }
+
+  //Whole track commands
+  {
+    NullDataSink sink;
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    priamDrive.DumpTracks(0, sink);
+    BenchReport("per track, no output", start, diskBytes);
+  }
+
+  //Whole track commands, the other DTREQ handshake setting
+  {
+    NullDataSink sink;
+    bool dtreq = smartInterface.DtreqHandshakeEnabled();
+    smartInterface.UseDtreqHandshake(!dtreq);
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    priamDrive.DumpTracks(0, sink);
+    BenchReport(dtreq ? "per track, no DTREQ handshake" : "per track, DTREQ handshake", start, diskBytes);
+    fprintf(stderr, "%-38s DTREQ handshake %s\n", "", smartInterface.DtreqHandshakeValidated() ? "validated" :
+            smartInterface.DtreqHandshakeEnabled() ? "not validated" : "off");
+    smartInterface.UseDtreqHandshake(dtreq);
+  }
+
+  //Whole track commands with controller retries, the dump before retry tiers
+  {
+    NullDataSink sink;
+    priamDrive.SetRetryPolicy(RetryPolicy::ControllerRetryOnly());
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    priamDrive.DumpTracks(0, sink);
+    BenchReport("per track, controller retry only", start, diskBytes);
+    priamDrive.SetRetryPolicy(RetryPolicy());
+  }
+
+  //Whole track commands, binary frames and hex dump over a 115200 baud link
+  {
+    TimedNullPrint link(115200);
+    SectorStream stream(link, SectorStream::OutputMode::BINARY);
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    priamDrive.DumpTracks(0, stream);
+    BenchReport("per track, binary @115200", start, diskBytes);
+  }
+
+  //Same through a SectorPipeline, the link drains while the controller reads
+  {
+    TimedNullPrint link(115200);
+    SectorPipeline pipeline(link);
+    SectorStream stream(pipeline, SectorStream::OutputMode::BINARY);
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    priamDrive.DumpTracks(0, stream);
+    pipeline.flush();
+    link.flush();
+    BenchReport("per track, binary @115200 pipelined", start, diskBytes);
+  }
+
+  //Compressed frames, decoded and checked on the receiving end
+  {
+    VerifyingLink link(115200, smartInterface);
+    SectorPipeline pipeline(link);
+    SectorStream stream(pipeline, SectorStream::OutputMode::COMPRESSED);
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    priamDrive.DumpTracks(0, stream);
+    pipeline.flush();
+    link.flush();
+    BenchReport("per track, compressed @115200", start, diskBytes);
+    fprintf(stderr, "%-38s %llu sectors decoded, %llu bad frames, %llu mismatches\n", "", (unsigned long long) link.Sectors(),
+            (unsigned long long) link.BadFrames(), (unsigned long long) link.Mismatches());
+  }
+
+  //Host protocol, one compressed READ request per cylinder, queued ahead while the previous ones run
+  {
+    VerifyingLink link(115200, smartInterface);
+    SectorPipeline pipeline(link);
+    SectorStream stream(pipeline);
+    RequestStream requests;
+    HostProtocol protocol(priamDrive, requests, stream);
+
+    uint8_t seq = 0;
+    requests.Add(HostRequest{seq++, HostProtocol::OP_HELLO, 0, 0, 0, 0, 0, 0});
+    requests.Add(HostRequest{seq++, HostProtocol::OP_PARAMS, 0, 0, 0, 0, 0, 0});
+    for (uint16_t cyl = 0; cyl < drv.Cylinders(); cyl++)
+      requests.Add(HostRequest{seq++, HostProtocol::OP_READ, 0, 0, cyl, 0, (uint16_t) (drv.Heads() * drv.SectorsPerTrack()),
+                               HostProtocol::FLAG_COMPRESS});
+    requests.Add(HostRequest{seq++, HostProtocol::OP_EXIT, 0, 0, 0, 0, 0, 0});
+
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    protocol.Run();
+    pipeline.flush();
+    link.flush();
+    BenchReport("host protocol batch, compressed @115200", start, diskBytes);
+    fprintf(stderr, "%-38s %llu sectors decoded, %llu responses, %llu failed, %llu mismatches\n", "", (unsigned long long) link.Sectors(),
+            (unsigned long long) link.Responses(), (unsigned long long) link.FailedResponses(), (unsigned long long) link.Mismatches());
+  }
+
+  //Host protocol over a link that corrupts a byte now and then, sectors that did not arrive intact are requested again
+  {
+    VerifyingLink link(115200, smartInterface);
+    link.SetCorruptEvery(20011);
+    SectorPipeline pipeline(link);
+    SectorStream stream(pipeline);
+    uint8_t seq = 0;
+    size_t tracks = (size_t) drv.Cylinders() * drv.Heads();
+    size_t total = tracks * drv.SectorsPerTrack();
+
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    {
+      RequestStream requests;
+      HostProtocol protocol(priamDrive, requests, stream);
+      for (uint16_t cyl = 0; cyl < drv.Cylinders(); cyl++)
+        requests.Add(HostRequest{seq++, HostProtocol::OP_READ, 0, 0, cyl, 0, (uint16_t) (drv.Heads() * drv.SectorsPerTrack()),
+                                 HostProtocol::FLAG_COMPRESS});
+      requests.Add(HostRequest{seq++, HostProtocol::OP_EXIT, 0, 0, 0, 0, 0, 0});
+      protocol.Run();
+    }
+
+    size_t rerequested = 0;
+    int rounds = 0;
+    for (; rounds < 5; rounds++)
+    {
+      RequestStream requests;
+      HostProtocol protocol(priamDrive, requests, stream);
+      size_t missing = 0;
+      for (size_t lba = 0; lba < total; lba++)
+      {
+        if (link.Good(lba))
+          continue;
+        uint16_t cyl = (uint16_t) (lba / (tracks / drv.Cylinders() * drv.SectorsPerTrack()));
+        uint8_t head = (uint8_t) (lba / drv.SectorsPerTrack() % drv.Heads());
+        requests.Add(HostRequest{seq++, HostProtocol::OP_READ, 0, head, cyl, (uint8_t) (lba % drv.SectorsPerTrack()), 1, 0});
+        missing++;
+      }
+      if (!missing)
+        break;
+      rerequested += missing;
+      requests.Add(HostRequest{seq++, HostProtocol::OP_EXIT, 0, 0, 0, 0, 0, 0});
+      protocol.Run();
+    }
+    pipeline.flush();
+    link.flush();
+
+    size_t good = 0;
+    for (size_t lba = 0; lba < total; lba++)
+      good += link.Good(lba);
+    BenchReport("host protocol, corrupting link", start, diskBytes);
+    fprintf(stderr, "%-38s %llu CRC32 errors, %llu bad frames, %zu sectors requested again in %d rounds, %zu/%zu good\n", "",
+            (unsigned long long) link.SectorCrcErrors(), (unsigned long long) link.BadFrames(), rerequested, rounds, good, total);
+  }
+
+  //Same at 1 Mbaud, where the link is no longer the limit
+  {
+    VerifyingLink link(1000000, smartInterface);
+    SectorPipeline pipeline(link);
+    SectorStream stream(pipeline, SectorStream::OutputMode::BINARY);
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    priamDrive.DumpTracks(0, stream);
+    pipeline.flush();
+    link.flush();
+    BenchReport("per track, binary @1000000 pipelined", start, diskBytes);
+  }
+
+  //The same through BlockDevice in requests of 100 blocks that start and end inside tracks
+  {
+    VerifyingLink link(1000000, smartInterface);
+    SectorPipeline pipeline(link);
+    SectorStream stream(pipeline, SectorStream::OutputMode::BINARY);
+    BlockDevice blocks(priamDrive, 0);
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    uint32_t total = blocks.Blocks();
+    for (uint32_t lba = 0; lba < total; lba += 100)
+      blocks.ReadBlocks(lba, total - lba < 100 ? total - lba : 100, stream);
+    pipeline.flush();
+    link.flush();
+    BenchReport("100 block requests, binary @1000000", start, diskBytes);
+    fprintf(stderr, "%-38s %llu sectors decoded, %llu mismatches\n", "", (unsigned long long) link.Sectors(),
+            (unsigned long long) link.Mismatches());
+  }
+
+  //One command per sector over the link, with and without pipeline
+  {
+    TimedNullPrint link(115200);
+    SectorStream stream(link, SectorStream::OutputMode::BINARY);
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    for (uint16_t cyl = 0; cyl < drv.Cylinders(); cyl++)
+      for (uint8_t head = 0; head < drv.Heads(); head++)
+        for (uint8_t sector = 0; sector < drv.SectorsPerTrack(); sector++)
+          priamDrive.ReadData(0, head, cyl, sector, 1, stream);
+    link.flush();
+    BenchReport("per sector, binary @115200", start, diskBytes);
+  }
+
+  {
+    TimedNullPrint link(115200);
+    SectorPipeline pipeline(link);
+    SectorStream stream(pipeline, SectorStream::OutputMode::BINARY);
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    for (uint16_t cyl = 0; cyl < drv.Cylinders(); cyl++)
+      for (uint8_t head = 0; head < drv.Heads(); head++)
+        for (uint8_t sector = 0; sector < drv.SectorsPerTrack(); sector++)
+          priamDrive.ReadData(0, head, cyl, sector, 1, stream);
+    pipeline.flush();
+    link.flush();
+    BenchReport("per sector, binary @115200 pipelined", start, diskBytes);
+  }
+
+  {
+    TimedNullPrint link(115200);
+    SectorStream stream(link, SectorStream::OutputMode::HEXDUMP);
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    priamDrive.DumpTracks(0, stream);
+    BenchReport("per track, hex dump @115200", start, diskBytes);
+  }
+
+  //Whole track commands with calibrated bus timing
+  {
+    NullDataSink sink;
+    uint8_t setup = smartInterface.BusDelaySetup();
+    uint8_t pulse = smartInterface.BusDelayPulse();
+    if (smartInterface.CalibrateBusTiming(0))
+    {
+      smartInterface.ResetStatistics();
+      start = ShimNowNanos();
+      priamDrive.DumpTracks(0, sink);
+      BenchReport("per track, calibrated bus", start, diskBytes);
+    }
+    smartInterface.SetBusDelays(setup, pulse);
+  }
+
+  //1000 scattered sectors, as for recovering files: read in the order asked for, then with ScatterReadQueue
+  {
+    const uint16_t REQUESTS = 1000;
+    uint32_t blocks = (uint32_t) drv.Cylinders() * drv.Heads() * drv.SectorsPerTrack();
+    std::vector<uint32_t> lbas(REQUESTS);
+    uint32_t seed = 12345;
+    for (uint16_t i = 0; i < REQUESTS; i++)
+    {
+      seed = seed * 1103515245UL + 12345UL;
+      lbas[i] = (seed >> 8) % blocks;
+    }
+
+    const char *names[] = {"scattered sectors, in request order", "scattered sectors, SCAN queue", "scattered sectors, C-SCAN queue"};
+    for (int variant = 0; variant < 3; variant++)
+    {
+      VerifyingLink link(1000000, smartInterface);
+      SectorPipeline pipeline(link);
+      SectorStream stream(pipeline, SectorStream::OutputMode::BINARY);
+      ScatterReadQueue queue(priamDrive, 0, variant == 2 ? ScatterReadQueue::CSCAN : ScatterReadQueue::SCAN);
+      DriveGeometry geometry = priamDrive.Geometry(0);
+      priamDrive.Seek(0, 0, 0);
+      scatterDone = 0;
+
+      smartInterface.ResetStatistics();
+      start = ShimNowNanos();
+      for (uint16_t i = 0; i < REQUESTS; i++)
+      {
+        if (!variant)
+        {
+          uint8_t head, sector;
+          uint16_t cylinder;
+          geometry.Chs(lbas[i], head, cylinder, sector);
+          if (!priamDrive.ReadData(0, head, cylinder, sector, 1, stream).IsErrorStatus())
+            scatterDone++;
+          continue;
+        }
+        queue.Add(i, lbas[i]);
+        if (queue.Full() || i == REQUESTS - 1)
+          queue.Run(stream, CountScatterDone);
+      }
+      pipeline.flush();
+      link.flush();
+      BenchReport(names[variant], start, (uint64_t) REQUESTS * drv.SectorSize());
+      fprintf(stderr, "%-38s %u of %u requests read, %llu sectors decoded, %llu mismatches\n", "", scatterDone, REQUESTS,
+              (unsigned long long) link.Sectors(), (unsigned long long) link.Mismatches());
+    }
+  }
+
+  //With more drives attached, all of them from spun down: spin up and dump one drive after the other, then
+  //MultiDriveDump reading the ready drives while the others spin up
+  uint8_t mask = 0;
+  uint64_t allBytes = 0;
+  for (uint8_t d = 0; d < SimulatedPriamSmart::MAXDRIVES; d++)
+  {
+    SimulatedDrive &disk = smartInterface.Drive(d);
+    if (!disk.Attached())
+      continue;
+    mask |= (uint8_t) bit(d);
+    allBytes += (uint64_t) disk.Cylinders() * disk.Heads() * disk.SectorsPerTrack() * disk.SectorSize();
+  }
+  if (!(mask & ~1))
+    return;
+
+  //Cold start of all drives with SEQUENCE UP AND WAIT one after the other, then with SpinupAll
+  for (int parallel = 0; parallel < 2; parallel++)
+  {
+    for (uint8_t d = 0; d < SimulatedPriamSmart::MAXDRIVES; d++)
+      if (mask & bit(d))
+        priamDrive.SpinDown(d);
+
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    if (parallel)
+      priamDrive.SpinupAll(mask);
+    else
+    {
+      for (uint8_t d = 0; d < SimulatedPriamSmart::MAXDRIVES; d++)
+        if (mask & bit(d))
+          priamDrive.SpinupWait(d);
+    }
+    BenchReport(parallel ? "spin up all drives together" : "spin up all drives one by one", start, 0);
+  }
+
+  for (int interleaved = 0; interleaved < 2; interleaved++)
+  {
+    VerifyingLink link(1000000, smartInterface);
+    SectorPipeline pipeline(link);
+    SectorStream stream(pipeline, SectorStream::OutputMode::BINARY);
+    MultiDriveDump dump(priamDrive);
+
+    for (uint8_t d = 0; d < SimulatedPriamSmart::MAXDRIVES; d++)
+      if (mask & bit(d))
+        priamDrive.SpinDown(d);
+
+    smartInterface.ResetStatistics();
+    start = ShimNowNanos();
+    if (interleaved)
+      dump.Run(mask, stream);
+    else
+    {
+      for (uint8_t d = 0; d < SimulatedPriamSmart::MAXDRIVES; d++)
+      {
+        if (!(mask & bit(d)))
+          continue;
+        priamDrive.SpinupWait(d, stream);
+        priamDrive.DumpTracks(d, stream);
+      }
+    }
+    pipeline.flush();
+    link.flush();
+    BenchReport(interleaved ? "all drives interleaved @1000000" : "all drives one by one @1000000", start, allBytes);
+    fprintf(stderr, "%-38s %llu sectors decoded, %llu bad frames, %llu mismatches\n", "", (unsigned long long) link.Sectors(),
+            (unsigned long long) link.BadFrames(), (unsigned long long) link.Mismatches());
+  }
+}
+
+static bool Check(bool ok, const char *what)
+{
+  fprintf(stderr, "%-4s %s\n", ok ? "ok" : "FAIL", what);
+  return ok;
+}
+
+static TransactionStatus lastTrackStatus(0, false);
+static void KeepTrackStatus(uint8_t driveno, uint8_t head, uint16_t cyl, TransactionStatus status)
+{
+  (void) driveno;
+  (void) head;
+  (void) cyl;
+  lastTrackStatus = status;
+}
+
+static TransactionStatus requestStatus[4] = {TransactionStatus(0, false), TransactionStatus(0, false),
+                                             TransactionStatus(0, false), TransactionStatus(0, false)};
+static void KeepRequestStatus(uint16_t id, TransactionStatus status)
+{
+  if (id < 4)
+    requestStatus[id] = status;
+}
+
+//Fault injection checks, each one with its own faults on drive 0
+static bool Test()
+{
+  SimulatedDrive &drv = smartInterface.Drive(0);
+  uint8_t last = (uint8_t) (drv.SectorsPerTrack() - 1);
+  bool ok = true;
+
+  //Error status on the last sector of a track after all of it was transferred
+  {
+    NullDataSink sink;
+    DumpResult result;
+    BadSectorMap badSectors;
+    drv.AddLateErrorSector(0, 1, last);
+    bool done = priamDrive.DumpTrack(0, 0, 1, drv.Heads(), drv.Cylinders(), drv.SectorsPerTrack(), sink, result,
+                                     KeepTrackStatus, &badSectors);
+    ok &= Check(done && result.TracksFailed() == 1 && result.SectorsBad() == 1, "late error on last sector fails the track");
+    ok &= Check(lastTrackStatus.IsErrorStatus(), "late error on last sector reported to trackDone");
+    ok &= Check(badSectors.Sectors() == 1 && badSectors.Contains(0, 1, last), "late error on last sector in bad sector map");
+  }
+
+  //The same in a scatter read: one run up to the end of the track, the request over the track end fails
+  {
+    NullDataSink sink;
+    ScatterReadQueue queue(priamDrive, 0);
+    drv.AddLateErrorSector(0, 2, last);
+    queue.Add(1, 0, 2, 0, last);
+    queue.Add(2, 0, 2, last, 2);
+    bool done = queue.Run(sink, KeepRequestStatus);
+    ok &= Check(done && !requestStatus[1].IsErrorStatus(), "scatter read before late error sector good");
+    ok &= Check(requestStatus[2].IsErrorStatus(), "scatter read over late error on last sector fails");
+  }
+
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  const char *mode = "sketch";
+  uint32_t rpm = 3600, settle = 3000, percyl = 50, spinup = 20000;
+  bool spunDown = false;
+  bool driveGiven = false;
+  bool pty = false;
+
+  for (int i = 1; i < argc; i++)
+  {
+    const char *a = argv[i];
+    const char *v = (i + 1 < argc) ? argv[i + 1] : nullptr;
+
+    if (!strcmp(a, "--drive") && v)
+    {
+      if (!ParseDrive(v))
+      {
+        fprintf(stderr, "priamsim: bad drive %s\n", v);
+        return 1;
+      }
+      driveGiven = true;
+      i++;
+    }
+    else if (!strcmp(a, "--rpm") && v)
+      rpm = (uint32_t) strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(a, "--seek") && v && sscanf(v, "%u,%u", &settle, &percyl) == 2)
+      i++;
+    else if (!strcmp(a, "--spinup") && v)
+      spinup = (uint32_t) strtoul(argv[++i], nullptr, 0);
+    else if (!strcmp(a, "--spun-down"))
+      spunDown = true;
+    else if ((!strcmp(a, "--weak") || !strcmp(a, "--bad") || !strcmp(a, "--late")) && v)
+    {
+      if (!ParseSector(v, a))
+        Usage();
+      i++;
+    }
+    else if (!strcmp(a, "--bus-ns") && v)
+      smartInterface.SetBusCycleNanos((uint32_t) strtoul(argv[++i], nullptr, 0));
+    else if (!strcmp(a, "--bus-min") && v)
+    {
+      unsigned setup, pulse;
+      if (sscanf(v, "%u,%u", &setup, &pulse) != 2)
+        Usage();
+      smartInterface.SetMinBusDelays((uint8_t) setup, (uint8_t) pulse);
+      i++;
+    }
+    else if (!strcmp(a, "--buffers") && v)
+      smartInterface.SetSectorBuffers((uint8_t) strtoul(argv[++i], nullptr, 0));
+    else if (!strcmp(a, "--eeprom") && v)
+      ShimEepromFile(argv[++i]);
+    else if (!strcmp(a, "--no-uart-time"))
+      Serial.SetTimed(false);
+    else if (!strcmp(a, "--dtreq"))
+      smartInterface.UseDtreqHandshake(true);
+    else if (!strcmp(a, "--no-dtreq"))
+      smartInterface.UseDtreqHandshake(false);
+    else if (!strcmp(a, "--pty"))
+      pty = true;
+    else if (a[0] != '-')
+      mode = a;
+    else
+      Usage();
+  }
+
+  if (!driveGiven)
+    smartInterface.Drive(0).Attach(nullptr, 320, 4, 16, 512);
+
+  for (uint8_t d = 0; d < SimulatedPriamSmart::MAXDRIVES; d++)
+  {
+    smartInterface.Drive(d).SetTiming(rpm, settle, percyl, spinup);
+    if (spunDown)
+      smartInterface.Drive(d).SetSpunDown();
+  }
+
+  if (!strcmp(mode, "bench"))
+  {
+    //Sketch startup messages are not part of the benchmark output, the sketch gets no input
+    Serial.SetFds(open("/dev/null", O_RDONLY), open("/dev/null", O_WRONLY));
+    Serial.SetExitOnEof(false);
+    setup();
+    smartInterface.WaitForDriveReady(1000, 10);
+    Bench();
+    return 0;
+  }
+  else if (!strcmp(mode, "test"))
+  {
+    Serial.SetFds(open("/dev/null", O_RDONLY), open("/dev/null", O_WRONLY));
+    Serial.SetExitOnEof(false);
+    setup();
+    smartInterface.WaitForDriveReady(1000, 10);
+    return Test() ? 0 : 1;
+  }
+  else if (strcmp(mode, "sketch"))
+    Usage();
+
+  if (pty && !OpenPty())
+    return 1;
+
+  setup();
+  for (;;)
+    loop();
+}
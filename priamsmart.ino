@@ -3,22 +3,59 @@
 
 #include "src/PriamSmartInterface.h"
 #include "src/PriamDrive.h"
+#include "src/PriamSectorStream.h"
+#include "src/PriamDumpState.h"
+#include "src/PriamSectorPipeline.h"
+#include "src/PriamSerialTransport.h"
+#include "src/PriamHostProtocol.h"
+#include "src/PriamMultiDump.h"
 
 using namespace Priam;
 
+#ifdef PRIAMSMART_SIMULATOR
+//Native build against the simulated controller, see host/
+#include "host/SimulatedPriamSmart.h"
+SimulatedPriamSmart smartInterface;
+#else
 PriamSmart smartInterface;
+#endif
 PriamDrive priamDrive(smartInterface);
+//Host link with flow control, all menu input and output goes through it
+SerialTransport transport(Serial);
+
+//Sector data is queued in the transport transmit ring and sent while the controller reads the next sector
+SectorStream sectorStream(transport.Pipeline());
+DumpState dumpState;
+//Bad sectors per drive of a dump of all drives together. Boards with less than 2 KB of RAM have no room for
+//them and recover failed sectors during that dump
+#if !(defined(RAMEND) && RAMEND < 0x900)
+BadSectorMap multiDumpBadSectors[PriamDrive::MAXDRIVES];
+#endif
+
+//Binary command protocol, a request frame sent instead of a menu key starts it
+HostProtocol hostProtocol(priamDrive, transport, sectorStream);
 
 #define PINKLED 19
 
+//Library diagnostics go into the frame stream as EVENT frames while it is binary, text would break up the frames
+bool StreamLogEvent(uint8_t level, uint8_t event, uint8_t value)
+{
+  if (sectorStream.GetMode() == SectorStream::OutputMode::HEXDUMP)
+    return false;
+  sectorStream.Event(level, event, value);
+  return true;
+}
+
 void setup() {
-  Serial.begin(115200);
-  Serial.print(F("Priam Smart Interface routine\n"));
+  transport.begin(115200);
+  Log::SetOutput(transport);
+  transport.print(F("Priam Smart Interface routine\n"));
+  Log::SetEventHandler(StreamLogEvent);
 
   if (!smartInterface.Open(false))
-    Serial.print(F("Interface class open error!\n"));
+    transport.print(F("Interface class open error!\n"));
   else
-    Serial.println(F("Interface class is open, no reset issued"));
+    transport.println(F("Interface class is open, no reset issued"));
 
 
   digitalWrite(PINKLED, HIGH);   // turn the LED off
@@ -26,177 +63,279 @@ void setup() {
 
 }
 
+//Command running in the background while the menu waits for a key, nullptr if none
+TransactionBase *pendingTransaction = nullptr;
+
+//Poll the background command, blink the LED while it runs
+void PollPendingTransaction()
+{
+  if (!pendingTransaction)
+    return;
+
+  if (pendingTransaction->Poll())
+  {
+    pendingTransaction = nullptr;
+    digitalWrite(PINKLED, LOW); //turn LED on
+    return;
+  }
+
+  digitalWrite(PINKLED, (millis() / 250) & 1 ? HIGH : LOW);
+}
+
+//Keys that issue controller commands, they have to wait for the background command
+bool IssuesCommand(char key)
+{
+  switch (key)
+  {
+    case '1': case 'a': case '2': case '3': case '4': case '5': case '6': case '7': case '8':
+    case 'u': case 'x': case 'm': case '9': case 'c': case 'p':
+      return true;
+    default:
+      return false;
+  }
+}
+
+//Wait for the background command, the interface can only run one command at a time
+void FinishPendingTransaction()
+{
+  if (!pendingTransaction)
+    return;
+
+  transport.println(F("Waiting for running command to finish"));
+  while (pendingTransaction)
+    PollPendingTransaction();
+}
+
 //Command execution functions
-void Spinup()
+void SpinupDone(TransactionStatus spinupStatus, void *context)
 {
-  Serial.println(F("Spin up and wait for completion, can take upto 30 seconds"));
-  
-  TransactionStatus spinupStatus = priamDrive.SpinupWait(0);
-  
+  (void) context;
+
   if (spinupStatus.CommsError())
   {
-    Serial.println(F("Spinup command error. comms failure"));
+    transport.println(F("Spinup command error. comms failure"));
   }
   else
   {
-    Serial.print(F("Spinup command finished with status: Drive "));
-    Serial.print(spinupStatus.Drive());
-    Serial.print(F(", Completion type:  "));
-    Serial.print(spinupStatus.CompType());
-    Serial.print(F(", Completion code:  0x"));
-    Serial.println(spinupStatus.Code(), HEX);
+    transport.print(F("Spinup command finished with status: Drive "));
+    transport.print(spinupStatus.Drive());
+    transport.print(F(", Completion type:  "));
+    transport.print(spinupStatus.CompType());
+    transport.print(F(", Completion code:  0x"));
+    transport.println(spinupStatus.Code(), HEX);
   }
 
 }
 
+//Spin up, seeks and verify run in the background. Menu keys that do not issue a controller command stay
+//usable meanwhile, the others wait for the running command (see IssuesCommand)
+NullDataSink nullSink;
+DriveParam spinupDrive(0);
+DriveCmd_SpinupAndWait::AsyncTransaction<NullDataSink> spinupTransaction(smartInterface, DriveCmd_SpinupAndWait().GetCommandInfo(),
+                                                                         DriveParam::MakeRegs(spinupDrive), nullSink, SpinupDone);
+
+void Spinup()
+{
+  transport.println(F("Spin up started, can take upto 30 seconds. Completion is reported when done"));
+
+  if (spinupTransaction.Begin())
+    pendingTransaction = &spinupTransaction;
+}
+
+void SpinupAllDrives()
+{
+  transport.println(F("Spin up all drives together, can take upto 30 seconds"));
+
+  PriamDrive::SpinupResult result = priamDrive.SpinupAll(0x0F, sectorStream);
+  for (uint8_t d = 0; d < PriamDrive::MAXDRIVES; d++)
+  {
+    transport.print(F("Drive "));
+    transport.print(d);
+    switch (result.State(d))
+    {
+      case DriveSpinup::READY:
+        transport.print(F(" ready after "));
+        transport.print(result.ReadyMillis(d));
+        transport.println(F(" ms"));
+        break;
+      case DriveSpinup::TIMEDOUT:
+        transport.println(F(" did not get ready"));
+        break;
+      case DriveSpinup::COMMSERROR:
+        transport.println(F(" comms failure"));
+        break;
+      default:
+        transport.println(F(" not attached"));
+    }
+  }
+}
+
 void Spindown()
 {
-  Serial.println(F("Spin down"));
+  transport.println(F("Spin down"));
   
   TransactionStatus spindownStatus = priamDrive.SpinDown(0);
   
   if (spindownStatus.CommsError())
   {
-    Serial.println(F("Spin down command error. comms failure"));
+    transport.println(F("Spin down command error. comms failure"));
   }
   else
   {
-    Serial.print(F("Spin down command finished with status: Drive "));
-    Serial.print(spindownStatus.Drive());
-    Serial.print(F(", Completion type:  "));
-    Serial.print(spindownStatus.CompType());
-    Serial.print(F(", Completion code:  0x"));
-    Serial.println(spindownStatus.Code(), HEX);
+    transport.print(F("Spin down command finished with status: Drive "));
+    transport.print(spindownStatus.Drive());
+    transport.print(F(", Completion type:  "));
+    transport.print(spindownStatus.CompType());
+    transport.print(F(", Completion code:  0x"));
+    transport.println(spindownStatus.Code(), HEX);
   }
 
 }
 
 void ReadDriveParams()
 {
-  Serial.println(F("Read drive paramaters"));
+  transport.println(F("Read drive paramaters"));
   
   ResultDriveParams parmStatus = priamDrive.ReadParams(0);
   
   if (parmStatus.GetStatus().CommsError())
   {
-    Serial.println(F("Read parameters error, comms failure"));
+    transport.println(F("Read parameters error, comms failure"));
   }
   else
   {
-    Serial.print(F("Read parameters command finished with status: Drive "));
-    Serial.print(parmStatus.GetStatus().Drive());
-    Serial.print(F(", Completion type:  "));
-    Serial.print(parmStatus.GetStatus().CompType());
-    Serial.print(F(", Completion code:  0x"));
-    Serial.println(parmStatus.GetStatus().Code(), HEX);
-
-    Serial.print(F("Drive parameters: "));
-    Serial.print(parmStatus.Heads());
-    Serial.print(F(" heads, "));
-    Serial.print(parmStatus.Cylinders());
-    Serial.print(F(" cylinders, "));
-    Serial.print(parmStatus.SectorsPerTrack());
-    Serial.print(F(" sectors/track, "));
-    Serial.print(parmStatus.LogicalSectorSize());
-    Serial.println(F(" logical sector size"));
+    transport.print(F("Read parameters command finished with status: Drive "));
+    transport.print(parmStatus.GetStatus().Drive());
+    transport.print(F(", Completion type:  "));
+    transport.print(parmStatus.GetStatus().CompType());
+    transport.print(F(", Completion code:  0x"));
+    transport.println(parmStatus.GetStatus().Code(), HEX);
+
+    transport.print(F("Drive parameters: "));
+    transport.print(parmStatus.Heads());
+    transport.print(F(" heads, "));
+    transport.print(parmStatus.Cylinders());
+    transport.print(F(" cylinders, "));
+    transport.print(parmStatus.SectorsPerTrack());
+    transport.print(F(" sectors/track, "));
+    transport.print(parmStatus.LogicalSectorSize());
+    transport.println(F(" logical sector size"));
 
   }
 
 
 }
 
-bool Seek(uint8_t head, uint16_t cylinder)
-{
-  bool retval = false;
+//Seek and verify run in the background like the spin up, the result is reported when done
+void SeekDone(TransactionStatus status, void *context);
+void VerifyDone(TransactionStatus status, void *context);
 
-  Serial.print(F("Seek head "));
-  Serial.print(head);
-  Serial.print(F(" cylinder "));
-  Serial.println(cylinder);
-  
-  ResultCylinder resCyl = priamDrive.Seek(0, head, cylinder);
+SeekParam seekTarget(0, 0, 0);
+DriveCmd_SeekWithRetry::AsyncTransaction<NullDataSink> seekTransaction(smartInterface, DriveCmd_SeekWithRetry().GetCommandInfo(),
+                                                                       SeekParam::MakeRegs(seekTarget), nullSink, SeekDone);
+DriveParam verifyDrive(0);
+DriveCmd_VerifyDisk::AsyncTransaction<NullDataSink> verifyTransaction(smartInterface, DriveCmd_VerifyDisk().GetCommandInfo(),
+                                                                      DriveParam::MakeRegs(verifyDrive), nullSink, VerifyDone);
+
+void SeekDone(TransactionStatus status, void *context)
+{
+  (void) status;
+  (void) context;
+  ResultCylinder resCyl = DriveCmd_SeekWithRetry::Finish(seekTransaction);
   
   if (resCyl.GetStatus().CommsError())
   {
-    Serial.println(F("Seek error, comms failure"));
-    retval = false;
+    transport.println(F("Seek error, comms failure"));
   }
   else
   {
-    Serial.print(F("Seek command finished with status: Drive "));
-    Serial.print(resCyl.GetStatus().Drive());
-    Serial.print(F(", Completion type:  "));
-    Serial.print(resCyl.GetStatus().CompType());
-    Serial.print(F(", Completion code:  0x"));
-    Serial.println(resCyl.GetStatus().Code(), HEX);
-
-    Serial.print(F("Drive is now at cylinder: "));
-    Serial.print(resCyl.Cylinder());
-    
-    retval = !resCyl.GetStatus().IsErrorStatus();
-
+    transport.print(F("Seek command finished with status: Drive "));
+    transport.print(resCyl.GetStatus().Drive());
+    transport.print(F(", Completion type:  "));
+    transport.print(resCyl.GetStatus().CompType());
+    transport.print(F(", Completion code:  0x"));
+    transport.println(resCyl.GetStatus().Code(), HEX);
+
+    transport.print(F("Drive is now at cylinder: "));
+    transport.println(resCyl.Cylinder());
   }
-
-  return retval;
 }
 
-bool SeekFirstCylinder()
+void Seek(uint8_t head, uint16_t cylinder)
 {
-  Serial.println(F("Seek to first cylinder"));
+  transport.print(F("Seek head "));
+  transport.print(head);
+  transport.print(F(" cylinder "));
+  transport.println(cylinder);
+
+  seekTarget = SeekParam(0, head, cylinder);
+  if (seekTransaction.Begin(SeekParam::MakeRegs(seekTarget)))
+    pendingTransaction = &seekTransaction;
+}
 
+void SeekFirstCylinder()
+{
+  transport.println(F("Seek to first cylinder"));
 
-  return Seek(0, 0);
+  Seek(0, 0);
 }
 
-bool SeekLastCylinder()
+void SeekLastCylinder()
 {
-  Serial.println(F("Seek to last cylinder"));
+  transport.println(F("Seek to last cylinder"));
 
-  ResultDriveParams parmStatus = priamDrive.ReadParams(0);
+  DriveGeometry geometry = priamDrive.Geometry(0);
   
-  if (parmStatus.GetStatus().CommsError() || parmStatus.GetStatus().IsErrorStatus())
+  if (!geometry.Valid())
   {
-    Serial.println(F("Error getting drive parameters"));
-    return false;
+    transport.println(F("Error getting drive parameters"));
+    return;
   }
 
-  return Seek(0, parmStatus.Cylinders() - 1);
+  Seek(0, geometry.Cylinders() - 1);
 }
 
-void VerifyDisk()
+void VerifyDone(TransactionStatus status, void *context)
 {
-  Serial.println(F("Verify Disk"));
-  
-  ResultHeadCylinderSector vrfStatus = priamDrive.VerifyDisk(0);
+  (void) status;
+  (void) context;
+  ResultHeadCylinderSector vrfStatus = DriveCmd_VerifyDisk::Finish(verifyTransaction);
   
   if (vrfStatus.GetStatus().CommsError())
   {
-    Serial.println(F("Verify disk command error. comms failure"));
+    transport.println(F("Verify disk command error. comms failure"));
   }
   else
   {
-    Serial.print(F("Verify command finished with status: Drive "));
-    Serial.print(vrfStatus.GetStatus().Drive());
-    Serial.print(F(", Completion type:  "));
-    Serial.print(vrfStatus.GetStatus().CompType());
-    Serial.print(F(", Completion code:  0x"));
-    Serial.println(vrfStatus.GetStatus().Code(), HEX);
+    transport.print(F("Verify command finished with status: Drive "));
+    transport.print(vrfStatus.GetStatus().Drive());
+    transport.print(F(", Completion type:  "));
+    transport.print(vrfStatus.GetStatus().CompType());
+    transport.print(F(", Completion code:  0x"));
+    transport.println(vrfStatus.GetStatus().Code(), HEX);
 
     if (!vrfStatus.GetStatus().IsErrorStatus())
     {
-      Serial.println(F("Verify disk: disk is good!"));
+      transport.println(F("Verify disk: disk is good!"));
     }
     else
     {
-      Serial.print(F("Verify disk: error found at head "));
-      Serial.print(vrfStatus.Head());
-      Serial.print(F(" cylinder "));
-      Serial.print(vrfStatus.Cylinder());
-      Serial.print(F(" sector "));
-      Serial.println(vrfStatus.Sector());
+      transport.print(F("Verify disk: error found at head "));
+      transport.print(vrfStatus.Head());
+      transport.print(F(" cylinder "));
+      transport.print(vrfStatus.Cylinder());
+      transport.print(F(" sector "));
+      transport.println(vrfStatus.Sector());
     }
   }
+}
 
+void VerifyDisk()
+{
+  transport.println(F("Verify Disk started, completion is reported when done"));
+
+  if (verifyTransaction.Begin())
+    pendingTransaction = &verifyTransaction;
 }
 
 void ReadData(uint8_t driveno, uint8_t head, uint16_t cylinder, uint8_t sector, uint8_t numsector, bool print = true)
@@ -204,48 +343,49 @@ void ReadData(uint8_t driveno, uint8_t head, uint16_t cylinder, uint8_t sector,
 
   if (print)
   {
-    Serial.print(F("Read "));
-    Serial.print(numsector);
-    Serial.print(F(" sectors starting at head "));
-    Serial.print(head);
-    Serial.print(F(" cylinder  "));
-    Serial.print(cylinder);
-    Serial.print(F(" sector  "));
-    Serial.println(sector);
+    transport.print(F("Read "));
+    transport.print(numsector);
+    transport.print(F(" sectors starting at head "));
+    transport.print(head);
+    transport.print(F(" cylinder  "));
+    transport.print(cylinder);
+    transport.print(F(" sector  "));
+    transport.println(sector);
   }
 
-  TransactionStatus parmStatus = priamDrive.ReadData(driveno, head, cylinder, sector, numsector);
+  TransactionStatus parmStatus = priamDrive.ReadData(driveno, head, cylinder, sector, numsector, sectorStream);
+  transport.flush();
   
   if (parmStatus.CommsError())
   {
-    Serial.println(F("Read data command error. comms failure"));
+    transport.println(F("Read data command error. comms failure"));
   }
   else
   {
     if (print)
     {    
-      Serial.print(F("Verify command finished with status: Drive "));
-      Serial.print(parmStatus.Drive());
-      Serial.print(F(", Completion type:  "));
-      Serial.print(parmStatus.CompType());
-      Serial.print(F(", Completion code:  0x"));
-      Serial.println(parmStatus.Code(), HEX);
+      transport.print(F("Verify command finished with status: Drive "));
+      transport.print(parmStatus.Drive());
+      transport.print(F(", Completion type:  "));
+      transport.print(parmStatus.CompType());
+      transport.print(F(", Completion code:  0x"));
+      transport.println(parmStatus.Code(), HEX);
     }
     
     if (!parmStatus.IsErrorStatus())
     {
       if (print)
       {
-        Serial.println(F("Read data: read successful!"));
+        transport.println(F("Read data: read successful!"));
       }
     }
     else
     {
-      Serial.println(F("Read data: error"));
-      Serial.print(F(", Completion type:  "));
-      Serial.print(parmStatus.CompType());
-      Serial.print(F(", Completion code:  0x"));
-      Serial.println(parmStatus.Code(), HEX);
+      transport.println(F("Read data: error"));
+      transport.print(F(", Completion type:  "));
+      transport.print(parmStatus.CompType());
+      transport.print(F(", Completion code:  0x"));
+      transport.println(parmStatus.Code(), HEX);
       
     }
   }
@@ -254,29 +394,331 @@ void ReadData(uint8_t driveno, uint8_t head, uint16_t cylinder, uint8_t sector,
   
 
 
-void ReadAllSectors()
+void ReportTrackStatus(uint8_t driveno, uint8_t head, uint16_t cylinder, TransactionStatus status)
 {
-  Serial.println(F("Read all sectors"));
+  //Binary modes carry the track status in the stream
+  if (sectorStream.GetMode() != SectorStream::OutputMode::HEXDUMP)
+    return;
 
-  ResultDriveParams parmStatus = priamDrive.ReadParams(0);
-  
-  if (parmStatus.GetStatus().CommsError() || parmStatus.GetStatus().IsErrorStatus())
+  if (status.CommsError() || status.IsErrorStatus())
   {
-    Serial.println(F("Error getting drive parameters"));
-    return;
+    transport.print(F("Read track error: Drive "));
+    transport.print(driveno);
+    transport.print(F(" head "));
+    transport.print(head);
+    transport.print(F(" cylinder "));
+    transport.print(cylinder);
+    transport.print(F(", Completion type:  "));
+    transport.print(status.CompType());
+    transport.print(F(", Completion code:  0x"));
+    transport.println(status.Code(), HEX);
   }
+}
 
-  for (uint8_t cyl = 0; cyl < parmStatus.Cylinders(); cyl++)
+void PrintRetryCounts()
+{
+  RetryPolicy &policy = priamDrive.GetRetryPolicy();
+
+  transport.print(F("Sectors read: first pass "));
+  transport.print(policy.Count(RetryPolicy::TIER_FIRSTPASS));
+  transport.print(F(", with retry "));
+  transport.print(policy.Count(RetryPolicy::TIER_RETRY));
+  transport.print(F(", after recalibrate "));
+  transport.print(policy.Count(RetryPolicy::TIER_RECALIBRATE));
+  transport.print(F(", failed "));
+  transport.println(policy.Count(RetryPolicy::TIER_FAILED));
+}
+
+void ToggleRetryPolicy()
+{
+  if (priamDrive.GetRetryPolicy().FirstPassRetry())
   {
-    for (uint8_t head = 0; head < parmStatus.Heads(); head++)
+    priamDrive.SetRetryPolicy(RetryPolicy());
+    transport.println(F("Dumps now read tracks without retry, failed sectors are retried one by one after the dump"));
+  }
+  else
+  {
+    priamDrive.SetRetryPolicy(RetryPolicy::ControllerRetryOnly());
+    transport.println(F("Dumps now read tracks with controller retries only"));
+  }
+}
+
+void PrintBadSectors(BadSectorMap &bad)
+{
+  transport.print(bad.Sectors());
+  transport.println(F(" bad sectors recorded"));
+  if (bad.Overflowed())
+    transport.println(F("Bad sector map overflowed, not all bad sectors are recorded"));
+
+  for (uint8_t i = 0; i < bad.Tracks(); i++)
+  {
+    transport.print(F("  head "));
+    transport.print(bad.Head(i));
+    transport.print(F(" cylinder "));
+    transport.print(bad.Cylinder(i));
+    transport.print(F(" sector mask 0x"));
+    transport.println(bad.SectorMask(i), HEX);
+  }
+}
+
+void RecoverBadSectors(uint8_t driveno, BadSectorMap &bad)
+{
+  transport.print(F("Read bad sectors of drive "));
+  transport.print(driveno);
+  transport.print(F(" again: "));
+  PrintBadSectors(bad);
+
+  priamDrive.GetRetryPolicy().ResetCounts();
+  uint16_t recovered = priamDrive.RereadBadSectors(driveno, bad, sectorStream, ReportTrackStatus);
+  transport.flush();
+
+  transport.print(recovered);
+  transport.println(F(" sectors recovered"));
+  PrintRetryCounts();
+  PrintBadSectors(bad);
+}
+
+void ReadAllSectors(bool resume)
+{
+  if (resume)
+  {
+    if (!dumpState.Load())
     {
-      for (uint8_t sector = 0; sector < parmStatus.SectorsPerTrack(); sector++)
-      {
-        ReadData(0, head, cyl, sector, 1, false);
-      }
+      transport.println(F("No interrupted dump to resume"));
+      return;
     }
+    transport.print(F("Resume dump of drive "));
+    transport.print(dumpState.Drive());
+    transport.print(F(" at head "));
+    transport.print(dumpState.Head());
+    transport.print(F(" cylinder "));
+    transport.println(dumpState.Cylinder());
+  }
+  else
+  {
+    transport.println(F("Read all sectors"));
+    dumpState.Start(0);
   }
 
+  priamDrive.GetRetryPolicy().ResetCounts();
+  DumpResult res = priamDrive.DumpTracks(dumpState.Drive(), sectorStream, ReportTrackStatus, &dumpState);
+  transport.flush();
+  
+  if (!res.ParamsOk())
+  {
+    transport.println(F("Error getting drive parameters"));
+    return;
+  }
+
+  if (res.CommsError())
+    transport.println(F("Dump aborted, comms failure"));
+
+  transport.print(F("Dump finished: "));
+  transport.print(res.TracksRead());
+  transport.print(F(" tracks read, "));
+  transport.print(res.TracksFailed());
+  transport.println(F(" tracks with errors"));
+  PrintRetryCounts();
+  PrintBadSectors(dumpState.BadSectors());
+
+  //The dump only recorded the sectors that failed, recover them now
+  if (!res.CommsError() && priamDrive.GetRetryPolicy().DeferRecovery() && dumpState.BadSectors().Sectors())
+  {
+    RecoverBadSectors(dumpState.Drive(), dumpState.BadSectors());
+    dumpState.BadSectors().Save();
+  }
+}
+
+void RereadBadSectors()
+{
+  dumpState.Load();
+  RecoverBadSectors(dumpState.Drive(), dumpState.BadSectors());
+  dumpState.BadSectors().Save();
+}
+
+void DumpAllDrives()
+{
+  transport.println(F("Dump all drives, one track from each in turn. Drives that are not ready are spun up"));
+
+  priamDrive.GetRetryPolicy().ResetCounts();
+  MultiDriveDump dump(priamDrive);
+#if defined(RAMEND) && RAMEND < 0x900
+  dump.Run(0x0F, sectorStream, ReportTrackStatus);
+#else
+  dump.Run(0x0F, sectorStream, ReportTrackStatus, multiDumpBadSectors);
+#endif
+  transport.flush();
+
+  for (uint8_t d = 0; d < PriamDrive::MAXDRIVES; d++)
+  {
+    if (dump.State(d) == MultiDriveDump::DRIVE_SKIPPED)
+      continue;
+
+    transport.print(F("Drive "));
+    transport.print(d);
+    if (dump.State(d) == MultiDriveDump::DRIVE_DONE)
+      transport.print(F(" done: "));
+    else
+      transport.print(F(" failed: "));
+    transport.print(dump.Result(d).TracksRead());
+    transport.print(F(" tracks read, "));
+    transport.print(dump.Result(d).TracksFailed());
+    transport.print(F(" tracks with errors, ready after "));
+    transport.print(dump.ReadyMillis(d));
+    transport.println(F(" ms"));
+  }
+  PrintRetryCounts();
+
+#if !(defined(RAMEND) && RAMEND < 0x900)
+  //The dump only recorded the sectors that failed, recover them now
+  for (uint8_t d = 0; d < PriamDrive::MAXDRIVES; d++)
+  {
+    if (dump.State(d) == MultiDriveDump::DRIVE_DONE && priamDrive.GetRetryPolicy().DeferRecovery() &&
+        multiDumpBadSectors[d].Sectors())
+      RecoverBadSectors(d, multiDumpBadSectors[d]);
+  }
+#endif
+}
+
+void MeasureBusSpeed()
+{
+  const uint16_t numCycles = 2000;
+  bool wasFast = smartInterface.FastBusEnabled();
+
+  transport.println(F("Measure bus speed (interface status register reads)"));
+
+  if (smartInterface.UseFastBus(false))
+  {
+    transport.print(F("Pin by pin bus: "));
+    transport.print(smartInterface.MeasureRegisterCycleRate(numCycles));
+    transport.println(F(" register cycles/s"));
+  }
+
+  if (smartInterface.UseFastBus(true))
+  {
+    transport.print(F("Port register bus: "));
+    transport.print(smartInterface.MeasureRegisterCycleRate(numCycles));
+    transport.println(F(" register cycles/s"));
+  }
+  else
+  {
+    transport.println(F("Port register bus not available on this board"));
+  }
+
+  smartInterface.UseFastBus(wasFast);
+}
+
+void ToggleSectorOutput()
+{
+  if (sectorStream.GetMode() == SectorStream::OutputMode::HEXDUMP)
+  {
+    sectorStream.SetMode(SectorStream::OutputMode::BINARY);
+    transport.println(F("Sector data is now sent as binary frames"));
+  }
+  else if (sectorStream.GetMode() == SectorStream::OutputMode::BINARY)
+  {
+    sectorStream.SetMode(SectorStream::OutputMode::COMPRESSED);
+    transport.println(F("Sector data is now sent as compressed binary frames"));
+  }
+  else
+  {
+    sectorStream.SetMode(SectorStream::OutputMode::HEXDUMP);
+    transport.println(F("Sector data is now sent as hex dump"));
+  }
+}
+
+void CalibrateBus()
+{
+  transport.println(F("Calibrate bus timing on drive 0, drive must be spun up"));
+
+  if (smartInterface.CalibrateBusTiming(0))
+    transport.println(F("Calibration done, stored in EEPROM"));
+  else
+    transport.println(F("Calibration failed"));
+
+  transport.print(F("Bus delays now: setup "));
+  transport.print(smartInterface.BusDelaySetup());
+  transport.print(F(" pulse "));
+  transport.print(smartInterface.BusDelayPulse());
+  transport.println(F(" (x 250ns)"));
+}
+
+void ProfileSeeks()
+{
+  transport.println(F("Measure seek times on drive 0, drive must be spun up"));
+
+  if (!priamDrive.ProfileSeeks(0))
+  {
+    transport.println(F("Seek profile failed"));
+    return;
+  }
+
+  priamDrive.GetSeekProfile().Dump(transport);
+}
+
+void SetLinkSpeed()
+{
+  static const unsigned long rates[] = {115200, 500000, 1000000, 2000000};
+
+  transport.println(F("Link speed: 1) 115200 2) 500000 3) 1000000 4) 2000000"));
+  transport.println(F("The host has to switch when it sees the BAUD line and send K at the new speed"));
+
+  while (!transport.available())
+    ;
+  int choice = transport.read() - '1';
+  if (choice < 0 || choice > 3)
+  {
+    transport.println(F("Invalid selection"));
+    return;
+  }
+
+  if (!SerialTransport::SupportsBaud(rates[choice]))
+  {
+    transport.println(F("Speed not possible with this CPU clock"));
+    return;
+  }
+
+  if (!transport.NegotiateBaud(rates[choice]))
+    transport.println(F("Host did not confirm, link speed unchanged"));
+}
+
+void ToggleFlowControl()
+{
+  if (transport.GetFlowControl() == SerialTransport::FLOW_NONE)
+  {
+    transport.SetFlowControl(SerialTransport::FLOW_XONXOFF);
+    transport.println(F("Flow control now XON/XOFF"));
+  }
+  else if (transport.GetFlowControl() == SerialTransport::FLOW_XONXOFF)
+  {
+    transport.SetFlowControl(SerialTransport::FLOW_CTS);
+    transport.println(F("Flow control now CTS on A2"));
+  }
+  else
+  {
+    transport.SetFlowControl(SerialTransport::FLOW_NONE);
+    transport.println(F("Flow control now off"));
+  }
+}
+
+void ToggleDtreqHandshake()
+{
+  smartInterface.UseDtreqHandshake(!smartInterface.DtreqHandshakeEnabled());
+  if (smartInterface.DtreqHandshakeEnabled())
+    transport.println(F("Data phase on DTREQ handshake once the next sector read shows DTREQ works"));
+  else
+    transport.println(F("Data phase now polls the status register per byte"));
+}
+
+void PrintStatistics()
+{
+  smartInterface.GetStats().Dump(transport);
+}
+
+void ResetStatistics()
+{
+  smartInterface.GetStats().Reset();
+  transport.println(F("Transaction statistics cleared"));
 }
 
 // the loop function runs over and over again forever
@@ -287,34 +729,83 @@ void loop() {
   {
     smartInterface.WaitForDriveReady(1000, 10);
   
-    Serial.println(F("Drive is ready for commands"));
+    transport.println(F("Drive is ready for commands"));
     startupDone = true;
     digitalWrite(PINKLED, LOW); //turn LED on
   }
   
   //Get rid of anything in serial buffer
-  while (Serial.available())
-    Serial.read();
-
-  Serial.print("\n");
-
-  Serial.println(F("1) Spin up drive"));
-  Serial.println(F("2) Spin down drive"));
-  Serial.println(F("3) Read drive parameters"));
-  Serial.println(F("4) Seek to first cylinder"));
-  Serial.println(F("5) Seek to last cylinder"));
-  Serial.println(F("6) Verify Disk"));
-  Serial.println(F("7) Read 5 sectors from h:0 c:0 s:0"));
-  Serial.println(F("8) Dump all sectors"));
-  Serial.print(F("Your choice>"));
-
-  //Wait for key
-  while (!Serial.available()) ;
+  while (transport.available())
+    transport.read();
+
+  transport.print("\n");
+
+  transport.println(F("1) Spin up drive"));
+  transport.println(F("a) Spin up all drives"));
+  transport.println(F("2) Spin down drive"));
+  transport.println(F("3) Read drive parameters"));
+  transport.println(F("4) Seek to first cylinder"));
+  transport.println(F("5) Seek to last cylinder"));
+  transport.println(F("6) Verify Disk"));
+  transport.println(F("7) Read 5 sectors from h:0 c:0 s:0"));
+  transport.println(F("8) Dump all sectors"));
+  transport.println(F("u) Resume interrupted dump"));
+  transport.println(F("x) Read bad sectors of last dump again"));
+  transport.println(F("m) Dump all drives together"));
+  transport.print(F("t) Toggle dump retry policy, now "));
+  if (priamDrive.GetRetryPolicy().FirstPassRetry())
+    transport.println(F("controller retry only"));
+  else
+    transport.println(F("tiered"));
+  transport.println(F("9) Measure bus speed"));
+  transport.print(F("b) Toggle sector data format, now "));
+  if (sectorStream.GetMode() == SectorStream::OutputMode::HEXDUMP)
+    transport.println(F("hex dump"));
+  else if (sectorStream.GetMode() == SectorStream::OutputMode::BINARY)
+    transport.println(F("binary frames"));
+  else
+    transport.println(F("compressed binary frames"));
+  transport.println(F("c) Calibrate bus timing"));
+  transport.print(F("l) Set link speed, now "));
+  transport.println(transport.Baud());
+  transport.print(F("f) Toggle flow control, now "));
+  if (transport.GetFlowControl() == SerialTransport::FLOW_NONE)
+    transport.println(F("off"));
+  else if (transport.GetFlowControl() == SerialTransport::FLOW_XONXOFF)
+    transport.println(F("XON/XOFF"));
+  else
+    transport.println(F("CTS"));
+  transport.print(F("d) Toggle DTREQ data handshake, now "));
+  if (smartInterface.DtreqHandshakeValidated())
+    transport.println(F("on"));
+  else if (smartInterface.DtreqHandshakeEnabled())
+    transport.println(F("on, checked on the next sector read"));
+  else
+    transport.println(F("off"));
+  transport.println(F("p) Measure seek time profile"));
+  transport.println(F("s) Show transaction latency statistics"));
+  transport.println(F("r) Reset transaction latency statistics"));
+  transport.print(F("Your choice>"));
+
+  //Wait for key, running the background command meanwhile
+  while (!transport.available())
+    PollPendingTransaction();
   
-  char incoming = Serial.read();
+  char incoming = transport.read();
 
-  Serial.print(incoming);
-  Serial.print("\n\n");
+  if ((uint8_t) incoming == HostProtocol::SYNC0)
+  {
+    FinishPendingTransaction();
+    hostProtocol.Run(true);
+    transport.flush();
+    return;
+  }
+
+  transport.print(incoming);
+  transport.print("\n\n");
+
+  if (IssuesCommand(incoming))
+    FinishPendingTransaction();
   
 
   switch (incoming)
@@ -322,6 +813,9 @@ void loop() {
     case '1':
       Spinup();
       break;
+    case 'a':
+      SpinupAllDrives();
+      break;
     case '2':
       Spindown();
       break;
@@ -341,10 +835,49 @@ void loop() {
       ReadData(0, 0, 0, 0, 5);
       break;
     case '8':
-      ReadAllSectors();
+      ReadAllSectors(false);
+      break;
+    case 'u':
+      ReadAllSectors(true);
+      break;
+    case 'x':
+      RereadBadSectors();
+      break;
+    case 'm':
+      DumpAllDrives();
+      break;
+    case 't':
+      ToggleRetryPolicy();
+      break;
+    case '9':
+      MeasureBusSpeed();
+      break;
+    case 'b':
+      ToggleSectorOutput();
+      break;
+    case 'c':
+      CalibrateBus();
+      break;
+    case 'l':
+      SetLinkSpeed();
+      break;
+    case 'f':
+      ToggleFlowControl();
+      break;
+    case 'd':
+      ToggleDtreqHandshake();
+      break;
+    case 'p':
+      ProfileSeeks();
+      break;
+    case 's':
+      PrintStatistics();
+      break;
+    case 'r':
+      ResetStatistics();
       break;
     default:
-      Serial.println(F("Invalid selection"));
+      transport.println(F("Invalid selection"));
   }
 
   
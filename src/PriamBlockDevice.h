@@ -0,0 +1,85 @@
+#pragma once
+#include "arduino.h"
+#include "PriamDrive.h"
+
+namespace Priam
+{
+
+//One drive as a row of blocks (sectors) addressed by LBA, see DriveGeometry for the block order
+//The geometry comes from the PriamDrive cache, so a request costs no READ DRIVE PARAMETERS after the first one
+//A request is split at track ends into the fewest READ DATA commands, one per track it touches
+class BlockDevice
+{
+  public:
+  BlockDevice(PriamDrive &drive, uint8_t driveno) : drive_(drive), driveno_(driveno), status_(0, true) {}
+
+  uint8_t DriveNo() {return driveno_;}
+  //0 if the drive parameters can not be read
+  uint32_t Blocks() {return Geometry().Blocks();}
+  uint16_t BlockSize() {return Geometry().SectorSize();}
+  DriveGeometry Geometry() {return drive_.Geometry(driveno_);}
+
+  bool ReadBlocks(uint32_t lba, uint32_t count, bool withRetry = true)
+  {
+    NullDataSink sink;
+    return ReadBlocks(lba, count, sink, nullptr, withRetry);
+  }
+
+  //Read count blocks from lba, the data goes to sink with BeginTransfer/EndTransfer around every command
+  //Returns true if all blocks were read. On false, blocksRead (if not nullptr) is the number of blocks that
+  //were read before the failing one and LastStatus() the status of the failing command. A request outside
+  //the disk or with the drive parameters not readable issues no read, LastStatus() then is the geometry status
+  template <class SINK>
+  bool ReadBlocks(uint32_t lba, uint32_t count, SINK &sink, uint32_t *blocksRead = nullptr, bool withRetry = true)
+  {
+    DriveGeometry geometry = Geometry();
+    status_ = geometry.GetStatus();
+    if (blocksRead)
+      *blocksRead = 0;
+
+    if (!geometry.Valid() || lba >= geometry.Blocks() || count > geometry.Blocks() - lba)
+      return false;
+
+    uint8_t head, sector;
+    uint16_t cylinder;
+    geometry.Chs(lba, head, cylinder, sector);
+
+    while (count)
+    {
+      uint8_t blocks = (uint8_t) (geometry.SectorsPerTrack() - sector);
+      if (blocks > count)
+        blocks = (uint8_t) count;
+
+      CountingDataSink<SINK> counter(sink);
+      status_ = drive_.ReadData(driveno_, head, cylinder, sector, blocks, counter, withRetry);
+      if (status_.CommsError() || status_.IsErrorStatus())
+      {
+        //The controller stops at the failing sector, the ones before it were transferred
+        if (blocksRead)
+          *blocksRead += counter.Count() / geometry.SectorSize();
+        return false;
+      }
+
+      if (blocksRead)
+        *blocksRead += blocks;
+      count -= blocks;
+      sector = 0;
+      if (++head >= geometry.Heads())
+      {
+        head = 0;
+        cylinder++;
+      }
+    }
+    return true;
+  }
+
+  //Status of the last command of ReadBlocks
+  TransactionStatus LastStatus() {return status_;}
+
+  private:
+  PriamDrive &drive_;
+  uint8_t driveno_;
+  TransactionStatus status_;
+};
+
+}
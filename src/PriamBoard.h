@@ -0,0 +1,237 @@
+#pragma once
+#include "arduino.h"
+
+//Board descriptors: where the Smart Interface signals are wired, resolved at compile time
+//Select one with PRIAMSMART_BOARD, the default is the shield wiring on an Uno/Nano:
+//  -DPRIAMSMART_BOARD=Priam::BoardMegaPortA
+//
+//A descriptor is a class with only static constant members:
+//  Dbus(bit), Addr(bit)        Arduino pins of DBUS0..7 and AD0..2, used by the portable digitalWrite/digitalRead bus
+//  RESETLINE DTREQ DBUSENA HRD HWR CTSLINE
+//                              Arduino pins of the control lines, CTSLINE is the host flow control input (SerialTransport)
+//  DTREQ_ACTIVE                level of DTREQ when the interface requests a data transfer
+//  FASTBUS                     true if the AVR port layout below is valid on the board being compiled for
+//  DBUSLOW_PORT DBUSLOW_SHIFT DBUSLOW_BITS
+//                              DBUS0..DBUSLOW_BITS-1 are on DBUSLOW_PORT, starting at bit DBUSLOW_SHIFT
+//  DBUSHIGH_PORT DBUSHIGH_SHIFT
+//                              the remaining data bits on DBUSHIGH_PORT, starting at bit DBUSHIGH_SHIFT.
+//                              With all 8 bits on one port set DBUSHIGH_PORT to DBUSLOW_PORT, it is not accessed
+//  ADDR_PORT ADDR_SHIFT        AD0..2 on ADDR_PORT, starting at bit ADDR_SHIFT
+//  HRD_PORT HRD_BIT HWR_PORT HWR_BIT DTREQ_PORT DTREQ_BIT
+//                              HRD, HWR and DTREQ port bits
+//The port layout is only used by the fast bus on AVR, other boards use the portable bus with the pin numbers
+//Both must describe the same wiring
+
+#ifndef PRIAMSMART_BOARD
+#define PRIAMSMART_BOARD Priam::BoardUnoShield
+#endif
+
+namespace Priam
+{
+
+//AVR ports for the board descriptors
+enum AvrPortName {
+  AVRPORT_A, AVRPORT_B, AVRPORT_C, AVRPORT_D, AVRPORT_E, AVRPORT_F,
+  AVRPORT_G, AVRPORT_H, AVRPORT_J, AVRPORT_K, AVRPORT_L
+  };
+
+//Priam shield on an ATmega328P/168 (Uno, Nano, Pro Mini)
+//DBUS0..5 = D2..D7 = PD2..PD7, DBUS6..7 = D8..D9 = PB0..PB1, AD0..2 = D10..D12 = PB2..PB4
+//RESET = D13, DBUSENA = A0, DTREQ = A1 = PC1, A2 free (CTS), HRD = A3 = PC3, HWR = A4 = PC4, A5 is the shield LED
+class BoardUnoShield
+{
+  public:
+  static constexpr uint8_t Dbus(uint8_t bit) {return (uint8_t) (2 + bit);}
+  static constexpr uint8_t Addr(uint8_t bit) {return (uint8_t) (10 + bit);}
+
+  static const uint8_t RESETLINE = 13;
+  static const uint8_t DBUSENA = 14;
+  static const uint8_t DTREQ = 15;
+  static const uint8_t CTSLINE = 16;
+  static const uint8_t HRD = 17;
+  static const uint8_t HWR = 18;
+  static const uint8_t DTREQ_ACTIVE = LOW;
+
+#if defined(__AVR_ATmega328P__) || defined(__AVR_ATmega328__) || defined(__AVR_ATmega168__)
+  static const bool FASTBUS = true;
+#else
+  static const bool FASTBUS = false;
+#endif
+  static const AvrPortName DBUSLOW_PORT = AVRPORT_D;
+  static const uint8_t DBUSLOW_SHIFT = 2;
+  static const uint8_t DBUSLOW_BITS = 6;
+  static const AvrPortName DBUSHIGH_PORT = AVRPORT_B;
+  static const uint8_t DBUSHIGH_SHIFT = 0;
+  static const AvrPortName ADDR_PORT = AVRPORT_B;
+  static const uint8_t ADDR_SHIFT = 2;
+  static const AvrPortName HRD_PORT = AVRPORT_C;
+  static const uint8_t HRD_BIT = 3;
+  static const AvrPortName HWR_PORT = AVRPORT_C;
+  static const uint8_t HWR_BIT = 4;
+  static const AvrPortName DTREQ_PORT = AVRPORT_C;
+  static const uint8_t DTREQ_BIT = 1;
+};
+
+//ATmega1280/2560 (Mega) with the data bus on one full port
+//DBUS0..7 = D22..D29 = PA0..PA7, AD0..2 = D37..D35 = PC0..PC2, HRD = D34 = PC3, HWR = D33 = PC4
+//RESET = D13, DBUSENA = A0, DTREQ = A1 = PF1, CTS = A2 as on the shield
+class BoardMegaPortA
+{
+  public:
+  static constexpr uint8_t Dbus(uint8_t bit) {return (uint8_t) (22 + bit);}
+  static constexpr uint8_t Addr(uint8_t bit) {return (uint8_t) (37 - bit);}
+
+  static const uint8_t RESETLINE = 13;
+  static const uint8_t DBUSENA = 54;
+  static const uint8_t DTREQ = 55;
+  static const uint8_t CTSLINE = 56;
+  static const uint8_t HRD = 34;
+  static const uint8_t HWR = 33;
+  static const uint8_t DTREQ_ACTIVE = LOW;
+
+#if defined(__AVR_ATmega2560__) || defined(__AVR_ATmega1280__)
+  static const bool FASTBUS = true;
+#else
+  static const bool FASTBUS = false;
+#endif
+  static const AvrPortName DBUSLOW_PORT = AVRPORT_A;
+  static const uint8_t DBUSLOW_SHIFT = 0;
+  static const uint8_t DBUSLOW_BITS = 8;
+  static const AvrPortName DBUSHIGH_PORT = AVRPORT_A;
+  static const uint8_t DBUSHIGH_SHIFT = 0;
+  static const AvrPortName ADDR_PORT = AVRPORT_C;
+  static const uint8_t ADDR_SHIFT = 0;
+  static const AvrPortName HRD_PORT = AVRPORT_C;
+  static const uint8_t HRD_BIT = 3;
+  static const AvrPortName HWR_PORT = AVRPORT_C;
+  static const uint8_t HWR_BIT = 4;
+  static const AvrPortName DTREQ_PORT = AVRPORT_F;
+  static const uint8_t DTREQ_BIT = 1;
+};
+
+#if defined(__AVR__)
+//Port, direction and input registers of an AVR port
+template <AvrPortName PORT> class AvrPort;
+
+#define PRIAMSMART_AVRPORT(NAME, LETTER) \
+  template <> class AvrPort<NAME> \
+  { \
+    public: \
+    static volatile uint8_t &Out() {return PORT##LETTER;} \
+    static volatile uint8_t &Dir() {return DDR##LETTER;} \
+    static volatile uint8_t &In() {return PIN##LETTER;} \
+  };
+
+#if defined(PORTA)
+PRIAMSMART_AVRPORT(AVRPORT_A, A)
+#endif
+#if defined(PORTB)
+PRIAMSMART_AVRPORT(AVRPORT_B, B)
+#endif
+#if defined(PORTC)
+PRIAMSMART_AVRPORT(AVRPORT_C, C)
+#endif
+#if defined(PORTD)
+PRIAMSMART_AVRPORT(AVRPORT_D, D)
+#endif
+#if defined(PORTE)
+PRIAMSMART_AVRPORT(AVRPORT_E, E)
+#endif
+#if defined(PORTF)
+PRIAMSMART_AVRPORT(AVRPORT_F, F)
+#endif
+#if defined(PORTG)
+PRIAMSMART_AVRPORT(AVRPORT_G, G)
+#endif
+#if defined(PORTH)
+PRIAMSMART_AVRPORT(AVRPORT_H, H)
+#endif
+#if defined(PORTJ)
+PRIAMSMART_AVRPORT(AVRPORT_J, J)
+#endif
+#if defined(PORTK)
+PRIAMSMART_AVRPORT(AVRPORT_K, K)
+#endif
+#if defined(PORTL)
+PRIAMSMART_AVRPORT(AVRPORT_L, L)
+#endif
+
+#undef PRIAMSMART_AVRPORT
+
+//Bus access through the AVR port registers of a board descriptor
+//Masks and shifts are constants, so each step is one or two port accesses and a data bus on one full
+//port is a single port read or write. Pins returned to input have their pullup off, same as pinMode(INPUT)
+template <class BOARD>
+class FastBus
+{
+  public:
+  typedef AvrPort<BOARD::DBUSLOW_PORT> Low;
+  typedef AvrPort<BOARD::DBUSHIGH_PORT> High;
+  typedef AvrPort<BOARD::ADDR_PORT> Addr;
+  typedef AvrPort<BOARD::HRD_PORT> Hrd;
+  typedef AvrPort<BOARD::HWR_PORT> Hwr;
+  typedef AvrPort<BOARD::DTREQ_PORT> Dtreq;
+
+  static constexpr uint8_t HighBits() {return (uint8_t) (8 - BOARD::DBUSLOW_BITS);}
+  static constexpr uint8_t LowMask() {return (uint8_t) (((1u << BOARD::DBUSLOW_BITS) - 1) << BOARD::DBUSLOW_SHIFT);}
+  static constexpr uint8_t HighMask() {return (uint8_t) (((1u << HighBits()) - 1) << BOARD::DBUSHIGH_SHIFT);}
+  static constexpr uint8_t AddrMask() {return (uint8_t) (7u << BOARD::ADDR_SHIFT);}
+  static constexpr uint8_t HrdMask() {return (uint8_t) (1u << BOARD::HRD_BIT);}
+  static constexpr uint8_t HwrMask() {return (uint8_t) (1u << BOARD::HWR_BIT);}
+  static constexpr uint8_t DtreqMask() {return (uint8_t) (1u << BOARD::DTREQ_BIT);}
+
+  static void DataInput()
+  {
+    Low::Dir() &= (uint8_t) ~LowMask();
+    Low::Out() &= (uint8_t) ~LowMask();
+    if (HighBits())
+    {
+      High::Dir() &= (uint8_t) ~HighMask();
+      High::Out() &= (uint8_t) ~HighMask();
+    }
+  }
+
+  static void DataOutput(uint8_t value)
+  {
+    if (LowMask() == 0xFF)
+      Low::Out() = value;
+    else
+      Low::Out() = (uint8_t) ((Low::Out() & ~LowMask()) | ((value << BOARD::DBUSLOW_SHIFT) & LowMask()));
+    if (HighBits())
+      High::Out() = (uint8_t) ((High::Out() & ~HighMask()) | (((value >> BOARD::DBUSLOW_BITS) << BOARD::DBUSHIGH_SHIFT) & HighMask()));
+
+    Low::Dir() |= LowMask();
+    if (HighBits())
+      High::Dir() |= HighMask();
+  }
+
+  //Both ports are sampled back to back
+  static uint8_t DataRead()
+  {
+    uint8_t low = Low::In();
+    uint8_t high = HighBits() ? High::In() : 0;
+    return (uint8_t) (((low & LowMask()) >> BOARD::DBUSLOW_SHIFT) | (((high & HighMask()) >> BOARD::DBUSHIGH_SHIFT) << BOARD::DBUSLOW_BITS));
+  }
+
+  static void AddrOutput(uint8_t address)
+  {
+    Addr::Out() = (uint8_t) ((Addr::Out() & ~AddrMask()) | ((address << BOARD::ADDR_SHIFT) & AddrMask()));
+    Addr::Dir() |= AddrMask();
+  }
+
+  static void AddrInput()
+  {
+    Addr::Dir() &= (uint8_t) ~AddrMask();
+    Addr::Out() &= (uint8_t) ~AddrMask();
+  }
+
+  static void HrdAssert() {Hrd::Out() &= (uint8_t) ~HrdMask();}
+  static void HrdRelease() {Hrd::Out() |= HrdMask();}
+  static void HwrAssert() {Hwr::Out() &= (uint8_t) ~HwrMask();}
+  static void HwrRelease() {Hwr::Out() |= HwrMask();}
+
+  static bool DtreqAsserted() {return ((Dtreq::In() & DtreqMask()) != 0) == (BOARD::DTREQ_ACTIVE != LOW);}
+};
+#endif
+
+}
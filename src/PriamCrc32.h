@@ -0,0 +1,18 @@
+#pragma once
+#include "arduino.h"
+
+//CRC32 lookup table: 256 entries (1 KB flash, one lookup per byte) or 16 entries (64 bytes, two lookups per byte)
+#ifndef PRIAMSMART_CRC32_TABLE
+#define PRIAMSMART_CRC32_TABLE 256
+#endif
+
+namespace Priam
+{
+
+//CRC-32 (IEEE 802.3, as zlib crc32): reflected poly 0xEDB88320
+//Start with CRC32_INIT, update with every byte, the final CRC is the value XOR CRC32_INIT
+static const uint32_t CRC32_INIT = 0xFFFFFFFFUL;
+
+uint32_t Crc32Update(uint32_t crc, uint8_t val);
+
+}
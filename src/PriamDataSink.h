@@ -0,0 +1,149 @@
+#pragma once
+#include "arduino.h"
+#include "PriamSmartCommandResult.h"
+
+namespace Priam
+{
+
+//CRC-16/CCITT (poly 0x1021, init 0xFFFF) update, one byte
+inline uint16_t Crc16Update(uint16_t crc, uint8_t val)
+{
+  crc = (uint16_t) (crc ^ (val << 8));
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    if (crc & 0x8000)
+      crc = (uint16_t) ((crc << 1) ^ 0x1021);
+    else
+      crc = (uint16_t) (crc << 1);
+  }
+  return crc;
+}
+
+//Data phase sinks and sources for PriamSmart::TransactNew
+//TransactNew is templated on the sink class, so the calls below are resolved at compile time
+//A sink/source class must provide:
+//  void BeginTransfer(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, uint16_t sectorSize)
+//      called by PriamDrive before a command with a data phase is issued
+//  void Put(uint8_t val)
+//      called for every byte read from READDISCDATA
+//  uint8_t Get()
+//      called for every byte to be written to WRITEDISCDATA
+//  void EndTransfer(TransactionStatus status)
+//      called by PriamDrive when the command has completed
+//  void Idle()
+//      called by PriamSmart while it waits for the controller, for work that can overlap the command
+//  void Checkpoint(uint8_t drive, uint8_t head, uint16_t cylinder)
+//      called by PriamDrive::DumpTracks after each track, head/cylinder is the next track it will read
+//DataSinkBase implements all of them as no-ops, derive from it and redefine the ones needed
+class DataSinkBase
+{
+  public:
+  void BeginTransfer(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, uint16_t sectorSize)
+  {
+    (void) drive; (void) head; (void) cylinder; (void) sector; (void) sectorSize;
+  }
+  void Put(uint8_t val) {(void) val;}
+  uint8_t Get() {return 0;}
+  void EndTransfer(TransactionStatus status) {(void) status;}
+  void Idle() {}
+  void Checkpoint(uint8_t drive, uint8_t head, uint16_t cylinder) {(void) drive; (void) head; (void) cylinder;}
+};
+
+//Discards read data, writes zeroes
+typedef DataSinkBase NullDataSink;
+
+//Reads into / writes from a caller supplied buffer
+//Bytes that do not fit in the buffer are counted but dropped, bytes beyond the end of the buffer are written as 0
+class BufferDataSink : public DataSinkBase
+{
+  public:
+  BufferDataSink(uint8_t *buffer, uint16_t size) :
+  buffer_(buffer), size_(size), pos_(0), overflow_(0) {}
+
+  void Put(uint8_t val)
+  {
+    if (pos_ < size_)
+      buffer_[pos_++] = val;
+    else
+      overflow_++;
+  }
+
+  uint8_t Get()
+  {
+    if (pos_ < size_)
+      return buffer_[pos_++];
+
+    overflow_++;
+    return 0;
+  }
+
+  //Restart at the beginning of the buffer
+  void Rewind() {pos_ = 0; overflow_ = 0;}
+
+  //Number of bytes transferred to/from the buffer
+  uint16_t Count() {return pos_;}
+
+  //Number of bytes that did not fit
+  uint16_t Overflow() {return overflow_;}
+
+  private:
+  uint8_t *buffer_;
+  uint16_t size_;
+  uint16_t pos_;
+  uint16_t overflow_;
+};
+
+//Passes everything on to another sink and counts the bytes read in the current transfer
+//Used to find out how many sectors of a multi sector read arrived before an error
+template <class SINK>
+class CountingDataSink
+{
+  public:
+  CountingDataSink(SINK &sink) : sink_(sink), count_(0) {}
+
+  void BeginTransfer(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, uint16_t sectorSize)
+  {
+    count_ = 0;
+    sink_.BeginTransfer(drive, head, cylinder, sector, sectorSize);
+  }
+  void Put(uint8_t val) {count_++; sink_.Put(val);}
+  uint8_t Get() {return sink_.Get();}
+  void EndTransfer(TransactionStatus status) {sink_.EndTransfer(status);}
+  void Idle() {sink_.Idle();}
+  void Checkpoint(uint8_t drive, uint8_t head, uint16_t cylinder) {sink_.Checkpoint(drive, head, cylinder);}
+
+  uint32_t Count() {return count_;}
+
+  private:
+  SINK &sink_;
+  uint32_t count_;
+};
+
+//Computes a CRC-16/CCITT and byte count of the data, without storing it
+class ChecksumDataSink : public DataSinkBase
+{
+  public:
+  ChecksumDataSink() : crc_(0xFFFF), count_(0) {}
+
+  void BeginTransfer(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, uint16_t sectorSize)
+  {
+    (void) drive; (void) head; (void) cylinder; (void) sector; (void) sectorSize;
+    crc_ = 0xFFFF;
+    count_ = 0;
+  }
+
+  void Put(uint8_t val)
+  {
+    crc_ = Crc16Update(crc_, val);
+    count_++;
+  }
+
+  uint16_t Crc() {return crc_;}
+  uint32_t Count() {return count_;}
+
+  private:
+  uint16_t crc_;
+  uint32_t count_;
+};
+
+}
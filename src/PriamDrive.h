@@ -3,28 +3,264 @@
 #include "PriamSmartCommand.h"
 #include "PriamSmartCommandResult.h"
 #include "PriamHighlevelCommands.h"
+#include "PriamDumpState.h"
+#include "PriamRetryPolicy.h"
+#include "PriamSeekProfile.h"
 //High level class for "drive" object
 
 using namespace Priam;
 
+namespace Priam
+{
+class MultiDriveDump;
+}
+
+//Called by PriamDrive::DumpTracks after each track
+typedef void (*TrackStatusCallback)(uint8_t driveno, uint8_t head, uint16_t cylinder, TransactionStatus status);
+
+//Result of PriamDrive::DumpTracks
+class DumpResult
+{
+    public:
+    DumpResult() : paramsOk_(false), commsError_(false), tracksRead_(0), tracksFailed_(0), sectorsBad_(0) {};
+
+    //False if the drive parameters could not be read, nothing was dumped
+    bool ParamsOk() {return paramsOk_;}
+    //True if the dump was aborted on an interface comms error
+    bool CommsError() {return commsError_;}
+    uint32_t TracksRead() {return tracksRead_;}
+    uint32_t TracksFailed() {return tracksFailed_;}
+    uint32_t SectorsBad() {return sectorsBad_;}
+
+    private:
+    friend class PriamDrive;
+    friend class Priam::MultiDriveDump;
+    bool paramsOk_;
+    bool commsError_;
+    uint32_t tracksRead_;
+    uint32_t tracksFailed_;
+    uint32_t sectorsBad_;
+};
+
+//Drive geometry from READ DRIVE PARAMETERS, cached per drive by PriamDrive::Geometry()
+//Blocks are numbered cylinder by cylinder, head by head within a cylinder, the order DumpTracks reads them
+class DriveGeometry
+{
+    public:
+    DriveGeometry() : status_(0, true), cylinders_(0), heads_(0), sectorsPerTrack_(0), sectorSize_(0) {};
+    DriveGeometry(ResultDriveParams &params) :
+    status_(params.GetStatus()), cylinders_(params.Cylinders()), heads_(params.Heads()),
+    sectorsPerTrack_(params.SectorsPerTrack()), sectorSize_(params.LogicalSectorSize()) {};
+
+    //False if the parameters could not be read, GetStatus() tells why
+    bool Valid() {return !status_.CommsError() && !status_.IsErrorStatus() && cylinders_ && heads_ && sectorsPerTrack_ && sectorSize_;}
+    TransactionStatus GetStatus() {return status_;}
+
+    uint16_t Cylinders() {return cylinders_;}
+    uint8_t Heads() {return heads_;}
+    uint8_t SectorsPerTrack() {return sectorsPerTrack_;}
+    uint16_t SectorSize() {return sectorSize_;}
+    uint32_t Blocks() {return (uint32_t) cylinders_ * heads_ * sectorsPerTrack_;}
+
+    uint32_t Lba(uint8_t head, uint16_t cylinder, uint8_t sector)
+    {
+        return ((uint32_t) cylinder * heads_ + head) * sectorsPerTrack_ + sector;
+    }
+
+    void Chs(uint32_t lba, uint8_t &head, uint16_t &cylinder, uint8_t &sector)
+    {
+        uint32_t track = lba / sectorsPerTrack_;
+        sector = (uint8_t) (lba - track * sectorsPerTrack_);
+        cylinder = (uint16_t) (track / heads_);
+        head = (uint8_t) (track - (uint32_t) cylinder * heads_);
+    }
+
+    private:
+    TransactionStatus status_;
+    uint16_t cylinders_;
+    uint8_t heads_;
+    uint8_t sectorsPerTrack_;
+    uint16_t sectorSize_;
+};
+
+//Spin up of one drive, advanced without blocking by PriamDrive::SpinupBegin and PriamDrive::SpinupPoll
+class DriveSpinup
+{
+    public:
+    enum State {
+        NOTREQUESTED = 0,
+        NOTATTACHED,    //the sequence up command failed
+        SPINNING,       //polled until it answers READ DRIVE PARAMETERS
+        READY,
+        TIMEDOUT,       //did not get ready in time
+        COMMSERROR
+    };
+
+    DriveSpinup() : state_(NOTREQUESTED), start_(0), lastPoll_(0), readyMillis_(0) {};
+
+    State GetState() {return state_;}
+    //Milliseconds from SpinupBegin until the drive answered READ DRIVE PARAMETERS, 0 if it was ready already
+    unsigned long ReadyMillis() {return readyMillis_;}
+
+    private:
+    friend class PriamDrive;
+    State state_;
+    unsigned long start_;
+    unsigned long lastPoll_;
+    unsigned long readyMillis_;
+};
+
 class PriamDrive
 {
     public:
-    PriamDrive(PriamSmart &interface) : interface_(interface) {};
+    PriamDrive(PriamSmart &interface) : interface_(interface), geometryResets_{0} {};
+
+    //Number of drives addressable through one Smart Interface
+    static const uint8_t MAXDRIVES = 4;
+
+    //Sector size used when the drive parameters can not be read
+    static const uint16_t DEFAULTSECTORSIZE = 512;
 
     TransactionStatus SpinupWait(uint8_t driveno)
+    {
+        NullDataSink sink;
+        return SpinupWait(driveno, sink);
+    }
+
+    //Spin up, sink.Idle() is called while the drive spins up
+    template <class SINK>
+    TransactionStatus SpinupWait(uint8_t driveno, SINK &sink)
     {
         DriveParam drive(driveno);
         DriveCmd_SpinupAndWait hlcmd;
-        TransactionStatus st = hlcmd.Execute(interface_, drive);   
+        TransactionStatus st = hlcmd.Execute(interface_, drive, sink);
         return st;
     }
 
+    //Start the spin up and return at once, the drive reports not ready until it is up to speed
+    TransactionStatus SpinupStart(uint8_t driveno)
+    {
+        DriveParam drive(driveno);
+        DriveCmd_SpinupAndReturn hlcmd;
+        return hlcmd.Execute(interface_, drive);
+    }
+
+    //Time between readiness polls of a spinning up drive, and how long a spin up may take
+    static const unsigned long SPINUPPOLL_MS = 250;
+    static const unsigned long SPINUPTIMEOUT_MS = 60000;
+
+    //Non-blocking spin up of one drive: SpinupBegin reads the drive parameters and sends SEQUENCE UP AND RETURN
+    //if the drive is not ready, SpinupPoll reads them again every SPINUPPOLL_MS until the drive answers or
+    //timeout_ms after SpinupBegin. Both return true once the spin up is over, see spinup.GetState()
+    //The drive geometry is cached (see Geometry) when the drive is READY
+    bool SpinupBegin(uint8_t driveno, DriveSpinup &spinup)
+    {
+        spinup = DriveSpinup();
+        spinup.start_ = millis();
+        spinup.lastPoll_ = spinup.start_;
+
+        TransactionStatus st = ReadParams(driveno).GetStatus();
+        if (!st.CommsError() && !st.IsErrorStatus())
+        {
+            spinup.state_ = DriveSpinup::READY;
+            return true;
+        }
+
+        if (!st.CommsError())
+            st = SpinupStart(driveno);
+
+        if (st.CommsError())
+            spinup.state_ = DriveSpinup::COMMSERROR;
+        else if (st.IsErrorStatus())
+            spinup.state_ = DriveSpinup::NOTATTACHED;
+        else
+            spinup.state_ = DriveSpinup::SPINNING;
+        return spinup.state_ != DriveSpinup::SPINNING;
+    }
+
+    bool SpinupPoll(uint8_t driveno, DriveSpinup &spinup, unsigned long timeout_ms = SPINUPTIMEOUT_MS)
+    {
+        if (spinup.state_ != DriveSpinup::SPINNING)
+            return true;
+        if (millis() - spinup.lastPoll_ < SPINUPPOLL_MS)
+            return false;
+        spinup.lastPoll_ = millis();
+
+        TransactionStatus st = ReadParams(driveno).GetStatus();
+        if (st.CommsError())
+            spinup.state_ = DriveSpinup::COMMSERROR;
+        else if (!st.IsErrorStatus())
+        {
+            spinup.state_ = DriveSpinup::READY;
+            spinup.readyMillis_ = millis() - spinup.start_;
+        }
+        else if (millis() - spinup.start_ >= timeout_ms)
+            spinup.state_ = DriveSpinup::TIMEDOUT;
+        return spinup.state_ != DriveSpinup::SPINNING;
+    }
+
+    //Result of SpinupAll, per drive
+    class SpinupResult
+    {
+        public:
+        DriveSpinup::State State(uint8_t driveno) {return drives_[driveno].GetState();}
+        unsigned long ReadyMillis(uint8_t driveno) {return drives_[driveno].ReadyMillis();}
+
+        //Bit n set if drive n is ready
+        uint8_t ReadyMask()
+        {
+            uint8_t mask = 0;
+            for (uint8_t d = 0; d < MAXDRIVES; d++)
+                if (drives_[d].GetState() == DriveSpinup::READY)
+                    mask |= (uint8_t) bit(d);
+            return mask;
+        }
+
+        private:
+        friend class PriamDrive;
+        DriveSpinup drives_[MAXDRIVES];
+    };
+
+    SpinupResult SpinupAll(uint8_t driveMask, unsigned long timeout_ms = SPINUPTIMEOUT_MS)
+    {
+        NullDataSink sink;
+        return SpinupAll(driveMask, sink, timeout_ms);
+    }
+
+    //Spin up the drives in driveMask (bit n for drive n) together with SpinupBegin and SpinupPoll
+    //The drives come up in about the time of one spin up instead of one after the other with SpinupWait
+    //sink.Idle() is called while waiting
+    template <class SINK>
+    SpinupResult SpinupAll(uint8_t driveMask, SINK &sink, unsigned long timeout_ms = SPINUPTIMEOUT_MS)
+    {
+        SpinupResult result;
+        bool spinning = false;
+
+        for (uint8_t d = 0; d < MAXDRIVES; d++)
+            if ((driveMask & bit(d)) && !SpinupBegin(d, result.drives_[d]))
+                spinning = true;
+
+        while (spinning)
+        {
+            sink.Idle();
+            delay(1);
+
+            spinning = false;
+            for (uint8_t d = 0; d < MAXDRIVES; d++)
+                if (!SpinupPoll(d, result.drives_[d], timeout_ms))
+                    spinning = true;
+        }
+
+        return result;
+    }
+
     TransactionStatus SpinDown(uint8_t driveno)
     {
         DriveParam drive(driveno);
         DriveCmd_SpinDown hlcmd;
         TransactionStatus st = hlcmd.Execute(interface_, drive);   
+        if (driveno < MAXDRIVES)
+            geometry_[driveno] = DriveGeometry();
         return st;
     }
 
@@ -33,9 +269,37 @@ class PriamDrive
         DriveParam drive(driveno);
         DriveCmd_ReadParams rdpCmd;
         ResultDriveParams res = rdpCmd.Execute(interface_, drive);
+        if (driveno < MAXDRIVES)
+        {
+            geometry_[driveno] = DriveGeometry(res);
+            geometryResets_[driveno] = interface_.ResetCount();
+        }
         return res;
     }
 
+    //Geometry of the drive, read with ReadParams the first time it is needed and after SpinDown or an
+    //interface reset. An invalid geometry (not ready, comms error) is read again on the next call
+    DriveGeometry Geometry(uint8_t driveno)
+    {
+        if (driveno >= MAXDRIVES)
+            return DriveGeometry();
+
+        if (!geometry_[driveno].Valid() || geometryResets_[driveno] != interface_.ResetCount())
+            ReadParams(driveno);
+
+        return geometry_[driveno];
+    }
+
+    //Logical sector size of the drive from Geometry()
+    uint16_t SectorSize(uint8_t driveno)
+    {
+        DriveGeometry geometry = Geometry(driveno);
+        if (!geometry.Valid())
+            return DEFAULTSECTORSIZE;
+
+        return geometry.SectorSize();
+    }
+
     ResultCylinder Seek(uint8_t driveno, uint8_t head, uint16_t cylinder, bool withRetry = true)
     {
         SeekParam seekP(driveno, head, cylinder);
@@ -48,39 +312,344 @@ class PriamDrive
         }
         else
         {
-            DriveCmd_SeekWithRetry cmdSeekNoRetry;
+            DriveCmd_SeekNoRetry cmdSeekNoRetry;
             ResultCylinder res = cmdSeekNoRetry.Execute(interface_, seekP);
             return res;
         }
         
     }
 
+    //Measure seek time against distance over the whole stroke with no retry seeks, the drive must be spun up
+    //Every distance is measured at samples positions spread from cylinder 0 to the last cylinder, in both
+    //directions, and averaged. Returns false if a seek failed, the profile is then invalid
+    bool ProfileSeeks(uint8_t driveno, uint8_t samples = 3)
+    {
+        ResultDriveParams params = ReadParams(driveno);
+        if (params.GetStatus().CommsError() || params.GetStatus().IsErrorStatus() || !samples)
+            return false;
+
+        uint16_t cylinders = params.Cylinders();
+        seekProfile_.Begin(driveno, cylinders);
+
+        for (uint8_t point = 0; point < seekProfile_.Points(); point++)
+        {
+            uint16_t distance = seekProfile_.Distance(point);
+            uint32_t total = 0;
+
+            for (uint8_t sample = 0; sample < samples; sample++)
+            {
+                uint16_t from = (samples > 1) ? (uint16_t) ((uint32_t) (cylinders - 1 - distance) * sample / (samples - 1)) : 0;
+                uint16_t to = (uint16_t) (from + distance);
+
+                if (!TimedSeek(driveno, from, nullptr) || !TimedSeek(driveno, to, &total) || !TimedSeek(driveno, from, &total))
+                {
+                    seekProfile_.Invalidate();
+                    return false;
+                }
+            }
+
+            seekProfile_.SetMicros(point, total / (2 * samples));
+        }
+
+        seekProfile_.Finish();
+        return true;
+    }
+
+    //Last measured seek profile
+    SeekProfile &GetSeekProfile() {return seekProfile_;}
+
+    //Predicted time of a seek command of drive driveno in microseconds from the seek profile, 0 if no profile
+    //was measured on that drive
+    uint32_t PredictSeekMicros(uint8_t driveno, uint16_t fromCylinder, uint16_t toCylinder)
+    {
+        return seekProfile_.PredictMicros(driveno, fromCylinder, toCylinder);
+    }
+
     ResultHeadCylinderSector VerifyDisk(uint8_t driveno)
+    {
+        NullDataSink sink;
+        return VerifyDisk(driveno, sink);
+    }
+
+    //Verify, sink.Idle() is called while the controller verifies the disk
+    template <class SINK>
+    ResultHeadCylinderSector VerifyDisk(uint8_t driveno, SINK &sink)
     {
         DriveParam drive(driveno);
         DriveCmd_VerifyDisk vrfDiskCmd;
-        ResultHeadCylinderSector res = vrfDiskCmd.Execute(interface_, drive);
+        ResultHeadCylinderSector res = vrfDiskCmd.Execute(interface_, drive, sink);
         return res;
     }
 
+    //Read data, the data is discarded
     TransactionStatus ReadData(uint8_t driveno, uint8_t head, uint16_t cylinder, uint8_t sector, uint8_t multiSectorCount, bool withRetry = true)
+    {
+        NullDataSink sink;
+        return ReadData(driveno, head, cylinder, sector, multiSectorCount, sink, withRetry);
+    }
+
+    //Read data, every byte read is passed to sink.Put(). See PriamDataSink.h
+    template <class SINK>
+    TransactionStatus ReadData(uint8_t driveno, uint8_t head, uint16_t cylinder, uint8_t sector, uint8_t multiSectorCount, SINK &sink, bool withRetry = true)
     {
         DiskReadParam readParams(driveno, head, cylinder, sector, multiSectorCount);
+        uint16_t sectorSize = SectorSize(driveno);
 
+        interface_.SetDataBlockSize(sectorSize);
+        sink.BeginTransfer(driveno, head, cylinder, sector, sectorSize);
+
+        TransactionStatus res(0, true);
         if (withRetry)
         {
             DriveCmd_ReadDataWithRetry readRetry;
-            TransactionStatus res = readRetry.Execute(interface_, readParams);
-            return res;
+            res = readRetry.Execute(interface_, readParams, sink);
         }
         else
         {
             DriveCmd_ReadDataNoRetry readNoRetry;
-            TransactionStatus res = readNoRetry.Execute(interface_, readParams);
-            return res;
+            res = readNoRetry.Execute(interface_, readParams, sink);
+        }
+
+        sink.EndTransfer(res);
+
+        return res;
+    }
+
+    //Retry policy used by DumpTracks and RereadBadSectors, also counts which tier read the sectors
+    RetryPolicy &GetRetryPolicy() {return retryPolicy_;}
+    void SetRetryPolicy(const RetryPolicy &policy) {retryPolicy_ = policy;}
+
+    //Read one sector that failed in a whole track read with the recovery tiers of the retry policy
+    //Returns the tier that read the sector or TIER_FAILED, status is the status of the last read or seek
+    //cylinders is the number of cylinders of the drive, for the recalibrating seeks
+    template <class SINK>
+    RetryPolicy::Tier RecoverSector(uint8_t driveno, uint8_t head, uint16_t cylinder, uint8_t sector, uint16_t cylinders, SINK &sink, TransactionStatus &status)
+    {
+        RetryPolicy::Tier tier = RetryPolicy::TIER_FAILED;
+
+        if (retryPolicy_.SectorRetry())
+        {
+            status = ReadData(driveno, head, cylinder, sector, 1, sink, true);
+            if (status.CommsError())
+                return RetryPolicy::TIER_FAILED;
+            if (!status.IsErrorStatus())
+                tier = RetryPolicy::TIER_RETRY;
+        }
+
+        for (uint8_t attempt = 0; tier == RetryPolicy::TIER_FAILED && attempt < retryPolicy_.RecalibrateBudget(); attempt++)
+        {
+            uint16_t recalCylinder = (attempt & 1) ? (uint16_t) (cylinders - 1) : 0;
+
+            status = Seek(driveno, 0, recalCylinder).GetStatus();
+            if (status.CommsError())
+                return RetryPolicy::TIER_FAILED;
+
+            status = ReadData(driveno, head, cylinder, sector, 1, sink, false);
+            if (status.CommsError())
+                return RetryPolicy::TIER_FAILED;
+            if (!status.IsErrorStatus())
+                tier = RetryPolicy::TIER_RECALIBRATE;
+        }
+
+        retryPolicy_.Recovered(driveno, head, cylinder, sector, tier);
+        return tier;
+    }
+
+    //One track of DumpTracks: a whole track read, a sector that fails is read with RecoverSector and the rest
+    //of the track with a new command. Failed sectors are counted in result and added to badSectors if not nullptr
+    //With badSectors and a retry policy that defers recovery, failed sectors are only added to badSectors
+    //Calls trackDone and then sink.Checkpoint() with the next track
+    //Returns false on an interface comms error, result.CommsError() is then set
+    template <class SINK>
+    bool DumpTrack(uint8_t driveno, uint8_t head, uint16_t cyl, uint8_t heads, uint16_t cylinders, uint8_t sectors, SINK &sink,
+                   DumpResult &result, TrackStatusCallback trackDone = nullptr, BadSectorMap *badSectors = nullptr)
+    {
+        uint16_t sectorSize = SectorSize(driveno);
+        TransactionStatus trackStatus(0, false);
+        uint8_t sector = 0;
+        bool trackError = false;
+
+        while (sector < sectors)
+        {
+            CountingDataSink<SINK> counter(sink);
+            TransactionStatus st = ReadData(driveno, head, cyl, sector, sectors - sector, counter, retryPolicy_.FirstPassRetry());
+
+            if (st.CommsError())
+            {
+                if (trackDone)
+                    trackDone(driveno, head, cyl, st);
+                result.commsError_ = true;
+                return false;
+            }
+
+            //The controller stops at the failing sector, all sectors before it were transferred
+            //An error with every sector transferred was found after the transfer of the last one
+            uint8_t readOk = (uint8_t) (counter.Count() / sectorSize);
+            if (st.IsErrorStatus() && readOk >= sectors - sector)
+                readOk = (uint8_t) (sectors - sector - 1);
+            retryPolicy_.Record(RetryPolicy::TIER_FIRSTPASS, st.IsErrorStatus() ? readOk : sectors - sector);
+
+            if (!st.IsErrorStatus())
+                break;
+
+            uint8_t failed = (uint8_t) (sector + readOk);
+            bool defer = badSectors && retryPolicy_.DeferRecovery();
+
+            if (defer || RecoverSector(driveno, head, cyl, failed, cylinders, sink, st) == RetryPolicy::TIER_FAILED)
+            {
+                if (st.CommsError())
+                {
+                    if (trackDone)
+                        trackDone(driveno, head, cyl, st);
+                    result.commsError_ = true;
+                    return false;
+                }
+
+                if (!trackError)
+                    trackStatus = st;
+                trackError = true;
+                result.sectorsBad_++;
+                if (badSectors)
+                    badSectors->Add(head, cyl, failed);
+            }
+            sector = (uint8_t) (failed + 1);
+        }
+
+        if (trackDone)
+            trackDone(driveno, head, cyl, trackStatus);
+
+        result.tracksRead_++;
+        if (trackError)
+            result.tracksFailed_++;
+
+        uint8_t nextHead = (uint8_t) (head + 1);
+        uint16_t nextCyl = cyl;
+        if (nextHead >= heads)
+        {
+            nextHead = 0;
+            nextCyl++;
+        }
+        sink.Checkpoint(driveno, nextHead, nextCyl);
+        return true;
+    }
+
+    //Dump the whole drive, one READ DATA command per track reading all sectors of the track
+    //Cylinders are the outer loop, heads the inner loop
+    //Data goes to sink, BeginTransfer/EndTransfer are called once per transfer and sink.Checkpoint() after each track
+    //trackDone, if not nullptr, is called with the status of every track, an error status if a sector could not be read
+    //When a sector fails the rest of the track is read with a new command starting at the sector after it
+    //Aborts on an interface comms error
+    //With state, the dump starts at the position in state if it holds an unfinished dump of this drive and
+    //the position and bad sectors are recorded in it, so an aborted dump can be resumed later
+    //By default (RetryPolicy::DeferRecovery) failed sectors are then only recorded in state, to be read again
+    //with RereadBadSectors after the dump. Without state, or with recovery not deferred, a failed sector is
+    //read again with RecoverSector before the rest of its track. See PriamRetryPolicy.h
+    template <class SINK>
+    DumpResult DumpTracks(uint8_t driveno, SINK &sink, TrackStatusCallback trackDone = nullptr, DumpState *state = nullptr)
+    {
+        DumpResult result;
+        DriveGeometry geometry = Geometry(driveno);
+
+        if (!geometry.Valid())
+            return result;
+
+        result.paramsOk_ = true;
+
+        uint16_t cylinders = geometry.Cylinders();
+        uint8_t heads = geometry.Heads();
+        uint8_t sectors = geometry.SectorsPerTrack();
+
+        uint16_t startCyl = 0;
+        uint8_t startHead = 0;
+        if (state)
+        {
+            if (!state->InProgress() || state->Drive() != driveno)
+                state->Start(driveno);
+            startCyl = state->Cylinder();
+            startHead = state->Head();
+        }
+
+        for (uint16_t cyl = startCyl; cyl < cylinders; cyl++)
+        {
+            for (uint8_t head = (cyl == startCyl) ? startHead : 0; head < heads; head++)
+            {
+                if (!DumpTrack(driveno, head, cyl, heads, cylinders, sectors, sink, result, trackDone, state ? &state->BadSectors() : nullptr))
+                    return result;
+
+                if (state)
+                {
+                    bool lastHead = head + 1 >= heads;
+                    state->Advance(lastHead ? 0 : (uint8_t) (head + 1), lastHead ? (uint16_t) (cyl + 1) : cyl);
+                }
+            }
+        }
+
+        if (state)
+            state->Finish();
+
+        return result;
+    }
+
+    //Read the sectors in badSectors again one by one with RecoverSector, sectors that read ok are removed from the map
+    //Returns the number of sectors recovered, stops on an interface comms error
+    //The map is not saved, a caller that keeps it in EEPROM calls badSectors.Save()
+    template <class SINK>
+    uint16_t RereadBadSectors(uint8_t driveno, BadSectorMap &badSectors, SINK &sink, TrackStatusCallback trackDone = nullptr)
+    {
+        uint16_t recovered = 0;
+        DriveGeometry geometry = Geometry(driveno);
+
+        if (!geometry.Valid())
+            return 0;
+
+        //Backwards, Remove() moves the last entry into the removed one
+        for (int16_t entry = (int16_t) badSectors.Tracks() - 1; entry >= 0; entry--)
+        {
+            uint8_t head = badSectors.Head((uint8_t) entry);
+            uint16_t cylinder = badSectors.Cylinder((uint8_t) entry);
+            uint32_t mask = badSectors.SectorMask((uint8_t) entry);
+
+            for (uint8_t sector = 0; sector < BadSectorMap::MAXSECTORS; sector++)
+            {
+                if (!(mask & (1UL << sector)))
+                    continue;
+
+                TransactionStatus st(0, false);
+                RetryPolicy::Tier tier = RecoverSector(driveno, head, cylinder, sector, geometry.Cylinders(), sink, st);
+
+                if (trackDone)
+                    trackDone(driveno, head, cylinder, st);
+
+                if (st.CommsError())
+                    return recovered;
+
+                if (tier != RetryPolicy::TIER_FAILED)
+                {
+                    badSectors.Remove(head, cylinder, sector);
+                    recovered++;
+                }
+            }
         }
+
+        return recovered;
     }
 
     private:
+    //Seek without retry, adds the time taken to *total if total is not nullptr
+    bool TimedSeek(uint8_t driveno, uint16_t cylinder, uint32_t *total)
+    {
+        unsigned long start = micros();
+        ResultCylinder res = Seek(driveno, 0, cylinder, false);
+        if (total)
+            *total += (uint32_t) (micros() - start);
+        return !res.GetStatus().CommsError() && !res.GetStatus().IsErrorStatus();
+    }
+
     PriamSmart & interface_;
+    RetryPolicy retryPolicy_;
+    SeekProfile seekProfile_;
+
+    //Cached drive parameters and the interface reset count when they were read
+    DriveGeometry geometry_[MAXDRIVES];
+    uint8_t geometryResets_[MAXDRIVES];
 };
@@ -0,0 +1,212 @@
+#include "PriamDumpState.h"
+#if PRIAMSMART_EEPROM
+#include <EEPROM.h>
+#endif
+
+using namespace Priam;
+
+static const uint8_t DUMPSTATE_MAGIC0 = 'D';
+static const uint8_t DUMPSTATE_MAGIC1 = 'S';
+
+void BadSectorMap::Clear()
+{
+  used_ = 0;
+  overflow_ = false;
+}
+
+int8_t BadSectorMap::Find(uint8_t head, uint16_t cylinder)
+{
+  for (uint8_t i = 0; i < used_; i++)
+  {
+    if (entries_[i].head == head && entries_[i].cylinder == cylinder)
+      return (int8_t) i;
+  }
+  return -1;
+}
+
+bool BadSectorMap::Add(uint8_t head, uint16_t cylinder, uint8_t sector)
+{
+  if (sector >= MAXSECTORS)
+  {
+    overflow_ = true;
+    return false;
+  }
+
+  int8_t entry = Find(head, cylinder);
+  if (entry < 0)
+  {
+    if (used_ >= PRIAMSMART_BADMAP_ENTRIES)
+    {
+      overflow_ = true;
+      return false;
+    }
+    entry = (int8_t) used_++;
+    entries_[entry].head = head;
+    entries_[entry].cylinder = cylinder;
+    entries_[entry].mask = 0;
+  }
+
+  entries_[entry].mask |= (1UL << sector);
+  return true;
+}
+
+void BadSectorMap::Remove(uint8_t head, uint16_t cylinder, uint8_t sector)
+{
+  int8_t entry = Find(head, cylinder);
+  if (entry < 0 || sector >= MAXSECTORS)
+    return;
+
+  entries_[entry].mask &= ~(1UL << sector);
+
+  //Empty track entry, move the last one in its place
+  if (!entries_[entry].mask)
+    entries_[entry] = entries_[--used_];
+}
+
+bool BadSectorMap::Contains(uint8_t head, uint16_t cylinder, uint8_t sector)
+{
+  int8_t entry = Find(head, cylinder);
+  return entry >= 0 && sector < MAXSECTORS && (entries_[entry].mask & (1UL << sector));
+}
+
+uint16_t BadSectorMap::Sectors()
+{
+  uint16_t count = 0;
+  for (uint8_t i = 0; i < used_; i++)
+  {
+    for (uint32_t mask = entries_[i].mask; mask; mask &= mask - 1)
+      count++;
+  }
+  return count;
+}
+
+#if PRIAMSMART_EEPROM
+
+//EEPROM layout: used count, overflow flag, then per entry head, cylinder MSB, LSB and 4 mask bytes LSB first
+static const uint8_t BADMAP_ENTRYSIZE = 7;
+
+void BadSectorMap::SaveEntry(uint8_t entry)
+{
+  int addr = EEPROM_BADMAP + 2 + entry * BADMAP_ENTRYSIZE;
+  Entry &e = entries_[entry];
+
+  EEPROM.update(addr, e.head);
+  EEPROM.update(addr + 1, (uint8_t) (e.cylinder >> 8));
+  EEPROM.update(addr + 2, (uint8_t) (e.cylinder & 0xFF));
+  for (uint8_t i = 0; i < 4; i++)
+    EEPROM.update(addr + 3 + i, (uint8_t) (e.mask >> (8 * i)));
+}
+
+void BadSectorMap::Save()
+{
+  EEPROM.update(EEPROM_BADMAP, used_);
+  EEPROM.update(EEPROM_BADMAP + 1, overflow_ ? 1 : 0);
+  for (uint8_t i = 0; i < used_; i++)
+    SaveEntry(i);
+}
+
+bool BadSectorMap::Load()
+{
+  uint8_t used = EEPROM.read(EEPROM_BADMAP);
+
+  Clear();
+  if (used > PRIAMSMART_BADMAP_ENTRIES)
+    return false;
+
+  for (uint8_t i = 0; i < used; i++)
+  {
+    int addr = EEPROM_BADMAP + 2 + i * BADMAP_ENTRYSIZE;
+    Entry &e = entries_[i];
+
+    e.head = EEPROM.read(addr);
+    e.cylinder = (uint16_t) ((EEPROM.read(addr + 1) << 8) | EEPROM.read(addr + 2));
+    e.mask = 0;
+    for (uint8_t b = 0; b < 4; b++)
+      e.mask |= (uint32_t) EEPROM.read(addr + 3 + b) << (8 * b);
+  }
+
+  used_ = used;
+  overflow_ = EEPROM.read(EEPROM_BADMAP + 1) == 1;
+  return true;
+}
+
+//EEPROM layout: magic0, magic1, drive, cylinder MSB, LSB, head, in progress, check byte
+void DumpState::Save()
+{
+  uint8_t check = (uint8_t) (drive_ ^ (cylinder_ >> 8) ^ (cylinder_ & 0xFF) ^ head_ ^ (inProgress_ ? 1 : 0) ^ 0x5A);
+
+  EEPROM.update(EEPROM_DUMPSTATE, DUMPSTATE_MAGIC0);
+  EEPROM.update(EEPROM_DUMPSTATE + 1, DUMPSTATE_MAGIC1);
+  EEPROM.update(EEPROM_DUMPSTATE + 2, drive_);
+  EEPROM.update(EEPROM_DUMPSTATE + 3, (uint8_t) (cylinder_ >> 8));
+  EEPROM.update(EEPROM_DUMPSTATE + 4, (uint8_t) (cylinder_ & 0xFF));
+  EEPROM.update(EEPROM_DUMPSTATE + 5, head_);
+  EEPROM.update(EEPROM_DUMPSTATE + 6, inProgress_ ? 1 : 0);
+  EEPROM.update(EEPROM_DUMPSTATE + 7, check);
+}
+
+bool DumpState::Load()
+{
+  uint8_t drive = EEPROM.read(EEPROM_DUMPSTATE + 2);
+  uint16_t cylinder = (uint16_t) ((EEPROM.read(EEPROM_DUMPSTATE + 3) << 8) | EEPROM.read(EEPROM_DUMPSTATE + 4));
+  uint8_t head = EEPROM.read(EEPROM_DUMPSTATE + 5);
+  uint8_t inProgress = EEPROM.read(EEPROM_DUMPSTATE + 6);
+  uint8_t check = (uint8_t) (drive ^ (cylinder >> 8) ^ (cylinder & 0xFF) ^ head ^ inProgress ^ 0x5A);
+
+  if (EEPROM.read(EEPROM_DUMPSTATE) != DUMPSTATE_MAGIC0 || EEPROM.read(EEPROM_DUMPSTATE + 1) != DUMPSTATE_MAGIC1 ||
+      EEPROM.read(EEPROM_DUMPSTATE + 7) != check || inProgress > 1)
+    return false;
+
+  drive_ = drive;
+  cylinder_ = cylinder;
+  head_ = head;
+  inProgress_ = inProgress == 1;
+  badSectors_.Load();
+  return inProgress_;
+}
+
+#else
+
+void BadSectorMap::SaveEntry(uint8_t entry) {(void) entry;}
+void BadSectorMap::Save() {}
+bool BadSectorMap::Load() {Clear(); return false;}
+void DumpState::Save() {}
+bool DumpState::Load() {return false;}
+
+#endif
+
+void DumpState::Start(uint8_t driveno)
+{
+  drive_ = driveno;
+  head_ = 0;
+  cylinder_ = 0;
+  inProgress_ = true;
+  badSectors_.Clear();
+  badSectors_.Save();
+  Save();
+}
+
+void DumpState::Advance(uint8_t head, uint16_t cylinder)
+{
+  bool newCylinder = cylinder != cylinder_;
+
+  head_ = head;
+  cylinder_ = cylinder;
+
+  //EEPROM only on cylinder change, with head 0 of the next cylinder
+  if (newCylinder)
+  {
+    uint8_t savedHead = head_;
+    head_ = 0;
+    Save();
+    badSectors_.Save();
+    head_ = savedHead;
+  }
+}
+
+void DumpState::Finish()
+{
+  inProgress_ = false;
+  Save();
+  badSectors_.Save();
+}
@@ -0,0 +1,101 @@
+#pragma once
+#include "arduino.h"
+#include "PriamEepromLayout.h"
+
+//Number of tracks with bad sectors the bad sector map can hold, 7 bytes of RAM and EEPROM each
+#ifndef PRIAMSMART_BADMAP_ENTRIES
+#define PRIAMSMART_BADMAP_ENTRIES 32
+#endif
+
+namespace Priam
+{
+
+//Sectors that returned an error status, as one sector bitmap per track
+//Sectors 32 and up of a track can not be recorded
+class BadSectorMap
+{
+  public:
+  static const uint8_t MAXSECTORS = 32;
+
+  BadSectorMap() {Clear();}
+
+  void Clear();
+
+  //Returns false if the map is full or the sector number too large, Overflowed() is then set
+  bool Add(uint8_t head, uint16_t cylinder, uint8_t sector);
+
+  //Sector read ok after all, removes the track entry when its last sector is removed
+  void Remove(uint8_t head, uint16_t cylinder, uint8_t sector);
+
+  bool Contains(uint8_t head, uint16_t cylinder, uint8_t sector);
+
+  //Track entries
+  uint8_t Tracks() {return used_;}
+  uint8_t Head(uint8_t entry) {return entries_[entry].head;}
+  uint16_t Cylinder(uint8_t entry) {return entries_[entry].cylinder;}
+  uint32_t SectorMask(uint8_t entry) {return entries_[entry].mask;}
+
+  //Total number of bad sectors in the map
+  uint16_t Sectors();
+
+  //Some bad sectors were not recorded
+  bool Overflowed() {return overflow_;}
+
+  //Persist in EEPROM
+  bool Load();
+  void Save();
+
+  private:
+  class Entry
+  {
+    public:
+    uint16_t cylinder;
+    uint8_t head;
+    uint32_t mask;
+  };
+
+  int8_t Find(uint8_t head, uint16_t cylinder);
+  void SaveEntry(uint8_t entry);
+
+  Entry entries_[PRIAMSMART_BADMAP_ENTRIES];
+  uint8_t used_;
+  bool overflow_;
+};
+
+//Progress of a full drive dump: the next track to read and the bad sectors found so far
+//The position is saved to EEPROM once per cylinder (EEPROM wear), so a resume repeats at most one cylinder
+class DumpState
+{
+  public:
+  DumpState() : drive_(0), head_(0), cylinder_(0), inProgress_(false) {}
+
+  //New dump from cylinder 0 head 0, clears the bad sector map
+  void Start(uint8_t driveno);
+
+  //Track done, head/cylinder is the next track to read
+  void Advance(uint8_t head, uint16_t cylinder);
+
+  //Dump finished, nothing left to resume
+  void Finish();
+
+  bool InProgress() {return inProgress_;}
+  uint8_t Drive() {return drive_;}
+  uint8_t Head() {return head_;}
+  uint16_t Cylinder() {return cylinder_;}
+
+  BadSectorMap &BadSectors() {return badSectors_;}
+
+  //Load position and bad sector map from EEPROM, false if there is no saved dump
+  bool Load();
+
+  private:
+  void Save();
+
+  uint8_t drive_;
+  uint8_t head_;
+  uint16_t cylinder_;
+  bool inProgress_;
+  BadSectorMap badSectors_;
+};
+
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+//EEPROM usage of the priamsmart library
+//Define PRIAMSMART_EEPROM 0 on boards without EEPROM.h, settings are then not persisted
+#ifndef PRIAMSMART_EEPROM
+#if defined(__AVR__) || defined(PRIAMSMART_SIMULATOR)
+#define PRIAMSMART_EEPROM 1
+#else
+#define PRIAMSMART_EEPROM 0
+#endif
+#endif
+
+namespace Priam
+{
+
+enum EepromAddress {
+  //Calibrated bus timing: magic0, magic1, setup delay, pulse delay, check byte
+  EEPROM_BUSTIMING = 0,
+  EEPROM_BUSTIMING_SIZE = 5,
+
+  //Dump position: magic0, magic1, drive, cylinder MSB, LSB, head, in progress, check byte
+  EEPROM_DUMPSTATE = 8,
+  EEPROM_DUMPSTATE_SIZE = 8,
+
+  //Bad sector map: count, overflow, then 7 bytes per track entry (PRIAMSMART_BADMAP_ENTRIES)
+  EEPROM_BADMAP = 16
+  };
+
+}
@@ -26,6 +26,26 @@ class CommandDefinition
     return RESULTS::ParseStatus(resRegs) ;  
   }
 
+  //Same as above, data phase bytes are passed to/taken from sink
+  template <class SINK>
+  RESULTS Execute(PriamSmart &interface, PARAMS &parameter, SINK &sink)
+  {
+    RegisterValues<RESULTS::NUMREGS> resRegs = 
+    interface.TransactNew(cmdInfo_, PARAMS::MakeRegs(parameter), sink);
+    return RESULTS::ParseStatus(resRegs) ;  
+  }
+
+  //Non-blocking execution, see Transaction in PriamSmartInterface.h
+  //Construct an AsyncTransaction with GetCommandInfo() and PARAMS::MakeRegs(), poll it, then get the results with Finish()
+  template <class SINK>
+  using AsyncTransaction = Transaction<PARAMS::NUMREGS, RESULTS::NUMREGS, SINK>;
+
+  template <class SINK>
+  static RESULTS Finish(AsyncTransaction<SINK> &transaction)
+  {
+    return RESULTS::ParseStatus(transaction.Finish());
+  }
+
   private:
   CommandInfo<PARAMS::NUMREGS, RESULTS::NUMREGS> cmdInfo_;
   
@@ -33,12 +53,15 @@ class CommandDefinition
 
 //The following typedefs define class types for each of the actual command: byte value, parameter type and result type
 typedef CommandDefinition<PriamCommandsByteValues::SEQUENCEUPANDWAIT, DriveParam, TransactionStatus> DriveCmd_SpinupAndWait; 
+typedef CommandDefinition<PriamCommandsByteValues::SEQUENCEUPANDRETURN, DriveParam, TransactionStatus> DriveCmd_SpinupAndReturn;
 typedef CommandDefinition<PriamCommandsByteValues::SEQUENCEDOWN, DriveParam, TransactionStatus> DriveCmd_SpinDown; 
 
 typedef CommandDefinition<PriamCommandsByteValues::READDRIVEPARAM, DriveParam, ResultDriveParams> DriveCmd_ReadParams; 
 
 typedef CommandDefinition<PriamCommandsByteValues::SEEKWITHRETRY, SeekParam, ResultCylinder> DriveCmd_SeekWithRetry; 
 
+typedef CommandDefinition<PriamCommandsByteValues::SEEKNORETRY, SeekParam, ResultCylinder> DriveCmd_SeekNoRetry; 
+
 typedef CommandDefinition<PriamCommandsByteValues::VERIFYDISK, DriveParam, ResultHeadCylinderSector> DriveCmd_VerifyDisk; 
 
 typedef CommandDefinition<PriamCommandsByteValues::READDATAWITHRETRY, DiskReadParam, TransactionStatus> DriveCmd_ReadDataWithRetry; 
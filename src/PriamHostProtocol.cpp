@@ -0,0 +1,246 @@
+#include "PriamHostProtocol.h"
+#include "PriamDrive.h"
+
+using namespace Priam;
+
+HostProtocol::HostProtocol(PriamDrive &drive, Stream &in, SectorStream &stream) :
+drive_(drive), in_(in), stream_(stream), state_(PARSE_SYNC0), escape_(false), rxLen_(0), rx_{0},
+exit_(false), lastRequest_(0), queueHead_(0), queueCount_(0)
+{
+}
+
+void HostProtocol::PollInput()
+{
+  //A full queue leaves the input in the receive buffers
+  while (queueCount_ < PRIAMSMART_HOSTQUEUE && in_.available())
+    ParseByte((uint8_t) in_.read());
+}
+
+void HostProtocol::ParseByte(uint8_t val)
+{
+  //Sync always starts a new frame, it is escaped inside one
+  if (val == SYNC0)
+  {
+    state_ = PARSE_SYNC1;
+    return;
+  }
+
+  switch (state_)
+  {
+    case PARSE_SYNC0:
+      return;
+
+    case PARSE_SYNC1:
+      if (val == SYNC1)
+      {
+        state_ = PARSE_BODY;
+        escape_ = false;
+        rxLen_ = 0;
+      }
+      else
+        state_ = PARSE_SYNC0;
+      return;
+
+    case PARSE_BODY:
+      if (val == ESC)
+      {
+        escape_ = true;
+        return;
+      }
+      if (escape_)
+      {
+        val ^= ESCXOR;
+        escape_ = false;
+      }
+      rx_[rxLen_++] = val;
+      if (rxLen_ >= REQUESTSIZE)
+      {
+        RequestDone();
+        state_ = PARSE_SYNC0;
+      }
+      return;
+  }
+}
+
+void HostProtocol::RequestDone()
+{
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < REQUESTSIZE - 2; i++)
+    crc = Crc16Update(crc, rx_[i]);
+  if (crc != (uint16_t) ((rx_[REQUESTSIZE - 2] << 8) | rx_[REQUESTSIZE - 1]))
+    return;
+
+  HostRequest &request = queue_[(queueHead_ + queueCount_) % PRIAMSMART_HOSTQUEUE];
+  request.seq = rx_[0];
+  request.op = rx_[1];
+  request.drive = rx_[2];
+  request.head = rx_[3];
+  request.cylinder = (uint16_t) ((rx_[4] << 8) | rx_[5]);
+  request.sector = rx_[6];
+  request.count = (uint16_t) ((rx_[7] << 8) | rx_[8]);
+  request.flags = rx_[9];
+  queueCount_++;
+}
+
+void HostProtocol::Run(bool syncSeen)
+{
+  SectorStream::OutputMode oldMode = stream_.GetMode();
+  stream_.SetMode(SectorStream::BINARY);
+
+  state_ = syncSeen ? PARSE_SYNC1 : PARSE_SYNC0;
+  queueHead_ = 0;
+  queueCount_ = 0;
+  exit_ = false;
+  lastRequest_ = millis();
+
+  while (!exit_)
+  {
+    PollInput();
+
+    if (queueCount_)
+    {
+      HostRequest request = queue_[queueHead_];
+      queueHead_ = (uint8_t) ((queueHead_ + 1) % PRIAMSMART_HOSTQUEUE);
+      queueCount_--;
+
+      Execute(request);
+      lastRequest_ = millis();
+      continue;
+    }
+
+    stream_.Idle();
+    if (millis() - lastRequest_ > IDLETIMEOUT_MS)
+      break;
+  }
+
+  stream_.SetMode(oldMode);
+}
+
+void HostProtocol::Respond(const HostRequest &request, TransactionStatus status, uint8_t flags, const uint8_t *data, uint8_t len)
+{
+  if (status.CommsError())
+    flags |= RESPONSEFLAG_COMMSERROR;
+  else if (status.IsErrorStatus())
+    flags |= RESPONSEFLAG_ERROR;
+
+  stream_.Response(request.drive, request.head, request.cylinder, request.seq, request.op, status.GetRawStatusVal(), flags, data, len);
+}
+
+void HostProtocol::Execute(const HostRequest &request)
+{
+  TransactionStatus none(0, false);
+  ProtocolSink sink(*this);
+
+  if (request.op != OP_HELLO && request.op != OP_EXIT && request.drive >= PriamDrive::MAXDRIVES)
+  {
+    Respond(request, none, RESPONSEFLAG_REJECTED);
+    return;
+  }
+
+  switch (request.op)
+  {
+    case OP_HELLO:
+    {
+      uint8_t data[3] = {VERSION, PRIAMSMART_HOSTQUEUE, PriamDrive::MAXDRIVES};
+      Respond(request, none, 0, data, sizeof(data));
+      break;
+    }
+
+    case OP_PARAMS:
+    {
+      ResultDriveParams res = drive_.ReadParams(request.drive);
+      uint8_t data[6] = {res.Heads(), (uint8_t) (res.Cylinders() >> 8), (uint8_t) (res.Cylinders() & 0xFF),
+                         res.SectorsPerTrack(), (uint8_t) (res.LogicalSectorSize() >> 8), (uint8_t) (res.LogicalSectorSize() & 0xFF)};
+      Respond(request, res.GetStatus(), 0, data, sizeof(data));
+      break;
+    }
+
+    case OP_SPINUP:
+      Respond(request, drive_.SpinupWait(request.drive, sink), 0);
+      break;
+
+    case OP_SPINDOWN:
+      Respond(request, drive_.SpinDown(request.drive), 0);
+      break;
+
+    case OP_SEEK:
+    {
+      ResultCylinder res = drive_.Seek(request.drive, request.head, request.cylinder, !(request.flags & FLAG_NORETRY));
+      uint8_t data[2] = {(uint8_t) (res.Cylinder() >> 8), (uint8_t) (res.Cylinder() & 0xFF)};
+      Respond(request, res.GetStatus(), 0, data, sizeof(data));
+      break;
+    }
+
+    case OP_VERIFY:
+    {
+      ResultHeadCylinderSector res = drive_.VerifyDisk(request.drive, sink);
+      uint8_t data[4] = {res.Head(), (uint8_t) (res.Cylinder() >> 8), (uint8_t) (res.Cylinder() & 0xFF), res.Sector()};
+      Respond(request, res.GetStatus(), 0, data, sizeof(data));
+      break;
+    }
+
+    case OP_READ:
+      Read(request);
+      break;
+
+    case OP_EXIT:
+      Respond(request, none, 0);
+      exit_ = true;
+      break;
+
+    default:
+      Respond(request, none, RESPONSEFLAG_REJECTED);
+      break;
+  }
+}
+
+void HostProtocol::Read(const HostRequest &request)
+{
+  //Cached, a dump sends one READ per track
+  DriveGeometry params = drive_.Geometry(request.drive);
+  TransactionStatus status = params.GetStatus();
+
+  uint8_t head = request.head;
+  uint16_t cylinder = request.cylinder;
+  uint8_t sector = request.sector;
+  uint16_t left = request.count;
+  uint16_t done = 0;
+  uint8_t flags = 0;
+
+  if (status.CommsError() || status.IsErrorStatus())
+    left = 0;
+  else if (head >= params.Heads() || cylinder >= params.Cylinders() || sector >= params.SectorsPerTrack())
+  {
+    flags = RESPONSEFLAG_REJECTED;
+    left = 0;
+  }
+
+  stream_.SetMode((request.flags & FLAG_COMPRESS) ? SectorStream::COMPRESSED : SectorStream::BINARY);
+
+  ProtocolSink sink(*this);
+  while (left && cylinder < params.Cylinders())
+  {
+    //Up to the end of the track in one command
+    uint8_t count = (uint8_t) (params.SectorsPerTrack() - sector);
+    if (count > left)
+      count = (uint8_t) left;
+
+    status = drive_.ReadData(request.drive, head, cylinder, sector, count, sink, !(request.flags & FLAG_NORETRY));
+    if (status.CommsError() || status.IsErrorStatus())
+      break;
+
+    done = (uint16_t) (done + count);
+    left = (uint16_t) (left - count);
+    sector = 0;
+    if (++head >= params.Heads())
+    {
+      head = 0;
+      cylinder++;
+    }
+  }
+
+  stream_.SetMode(SectorStream::BINARY);
+
+  uint8_t data[6] = {(uint8_t) (done >> 8), (uint8_t) (done & 0xFF), head, (uint8_t) (cylinder >> 8), (uint8_t) (cylinder & 0xFF), sector};
+  Respond(request, status, flags, data, sizeof(data));
+}
@@ -0,0 +1,192 @@
+#pragma once
+#include "arduino.h"
+#include "PriamSectorStream.h"
+#include "PriamSerialTransport.h"
+
+class PriamDrive;
+
+//Requests the host can queue while earlier ones are still running
+//Every queued request takes 10 bytes of RAM
+#ifndef PRIAMSMART_HOSTQUEUE
+#if defined(RAMEND) && RAMEND < 0x900
+#define PRIAMSMART_HOSTQUEUE 4
+#else
+#define PRIAMSMART_HOSTQUEUE 16
+#endif
+#endif
+
+namespace Priam
+{
+
+//One request of the host command protocol
+class HostRequest
+{
+  public:
+  uint8_t seq;
+  uint8_t op;
+  uint8_t drive;
+  uint8_t head;
+  uint16_t cylinder;
+  uint8_t sector;
+  uint16_t count;
+  uint8_t flags;
+};
+
+//Binary command protocol for a host program, instead of the menu
+//The host sends a batch of requests, each tagged with a sequence number. They are queued and run
+//back to back, the answer to every request is a RESPONSE frame on the SectorStream with its sequence number.
+//Sector data of READ requests is sent as DATA/PACKED and STATUS frames before the response
+//
+//Request frame (host to device), all requests have the same size:
+//  SYNC0 SYNC1 <escaped: seq op drive head cylMSB cylLSB sector countMSB countLSB flags crcMSB crcLSB>
+//  The CRC is the SectorStream CRC-16/CCITT over seq..flags
+//  After the sync bytes XON, XOFF, SYNC0 and ESC are sent as ESC followed by the byte XOR ESCXOR,
+//  so the data never looks like flow control and a new sync always starts a new frame
+//
+//Operations:
+//  OP_HELLO      response data: version, queue size, MAXDRIVES
+//  OP_PARAMS     read drive parameters, response data: heads, cylMSB, cylLSB, sectors per track, sizeMSB, sizeLSB
+//  OP_SPINUP     spin up the drive and wait until it is ready
+//  OP_SPINDOWN   spin down the drive
+//  OP_SEEK       seek to head/cylinder, FLAG_NORETRY for a seek without retries. Response data: cylMSB cylLSB
+//  OP_VERIFY     verify the disk, response data: head cylMSB cylLSB sector from the controller result
+//  OP_READ       read count sectors from head/cylinder/sector on, continuing on the next head and cylinder.
+//                Reads up to the end of each track with one command. FLAG_NORETRY reads without retries,
+//                FLAG_COMPRESS sends PACKED frames. Stops at the first failed command.
+//                Response data: sectors read MSB LSB, then head cylMSB cylLSB sector where the read stopped
+//  OP_EXIT       leave protocol mode, back to the menu
+//
+//Response status is the raw completion status of the last controller command (0 if none) with flags:
+//  RESPONSEFLAG_COMMSERROR   the interface did not answer
+//  RESPONSEFLAG_REJECTED     bad request: unknown op or drive out of range, nothing was done
+//  RESPONSEFLAG_ERROR        the controller reported an error
+//Requests with a bad CRC are dropped without a response, the host resends after a timeout
+//The host must not have more than the queue size of requests outstanding (see OP_HELLO). Input is
+//not read while the queue is full, further requests wait in the receive buffers and can be lost
+class HostProtocol
+{
+  public:
+  static const uint8_t VERSION = 2;
+
+  static const uint8_t SYNC0 = SectorStream::SYNC0;
+  static const uint8_t SYNC1 = 0xC3;
+  static const uint8_t ESC = 0x7D;
+  static const uint8_t ESCXOR = 0x20;
+
+  //Unescaped request bytes, seq to CRC
+  static const uint8_t REQUESTSIZE = 12;
+
+  //Longest encoded request frame
+  static const uint8_t MAXFRAMESIZE = 2 + 2 * REQUESTSIZE;
+
+  //Menu returns after this long without a request
+  static const unsigned long IDLETIMEOUT_MS = 10000;
+
+  enum Operation {
+    OP_HELLO = 0x01,
+    OP_PARAMS = 0x02,
+    OP_SPINUP = 0x03,
+    OP_SPINDOWN = 0x04,
+    OP_SEEK = 0x05,
+    OP_VERIFY = 0x06,
+    OP_READ = 0x07,
+    OP_EXIT = 0x7F
+    };
+
+  enum RequestFlags {
+    FLAG_NORETRY = bit(0),
+    FLAG_COMPRESS = bit(1)
+    };
+
+  enum ResponseFlags {
+    RESPONSEFLAG_COMMSERROR = bit(0),
+    RESPONSEFLAG_REJECTED = bit(1),
+    RESPONSEFLAG_ERROR = bit(2)
+    };
+
+  HostProtocol(PriamDrive &drive, Stream &in, SectorStream &stream);
+
+  //Run requests until OP_EXIT or IDLETIMEOUT_MS without requests
+  //syncSeen: SYNC0 was already read by the caller
+  void Run(bool syncSeen = false);
+
+  //Read requests into the queue, called while the controller is busy
+  void PollInput();
+
+  //Encode a request frame into out (MAXFRAMESIZE bytes), returns the length. For host programs
+  static uint8_t EncodeRequest(const HostRequest &request, uint8_t *out)
+  {
+    uint8_t body[REQUESTSIZE] = {request.seq, request.op, request.drive, request.head,
+                                 (uint8_t) (request.cylinder >> 8), (uint8_t) (request.cylinder & 0xFF), request.sector,
+                                 (uint8_t) (request.count >> 8), (uint8_t) (request.count & 0xFF), request.flags, 0, 0};
+
+    uint16_t crc = 0xFFFF;
+    for (uint8_t i = 0; i < REQUESTSIZE - 2; i++)
+      crc = Crc16Update(crc, body[i]);
+    body[REQUESTSIZE - 2] = (uint8_t) (crc >> 8);
+    body[REQUESTSIZE - 1] = (uint8_t) (crc & 0xFF);
+
+    uint8_t len = 0;
+    out[len++] = SYNC0;
+    out[len++] = SYNC1;
+    for (uint8_t i = 0; i < REQUESTSIZE; i++)
+    {
+      uint8_t val = body[i];
+      if (val == SerialTransport::XON || val == SerialTransport::XOFF || val == SYNC0 || val == ESC)
+      {
+        out[len++] = ESC;
+        val ^= ESCXOR;
+      }
+      out[len++] = val;
+    }
+    return len;
+  }
+
+  private:
+  enum ParseState {PARSE_SYNC0, PARSE_SYNC1, PARSE_BODY};
+
+  //Data sink for the commands run: forwards to the SectorStream, reads requests while the controller is busy
+  class ProtocolSink : public DataSinkBase
+  {
+    public:
+    ProtocolSink(HostProtocol &protocol) : protocol_(protocol) {}
+    void BeginTransfer(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, uint16_t sectorSize)
+    {
+      protocol_.stream_.BeginTransfer(drive, head, cylinder, sector, sectorSize);
+    }
+    void Put(uint8_t val) {protocol_.stream_.Put(val);}
+    void EndTransfer(TransactionStatus status) {protocol_.stream_.EndTransfer(status);}
+    void Idle()
+    {
+      protocol_.stream_.Idle();
+      protocol_.PollInput();
+    }
+
+    private:
+    HostProtocol &protocol_;
+  };
+
+  void ParseByte(uint8_t val);
+  void RequestDone();
+  void Execute(const HostRequest &request);
+  void Read(const HostRequest &request);
+  void Respond(const HostRequest &request, TransactionStatus status, uint8_t flags, const uint8_t *data = nullptr, uint8_t len = 0);
+
+  PriamDrive &drive_;
+  Stream &in_;
+  SectorStream &stream_;
+
+  ParseState state_;
+  bool escape_;
+  uint8_t rxLen_;
+  uint8_t rx_[REQUESTSIZE];
+
+  bool exit_;
+  unsigned long lastRequest_;
+
+  HostRequest queue_[PRIAMSMART_HOSTQUEUE];
+  uint8_t queueHead_;
+  uint8_t queueCount_;
+};
+
+}
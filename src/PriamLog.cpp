@@ -0,0 +1,38 @@
+#include "PriamLog.h"
+
+using namespace Priam;
+
+Log::EventHandler Log::handler_ = nullptr;
+Print *Log::out_ = &Serial;
+#if PRIAMSMART_LOGMASK
+uint8_t Log::mask_ = 0xFF;
+#endif
+
+void Log::Write(uint8_t level, uint8_t event, const __FlashStringHelper *text)
+{
+  Write(level, event, text, 0, false);
+}
+
+void Log::Write(uint8_t level, uint8_t event, const __FlashStringHelper *text, uint8_t value)
+{
+  Write(level, event, text, value, true);
+}
+
+void Log::Write(uint8_t level, uint8_t event, const __FlashStringHelper *text, uint8_t value, bool hasValue)
+{
+#if PRIAMSMART_LOGMASK
+  if (!(mask_ & bit(level)))
+    return;
+#endif
+
+  if (handler_ && handler_(level, event, value))
+    return;
+
+  out_->print(text);
+  if (hasValue)
+  {
+    out_->print(F(" 0x"));
+    out_->print(value, HEX);
+  }
+  out_->println();
+}
@@ -0,0 +1,111 @@
+#pragma once
+#include "arduino.h"
+
+//Diagnostic messages of the library
+//PRIAMSMART_LOGLEVEL selects at compile time which messages are built in, the others compile to nothing
+//(no code, no flash for the text, no UART wait in the poll loops):
+//  0 none, 1 errors, 2 + warnings (default), 3 + interface startup progress, 4 + command retry polls
+#ifndef PRIAMSMART_LOGLEVEL
+#define PRIAMSMART_LOGLEVEL 2
+#endif
+
+//Define PRIAMSMART_LOGMASK 1 to also filter the built in levels at runtime with Log::SetMask()
+#ifndef PRIAMSMART_LOGMASK
+#define PRIAMSMART_LOGMASK 0
+#endif
+
+#define PRIAM_LOGLEVEL_ERROR 1
+#define PRIAM_LOGLEVEL_WARN 2
+#define PRIAM_LOGLEVEL_INFO 3
+#define PRIAM_LOGLEVEL_DEBUG 4
+
+//PRIAM_LOGERROR(EVT_x, F("text")) or PRIAM_LOGERROR(EVT_x, F("text"), value), the same for WARN, INFO and DEBUG
+//The value is printed in hex after the text. Arguments of a disabled level are not evaluated
+#if PRIAMSMART_LOGLEVEL >= PRIAM_LOGLEVEL_ERROR
+#define PRIAM_LOGERROR(event, ...) Priam::Log::Write(PRIAM_LOGLEVEL_ERROR, Priam::Log::event, __VA_ARGS__)
+#else
+#define PRIAM_LOGERROR(event, ...) ((void) 0)
+#endif
+
+#if PRIAMSMART_LOGLEVEL >= PRIAM_LOGLEVEL_WARN
+#define PRIAM_LOGWARN(event, ...) Priam::Log::Write(PRIAM_LOGLEVEL_WARN, Priam::Log::event, __VA_ARGS__)
+#else
+#define PRIAM_LOGWARN(event, ...) ((void) 0)
+#endif
+
+#if PRIAMSMART_LOGLEVEL >= PRIAM_LOGLEVEL_INFO
+#define PRIAM_LOGINFO(event, ...) Priam::Log::Write(PRIAM_LOGLEVEL_INFO, Priam::Log::event, __VA_ARGS__)
+#else
+#define PRIAM_LOGINFO(event, ...) ((void) 0)
+#endif
+
+#if PRIAMSMART_LOGLEVEL >= PRIAM_LOGLEVEL_DEBUG
+#define PRIAM_LOGDEBUG(event, ...) Priam::Log::Write(PRIAM_LOGLEVEL_DEBUG, Priam::Log::event, __VA_ARGS__)
+#else
+#define PRIAM_LOGDEBUG(event, ...) ((void) 0)
+#endif
+
+namespace Priam
+{
+
+//Messages go to Serial (or the Print set with SetOutput) as text, or to an event handler that takes them as
+//compact codes, e.g. to put them in the binary frame stream (SectorStream::Event) where text would get in the
+//way of the host
+class Log
+{
+  public:
+  //Event codes, sent in EVENT frames. Keep the values, the host decodes them
+  enum Event {
+    EVT_RESETHOLD = 1,          //AssertReset while already held in reset
+    EVT_RESETSTATE = 2,         //ReleaseFromReset while not held in reset
+    EVT_DRIVEREADYRESET = 3,    //WaitForDriveReady gave up, interface reset
+    EVT_WAITBUSREADY = 4,       //value: DBUSENA line
+    EVT_BUSREADY = 5,
+    EVT_WAITINITIALCOMPREQ = 6,
+    EVT_NOINITIALCOMPREQ = 7,   //value: interface status
+    EVT_INITIALCOMPREQ = 8,     //value: interface status, acknowledged
+    EVT_INITDONE = 9,
+    EVT_NOTREADY = 10,          //transaction started while the interface is not ready
+    EVT_NOTREADYFORCOMMAND = 11,//value: interface status, polled again
+    EVT_COMPREQACK = 12,        //stale completion request acknowledged before a command
+    EVT_REJECTED = 13,          //the interface rejected the command
+    EVT_STATUSREADFAIL = 14,    //interface status register read failed
+    EVT_DTREQFAILED = 15,       //value: interface status, DTREQ did not follow it, handshake turned off
+    EVT_BUSVALUE = 16,          //bus value too large for the bus width
+    EVT_DTREQVALID = 17,        //DTREQ followed the status register for a sector, handshake in use
+    EVT_TIMINGSTUCK = 18,       //interface stuck after a failed bus timing test, reset
+    EVT_CALNOTREADY = 19,       //bus timing calibration with the interface not ready
+    EVT_CALNODRIVE = 20,        //value: drive, not usable for calibration at default timing
+    EVT_CALSETUP = 21,          //value: shortest working setup delay
+    EVT_CALPULSE = 22,          //value: shortest working pulse delay
+    EVT_CALMARGINFAILED = 23    //calibrated timing with margin failed, default timing kept
+    };
+
+  //Returns true if it took the message, false to print it as text
+  typedef bool (*EventHandler)(uint8_t level, uint8_t event, uint8_t value);
+
+  static void SetEventHandler(EventHandler handler) {handler_ = handler;}
+
+  //Where text messages go, Serial at start
+  static void SetOutput(Print &out) {out_ = &out;}
+
+#if PRIAMSMART_LOGMASK
+  //Bit n enables level n, all built in levels are enabled at start
+  static void SetMask(uint8_t mask) {mask_ = mask;}
+  static uint8_t GetMask() {return mask_;}
+#endif
+
+  static void Write(uint8_t level, uint8_t event, const __FlashStringHelper *text);
+  static void Write(uint8_t level, uint8_t event, const __FlashStringHelper *text, uint8_t value);
+
+  private:
+  static void Write(uint8_t level, uint8_t event, const __FlashStringHelper *text, uint8_t value, bool hasValue);
+
+  static EventHandler handler_;
+  static Print *out_;
+#if PRIAMSMART_LOGMASK
+  static uint8_t mask_;
+#endif
+};
+
+}
@@ -0,0 +1,155 @@
+#pragma once
+#include "arduino.h"
+#include "PriamDrive.h"
+
+namespace Priam
+{
+
+//Dumps several drives on one Smart Interface together, one track from each drive in turn
+//The interface runs one command at a time, so the transfers themselves do not overlap. What overlaps is the
+//spin up: a drive that is not ready is started with PriamDrive::SpinupBegin and the other drives are read while
+//it comes up to speed (PriamDrive::SpinupPoll), instead of one SEQUENCEUPANDWAIT and a whole dump after the other
+//Each drive has its own actuator, taking turns costs no seeks. The sector frames carry the drive number,
+//the host sorts the data by drive
+//Tracks are read with PriamDrive::DumpTrack, with the retry policy of the PriamDrive
+//Given a bad sector map per drive, sectors that fail are recorded there and by default (RetryPolicy::DeferRecovery)
+//only read again with PriamDrive::RereadBadSectors when the caller asks for it after Run
+class MultiDriveDump
+{
+  public:
+  enum DriveState {
+    DRIVE_SKIPPED,  //not asked for or not attached
+    DRIVE_SPINUP,   //spinning up, polled with READ DRIVE PARAMETERS until it answers
+    DRIVE_READING,
+    DRIVE_DONE,
+    DRIVE_FAILED    //did not get ready in time or interface comms error
+    };
+
+  MultiDriveDump(PriamDrive &drive) : drive_(drive) {}
+
+  //Dump the drives in driveMask, bit n for drive n. Returns when all of them are done, failed or skipped
+  //trackDone is called after every track as for PriamDrive::DumpTracks
+  //badSectors, if not nullptr, is an array of PriamDrive::MAXDRIVES maps, entry n for drive n. They are cleared first
+  template <class SINK>
+  void Run(uint8_t driveMask, SINK &sink, TrackStatusCallback trackDone = nullptr, BadSectorMap *badSectors = nullptr)
+  {
+    for (uint8_t d = 0; d < PriamDrive::MAXDRIVES; d++)
+    {
+      jobs_[d] = DriveJob();
+      if (badSectors)
+        badSectors[d].Clear();
+      if (driveMask & bit(d))
+      {
+        drive_.SpinupBegin(d, jobs_[d].spinup);
+        SpinupState(d);
+      }
+    }
+
+    bool busy = true;
+    while (busy)
+    {
+      busy = false;
+      bool readTrack = false;
+
+      for (uint8_t d = 0; d < PriamDrive::MAXDRIVES; d++)
+      {
+        DriveJob &job = jobs_[d];
+
+        if (job.state == DRIVE_SPINUP)
+        {
+          busy = true;
+          if (drive_.SpinupPoll(d, job.spinup))
+            SpinupState(d);
+        }
+
+        if (job.state != DRIVE_READING)
+          continue;
+
+        busy = true;
+        readTrack = true;
+        if (!drive_.DumpTrack(d, job.head, job.cylinder, job.heads, job.cylinders, job.sectors, sink, job.result, trackDone,
+                              badSectors ? &badSectors[d] : nullptr))
+        {
+          job.state = DRIVE_FAILED;
+          continue;
+        }
+
+        if (++job.head >= job.heads)
+        {
+          job.head = 0;
+          if (++job.cylinder >= job.cylinders)
+            job.state = DRIVE_DONE;
+        }
+      }
+
+      //Only drives spinning up left, keep the output moving while waiting for them
+      if (busy && !readTrack)
+      {
+        sink.Idle();
+        delay(10);
+      }
+    }
+  }
+
+  DriveState State(uint8_t driveno) {return jobs_[driveno].state;}
+  DumpResult &Result(uint8_t driveno) {return jobs_[driveno].result;}
+  //Milliseconds from the start of Run until the drive was ready, 0 if it was ready at once
+  unsigned long ReadyMillis(uint8_t driveno) {return jobs_[driveno].spinup.ReadyMillis();}
+
+  private:
+  class DriveJob
+  {
+    public:
+    DriveJob() : state(DRIVE_SKIPPED), heads(0), sectors(0), cylinders(0), head(0), cylinder(0) {}
+
+    DriveState state;
+    uint8_t heads;
+    uint8_t sectors;
+    uint16_t cylinders;
+    //Next track to read
+    uint8_t head;
+    uint16_t cylinder;
+    DriveSpinup spinup;
+    DumpResult result;
+  };
+
+  //Job state from the spin up state. A ready drive is read with the geometry its spin up cached
+  //One that does not take the spin up is not attached
+  void SpinupState(uint8_t driveno)
+  {
+    DriveJob &job = jobs_[driveno];
+    switch (job.spinup.GetState())
+    {
+      case DriveSpinup::SPINNING:
+        job.state = DRIVE_SPINUP;
+        break;
+      case DriveSpinup::READY:
+      {
+        DriveGeometry geometry = drive_.Geometry(driveno);
+        if (!geometry.Valid())
+        {
+          job.state = DRIVE_FAILED;
+          break;
+        }
+        job.heads = geometry.Heads();
+        job.cylinders = geometry.Cylinders();
+        job.sectors = geometry.SectorsPerTrack();
+        job.result.paramsOk_ = true;
+        job.state = (job.heads && job.cylinders && job.sectors) ? DRIVE_READING : DRIVE_DONE;
+        break;
+      }
+      case DriveSpinup::NOTATTACHED:
+      case DriveSpinup::NOTREQUESTED:
+        job.state = DRIVE_SKIPPED;
+        break;
+      default:
+        job.state = DRIVE_FAILED;
+        break;
+    }
+  }
+
+  PriamDrive &drive_;
+  DriveJob jobs_[PriamDrive::MAXDRIVES];
+};
+
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include "arduino.h"
+
+namespace Priam
+{
+
+//How PriamDrive::DumpTracks reads sectors, in tiers:
+//TIER_FIRSTPASS:   whole tracks, by default with READ DATA NO RETRY, a marginal sector fails at once
+//                  instead of holding up the track with controller retries
+//TIER_RETRY:       a sector that failed is read alone with READ DATA WITH RETRY
+//TIER_RECALIBRATE: then alone with READ DATA NO RETRY after a recalibrating seek, up to recalibrateBudget times.
+//                  The seek alternates between cylinder 0 and the last cylinder so the head approaches from both sides
+//TIER_FAILED:      the sector could not be read
+//With deferRecovery (the default) a dump with a bad sector map only records the sectors the first pass failed,
+//like priamdump does, and PriamDrive::RereadBadSectors applies the retry and recalibrate tiers once the pass is
+//done. Without it, or without a map, each failed sector is recovered before the rest of its track is read
+//Counts per tier which tier finally read each sector
+class RetryPolicy
+{
+  public:
+  enum Tier {
+    TIER_FIRSTPASS = 0,
+    TIER_RETRY = 1,
+    TIER_RECALIBRATE = 2,
+    TIER_FAILED = 3,
+    NUMTIERS = 4
+    };
+
+  //Called for every sector that was not read by the first pass, with the tier that read it
+  typedef void (*RecoveryCallback)(uint8_t driveno, uint8_t head, uint16_t cylinder, uint8_t sector, Tier tier);
+
+  RetryPolicy(bool firstPassRetry = false, bool sectorRetry = true, uint8_t recalibrateBudget = 4, bool deferRecovery = true) :
+  firstPassRetry_(firstPassRetry), sectorRetry_(sectorRetry), recalibrateBudget_(recalibrateBudget),
+  deferRecovery_(deferRecovery), callback_(nullptr), counts_{0} {}
+
+  //Controller retries on every read and no further recovery, the behaviour before retry tiers
+  static RetryPolicy ControllerRetryOnly() {return RetryPolicy(true, false, 0, false);}
+
+  bool FirstPassRetry() const {return firstPassRetry_;}
+  bool SectorRetry() const {return sectorRetry_;}
+  uint8_t RecalibrateBudget() const {return recalibrateBudget_;}
+  bool DeferRecovery() const {return deferRecovery_;}
+
+  void SetRecoveryCallback(RecoveryCallback callback) {callback_ = callback;}
+
+  //Sectors read per tier since the last ResetCounts(), TIER_FAILED counts sectors given up on
+  uint32_t Count(Tier tier) const {return counts_[tier];}
+  void ResetCounts()
+  {
+    for (uint8_t i = 0; i < NUMTIERS; i++)
+      counts_[i] = 0;
+  }
+
+  //Used by PriamDrive
+  void Record(Tier tier, uint32_t sectors) {counts_[tier] += sectors;}
+  void Recovered(uint8_t driveno, uint8_t head, uint16_t cylinder, uint8_t sector, Tier tier)
+  {
+    counts_[tier]++;
+    if (callback_)
+      callback_(driveno, head, cylinder, sector, tier);
+  }
+
+  private:
+  bool firstPassRetry_;
+  bool sectorRetry_;
+  uint8_t recalibrateBudget_;
+  bool deferRecovery_;
+  RecoveryCallback callback_;
+  uint32_t counts_[NUMTIERS];
+};
+
+}
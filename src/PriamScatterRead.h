@@ -0,0 +1,262 @@
+#pragma once
+#include "arduino.h"
+#include "PriamDrive.h"
+
+//Requests a ScatterReadQueue holds, 8 bytes of RAM each. Larger lists are read in batches
+#ifndef PRIAMSMART_SCATTER_REQUESTS
+#if defined(RAMEND) && RAMEND < 0x900
+#define PRIAMSMART_SCATTER_REQUESTS 32
+#else
+#define PRIAMSMART_SCATTER_REQUESTS 128
+#endif
+#endif
+
+namespace Priam
+{
+
+//Called by ScatterReadQueue::Run for every request after its data went to the sink, in the order they were read
+//status is the status of the first sector of the request that could not be read, or a good status
+typedef void (*ScatterDoneCallback)(uint16_t id, TransactionStatus status);
+
+//Reads a batch of scattered sectors of one drive in elevator order instead of the order they were asked for
+//Requests are kept sorted by LBA (see DriveGeometry), adjacent and overlapping ones are read together with one
+//READ DATA per track. Run() sweeps the cylinders from where the arm is:
+//SCAN:   up to the highest requested cylinder, then down for the ones below the start. The first direction is
+//        the one with the lower predicted seek time (PriamDrive::PredictSeekMicros, cylinder distance if no
+//        seek profile was measured on the drive)
+//C-SCAN: always up, then from the lowest requested cylinder up again
+//Sectors that fail are read again with PriamDrive::RecoverSector, with the retry policy of the PriamDrive
+class ScatterReadQueue
+{
+  public:
+  enum Order {SCAN, CSCAN};
+
+  static const uint16_t CAPACITY = PRIAMSMART_SCATTER_REQUESTS;
+
+  ScatterReadQueue(PriamDrive &drive, uint8_t driveno, Order order = SCAN) :
+  drive_(drive), driveno_(driveno), order_(order), used_(0), armCylinder_(0), commands_(0) {}
+
+  void SetOrder(Order order) {order_ = order;}
+
+  //Queue count blocks from lba, id is passed back to the done callback
+  //Returns false if the queue is full or the blocks are not on the disk
+  bool Add(uint16_t id, uint32_t lba, uint8_t count = 1)
+  {
+    DriveGeometry geometry = drive_.Geometry(driveno_);
+    if (used_ >= CAPACITY || !count || !geometry.Valid() || lba >= geometry.Blocks() || count > geometry.Blocks() - lba)
+      return false;
+
+    //Insertion keeps the queue sorted by LBA
+    uint16_t i = used_++;
+    while (i && requests_[i - 1].lba > lba)
+    {
+      requests_[i] = requests_[i - 1];
+      i--;
+    }
+    requests_[i].lba = lba;
+    requests_[i].id = id;
+    requests_[i].count = count;
+    return true;
+  }
+
+  bool Add(uint16_t id, uint8_t head, uint16_t cylinder, uint8_t sector, uint8_t count = 1)
+  {
+    DriveGeometry geometry = drive_.Geometry(driveno_);
+    if (!geometry.Valid() || head >= geometry.Heads() || cylinder >= geometry.Cylinders() || sector >= geometry.SectorsPerTrack())
+      return false;
+    return Add(id, geometry.Lba(head, cylinder, sector), count);
+  }
+
+  uint16_t Requests() {return used_;}
+  bool Full() {return used_ >= CAPACITY;}
+  void Clear() {used_ = 0;}
+
+  //Where the arm is, Run() starts its sweep there. Run() leaves it at the last cylinder it read
+  void SetArmCylinder(uint16_t cylinder) {armCylinder_ = cylinder;}
+  uint16_t ArmCylinder() {return armCylinder_;}
+
+  //READ DATA commands of the last Run(), recovery reads not included
+  uint16_t Commands() {return commands_;}
+
+  //Read all queued requests and empty the queue. Returns false on an interface comms error, the requests that
+  //were not read then get a comms error status
+  template <class SINK>
+  bool Run(SINK &sink, ScatterDoneCallback done = nullptr)
+  {
+    commands_ = 0;
+    DriveGeometry geometry = drive_.Geometry(driveno_);
+    bool ok = geometry.Valid();
+
+    if (ok && used_)
+    {
+      for (uint16_t i = 0; i < used_; i++)
+        requests_[i].status = (uint8_t) (driveno_ << 6);
+
+      //First request at or above the arm cylinder, and above it
+      uint16_t up = 0;
+      while (up < used_ && Cylinder(geometry, up) < armCylinder_)
+        up++;
+      uint16_t above = up;
+      while (above < used_ && Cylinder(geometry, above) == armCylinder_)
+        above++;
+
+      //Both ways cross all requested cylinders once, the difference is the way to the nearer end
+      bool upFirst = !up || (above < used_ &&
+                     SeekCost(armCylinder_, Cylinder(geometry, used_ - 1)) <= SeekCost(armCylinder_, Cylinder(geometry, 0)));
+
+      if (order_ == CSCAN)
+        ok = ReadUp(geometry, up, used_, sink, done) && ReadUp(geometry, 0, up, sink, done);
+      else if (upFirst)
+        ok = ReadUp(geometry, up, used_, sink, done) && ReadDown(geometry, 0, up, sink, done);
+      else
+        ok = ReadDown(geometry, 0, above, sink, done) && ReadUp(geometry, above, used_, sink, done);
+    }
+
+    //Not read: comms error, or the drive parameters could not be read
+    if (!ok && done)
+      for (uint16_t i = 0; i < used_; i++)
+        if (requests_[i].count)
+          done(requests_[i].id, geometry.Valid() ? TransactionStatus(0, true) : geometry.GetStatus());
+
+    used_ = 0;
+    return ok;
+  }
+
+  private:
+  class Request
+  {
+    public:
+    uint32_t lba;
+    uint16_t id;
+    //0 once the request was read and reported
+    uint8_t count;
+    //Raw status of the first failing sector, good status with the drive number until then
+    uint8_t status;
+  };
+
+  uint16_t Cylinder(DriveGeometry &geometry, uint16_t request)
+  {
+    return (uint16_t) (requests_[request].lba / ((uint32_t) geometry.Heads() * geometry.SectorsPerTrack()));
+  }
+
+  uint32_t SeekCost(uint16_t from, uint16_t to)
+  {
+    uint32_t micros = drive_.PredictSeekMicros(driveno_, from, to);
+    if (micros)
+      return micros;
+    return from > to ? (uint32_t) (from - to) : (uint32_t) (to - from);
+  }
+
+  //Requests [from, to) in ascending order, adjacent ones coalesced
+  template <class SINK>
+  bool ReadUp(DriveGeometry &geometry, uint16_t from, uint16_t to, SINK &sink, ScatterDoneCallback done)
+  {
+    uint16_t i = from;
+    while (i < to)
+    {
+      uint32_t start = requests_[i].lba;
+      uint32_t end = start + requests_[i].count;
+      uint16_t j = i + 1;
+      while (j < to && requests_[j].lba <= end)
+      {
+        if (requests_[j].lba + requests_[j].count > end)
+          end = requests_[j].lba + requests_[j].count;
+        j++;
+      }
+
+      if (!ReadRun(geometry, i, j, start, end, sink))
+        return false;
+
+      for (uint16_t r = i; r < j; r++)
+      {
+        if (done)
+          done(requests_[r].id, TransactionStatus(requests_[r].status, false));
+        requests_[r].count = 0;
+      }
+      i = j;
+    }
+    return true;
+  }
+
+  //Requests [from, to) one cylinder after the other downwards, each cylinder in ascending order
+  template <class SINK>
+  bool ReadDown(DriveGeometry &geometry, uint16_t from, uint16_t to, SINK &sink, ScatterDoneCallback done)
+  {
+    while (to > from)
+    {
+      uint16_t first = to - 1;
+      uint16_t cylinder = Cylinder(geometry, first);
+      while (first > from && Cylinder(geometry, first - 1) == cylinder)
+        first--;
+
+      if (!ReadUp(geometry, first, to, sink, done))
+        return false;
+      to = first;
+    }
+    return true;
+  }
+
+  //Blocks [start, end) for requests [from, to), one command per track, a failing sector goes to RecoverSector
+  //and the track is read on from the sector after it
+  template <class SINK>
+  bool ReadRun(DriveGeometry &geometry, uint16_t from, uint16_t to, uint32_t start, uint32_t end, SINK &sink)
+  {
+    RetryPolicy &policy = drive_.GetRetryPolicy();
+    uint32_t lba = start;
+
+    while (lba < end)
+    {
+      uint8_t head, sector;
+      uint16_t cylinder;
+      geometry.Chs(lba, head, cylinder, sector);
+      armCylinder_ = cylinder;
+
+      uint8_t count = (uint8_t) (geometry.SectorsPerTrack() - sector);
+      if (count > end - lba)
+        count = (uint8_t) (end - lba);
+
+      CountingDataSink<SINK> counter(sink);
+      TransactionStatus st = drive_.ReadData(driveno_, head, cylinder, sector, count, counter, policy.FirstPassRetry());
+      commands_++;
+      if (st.CommsError())
+        return false;
+
+      //An error with every sector transferred was found after the transfer of the last one
+      uint8_t readOk = (uint8_t) (counter.Count() / geometry.SectorSize());
+      if (st.IsErrorStatus() && readOk >= count)
+        readOk = (uint8_t) (count - 1);
+      policy.Record(RetryPolicy::TIER_FIRSTPASS, st.IsErrorStatus() ? readOk : count);
+      if (!st.IsErrorStatus())
+      {
+        lba += count;
+        continue;
+      }
+
+      uint32_t failed = lba + readOk;
+      if (drive_.RecoverSector(driveno_, head, cylinder, (uint8_t) (sector + readOk), geometry.Cylinders(), sink, st) == RetryPolicy::TIER_FAILED)
+      {
+        if (st.CommsError())
+          return false;
+
+        for (uint16_t r = from; r < to; r++)
+        {
+          Request &request = requests_[r];
+          if (failed >= request.lba && failed < request.lba + request.count && !TransactionStatus(request.status, false).IsErrorStatus())
+            request.status = st.GetRawStatusVal();
+        }
+      }
+      lba = failed + 1;
+    }
+    return true;
+  }
+
+  PriamDrive &drive_;
+  uint8_t driveno_;
+  Order order_;
+  uint16_t used_;
+  uint16_t armCylinder_;
+  uint16_t commands_;
+  Request requests_[CAPACITY];
+};
+
+}
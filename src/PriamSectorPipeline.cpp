@@ -0,0 +1,44 @@
+#include "PriamSectorPipeline.h"
+
+using namespace Priam;
+
+uint8_t SectorPipeline::Pop()
+{
+  uint8_t val = buffer_[tail_];
+  tail_ = (uint16_t) ((tail_ + 1) % SIZE);
+  count_--;
+  return val;
+}
+
+size_t SectorPipeline::write(uint8_t val)
+{
+  //Full, make room. Blocks in the output if the UART buffer is full as well
+  if (count_ >= SIZE)
+  {
+    Pump();
+    if (count_ >= SIZE)
+      out_.write(Pop());
+  }
+
+  buffer_[head_] = val;
+  head_ = (uint16_t) ((head_ + 1) % SIZE);
+  count_++;
+  if (count_ > highWater_)
+    highWater_ = count_;
+
+  return 1;
+}
+
+void SectorPipeline::Pump()
+{
+  int room = out_.availableForWrite();
+
+  while (count_ && room-- > 0)
+    out_.write(Pop());
+}
+
+void SectorPipeline::flush()
+{
+  while (count_)
+    out_.write(Pop());
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "arduino.h"
+
+//Size of the SectorPipeline buffer in bytes, two 512 byte sectors by default
+//Boards with 2 KB of RAM (Uno, Nano) get half a sector, which still keeps the UART busy
+//while the controller seeks or waits for the next sector
+#ifndef PRIAMSMART_PIPELINE_BYTES
+#if defined(RAMEND) && RAMEND < 0x900
+#define PRIAMSMART_PIPELINE_BYTES 256
+#else
+#define PRIAMSMART_PIPELINE_BYTES 1024
+#endif
+#endif
+
+namespace Priam
+{
+
+//Buffer between SectorStream and a serial port, so the controller can be read while the UART sends
+//Bytes written to the pipeline are queued, Pump() moves as many as fit in the UART transmit buffer
+//without blocking. PriamSmart calls sink.Idle() while the controller is busy, SectorStream then pumps
+//the pipeline, so sector N goes out over the link while sector N+1 is read from the disk
+//Only blocks when the buffer is full. Call flush() before writing to the port directly
+class SectorPipeline : public Print
+{
+  public:
+  SectorPipeline(Print &out) : out_(out), head_(0), tail_(0), count_(0), highWater_(0) {}
+
+  size_t write(uint8_t val) override;
+  using Print::write;
+
+  //Write as much buffered data as the output takes without blocking
+  void Pump();
+
+  //Write out all buffered data, blocks until done
+  void flush() override;
+
+  //Bytes waiting to be sent
+  uint16_t Buffered() {return count_;}
+
+  //Largest number of bytes that were buffered
+  uint16_t HighWater() {return highWater_;}
+
+  static const uint16_t SIZE = PRIAMSMART_PIPELINE_BYTES;
+
+  private:
+  uint8_t Pop();
+
+  Print &out_;
+  uint8_t buffer_[SIZE];
+  uint16_t head_;
+  uint16_t tail_;
+  uint16_t count_;
+  uint16_t highWater_;
+};
+
+}
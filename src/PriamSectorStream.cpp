@@ -0,0 +1,343 @@
+#include "PriamSectorStream.h"
+
+using namespace Priam;
+
+SectorStream::SectorStream(Print &out, OutputMode mode) :
+out_(out), pipeline_(nullptr), mode_(mode), drive_(0), head_(0), cylinder_(0), sector_(0), sectorSize_(0),
+firstSector_(0), sectorCount_(0), sectorBytes_(0), transferBytes_(0), crc_(0), sectorCrc_(0), hexDrive_(0),
+eventPending_(false), event_{0}, rleLast_(-1), rleCount_(0), rleExtra_(0), firstByte_(0), uniform_(false), holding_(false),
+prevValid_(false), holdIdx_(0), holdLen_{0}
+{
+}
+
+SectorStream::SectorStream(SectorPipeline &pipeline, OutputMode mode) :
+out_(pipeline), pipeline_(&pipeline), mode_(mode), drive_(0), head_(0), cylinder_(0), sector_(0), sectorSize_(0),
+firstSector_(0), sectorCount_(0), sectorBytes_(0), transferBytes_(0), crc_(0), sectorCrc_(0), hexDrive_(0),
+eventPending_(false), event_{0}, rleLast_(-1), rleCount_(0), rleExtra_(0), firstByte_(0), uniform_(false), holding_(false),
+prevValid_(false), holdIdx_(0), holdLen_{0}
+{
+}
+
+void SectorStream::BeginTransfer(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, uint16_t sectorSize)
+{
+  drive_ = drive;
+  head_ = head;
+  cylinder_ = cylinder;
+  sector_ = sector;
+  sectorSize_ = sectorSize;
+
+  firstSector_ = sector;
+  sectorCount_ = 0;
+  sectorBytes_ = 0;
+  transferBytes_ = 0;
+
+  //A hex dump carries no addresses, mark where data of another drive starts (MultiDriveDump)
+  if (mode_ == HEXDUMP && drive != hexDrive_)
+  {
+    out_.print(F("Drive "));
+    out_.println(drive);
+    hexDrive_ = drive;
+  }
+}
+
+void SectorStream::WriteFrameByte(uint8_t val)
+{
+  crc_ = Crc16Update(crc_, val);
+  out_.write(val);
+}
+
+void SectorStream::WriteFrameHeader(uint8_t type)
+{
+  out_.write(SYNC0);
+  out_.write(SYNC1);
+  crc_ = 0xFFFF;
+  WriteFrameByte(type);
+  WriteFrameByte(drive_);
+  WriteFrameByte(head_);
+  WriteFrameByte((uint8_t) (cylinder_ >> 8));
+  WriteFrameByte((uint8_t) (cylinder_ & 0xFF));
+}
+
+void SectorStream::WriteFrameCrc()
+{
+  uint16_t crc = crc_;
+  out_.write((uint8_t) (crc >> 8));
+  out_.write((uint8_t) (crc & 0xFF));
+}
+
+void SectorStream::WriteSectorCrc()
+{
+  uint32_t crc = sectorCrc_ ^ CRC32_INIT;
+  WriteFrameByte((uint8_t) (crc >> 24));
+  WriteFrameByte((uint8_t) (crc >> 16));
+  WriteFrameByte((uint8_t) (crc >> 8));
+  WriteFrameByte((uint8_t) (crc & 0xFF));
+}
+
+void SectorStream::Put(uint8_t val)
+{
+  if (mode_ == HEXDUMP)
+  {
+    char tmp[8];
+
+    if (transferBytes_ && !(transferBytes_ % 16))
+      out_.print(F("\n"));
+
+    sprintf(tmp, "%02X ", val);
+    out_.print(tmp);
+    transferBytes_++;
+    return;
+  }
+
+  if (mode_ == COMPRESSED)
+  {
+    PackByte(val);
+    return;
+  }
+
+  //First byte of a sector, send frame header
+  if (!sectorBytes_)
+  {
+    sectorCrc_ = CRC32_INIT;
+    WriteFrameHeader(FRAME_DATA);
+    WriteFrameByte(sector_);
+    WriteFrameByte((uint8_t) (sectorSize_ >> 8));
+    WriteFrameByte((uint8_t) (sectorSize_ & 0xFF));
+  }
+
+  sectorCrc_ = Crc32Update(sectorCrc_, val);
+  WriteFrameByte(val);
+  sectorBytes_++;
+  transferBytes_++;
+
+  //Last byte of the sector, close frame
+  if (sectorBytes_ >= sectorSize_)
+  {
+    WriteSectorCrc();
+    WriteFrameCrc();
+    sectorBytes_ = 0;
+    sectorCount_++;
+    sector_++;
+  }
+}
+
+void SectorStream::EndTransfer(TransactionStatus status)
+{
+  if (mode_ == HEXDUMP)
+  {
+    if (transferBytes_)
+      out_.print(F("\n"));
+    return;
+  }
+
+  uint8_t flags = 0;
+  if (status.CommsError())
+    flags |= STATUSFLAG_COMMSERROR;
+
+  //Short last sector, pad it so the host always gets sectorSize bytes per DATA frame
+  if (sectorBytes_)
+    flags |= STATUSFLAG_SHORTSECTOR;
+  while (sectorBytes_)
+    Put(0);
+
+  WriteFrameHeader(FRAME_STATUS);
+  WriteFrameByte(firstSector_);
+  WriteFrameByte(sectorCount_);
+  WriteFrameByte(status.GetRawStatusVal());
+  WriteFrameByte(flags);
+  WriteFrameCrc();
+
+  if (eventPending_)
+    WriteEventFrame();
+}
+
+void SectorStream::Checkpoint(uint8_t drive, uint8_t head, uint16_t cylinder)
+{
+  if (mode_ == HEXDUMP)
+    return;
+
+  //Data after a checkpoint must not depend on data before it
+  prevValid_ = false;
+
+  drive_ = drive;
+  head_ = head;
+  cylinder_ = cylinder;
+  WriteFrameHeader(FRAME_CHECKPOINT);
+  WriteFrameCrc();
+}
+
+void SectorStream::Response(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t seq, uint8_t op, uint8_t status, uint8_t flags,
+                            const uint8_t *data, uint8_t len)
+{
+  if (mode_ == HEXDUMP)
+    return;
+
+  drive_ = drive;
+  head_ = head;
+  cylinder_ = cylinder;
+  WriteFrameHeader(FRAME_RESPONSE);
+  WriteFrameByte(seq);
+  WriteFrameByte(op);
+  WriteFrameByte(status);
+  WriteFrameByte(flags);
+  WriteFrameByte(len);
+  for (uint8_t i = 0; i < len; i++)
+    WriteFrameByte(data[i]);
+  WriteFrameCrc();
+}
+
+void SectorStream::Event(uint8_t level, uint8_t event, uint8_t value)
+{
+  if (mode_ == HEXDUMP)
+    return;
+
+  event_[0] = level;
+  event_[1] = event;
+  event_[2] = value;
+  eventPending_ = true;
+
+  //A sector frame is open, EndTransfer sends it
+  if (sectorBytes_)
+    return;
+  WriteEventFrame();
+}
+
+void SectorStream::WriteEventFrame()
+{
+  eventPending_ = false;
+  WriteFrameHeader(FRAME_EVENT);
+  for (uint8_t i = 0; i < sizeof(event_); i++)
+    WriteFrameByte(event_[i]);
+  WriteFrameCrc();
+}
+
+void SectorStream::StartPackedFrame(uint8_t method)
+{
+  WriteFrameHeader(FRAME_PACKED);
+  WriteFrameByte(sector_);
+  WriteFrameByte((uint8_t) (sectorSize_ >> 8));
+  WriteFrameByte((uint8_t) (sectorSize_ & 0xFF));
+  WriteFrameByte(method);
+}
+
+//Packed output byte, held back while it fits, then the frame is started as RLE and the rest streamed
+void SectorStream::RleByte(uint8_t val)
+{
+  if (holding_)
+  {
+    if (holdLen_[holdIdx_] < PRIAMSMART_COMPRESS_HOLD)
+    {
+      hold_[holdIdx_][holdLen_[holdIdx_]++] = val;
+      return;
+    }
+
+    StartPackedFrame(PACK_RLE);
+    for (uint16_t i = 0; i < holdLen_[holdIdx_]; i++)
+      WriteFrameByte(hold_[holdIdx_][i]);
+    holding_ = false;
+  }
+
+  WriteFrameByte(val);
+}
+
+void SectorStream::PackByte(uint8_t val)
+{
+  //First byte of a sector
+  if (!sectorBytes_)
+  {
+    rleLast_ = -1;
+    rleCount_ = 0;
+    rleExtra_ = 0;
+    firstByte_ = val;
+    uniform_ = true;
+    holding_ = true;
+    holdLen_[holdIdx_] = 0;
+    sectorCrc_ = CRC32_INIT;
+  }
+
+  sectorCrc_ = Crc32Update(sectorCrc_, val);
+  if (val != firstByte_)
+    uniform_ = false;
+
+  //In a run: count repeats, a different byte or a full count ends it
+  bool repeat = false;
+  if (rleCount_ >= 2)
+  {
+    if (val == rleLast_ && rleExtra_ < 255)
+    {
+      rleExtra_++;
+      repeat = true;
+    }
+    else
+    {
+      RleByte(rleExtra_);
+      rleCount_ = 0;
+      rleExtra_ = 0;
+      rleLast_ = -1;
+    }
+  }
+
+  if (!repeat)
+  {
+    RleByte(val);
+    if (val == rleLast_)
+      rleCount_ = 2;
+    else
+    {
+      rleLast_ = val;
+      rleCount_ = 1;
+    }
+  }
+
+  sectorBytes_++;
+  transferBytes_++;
+
+  //Last byte of the sector, close frame
+  if (sectorBytes_ >= sectorSize_)
+  {
+    EndPackedSector();
+    sectorBytes_ = 0;
+    sectorCount_++;
+    sector_++;
+  }
+}
+
+void SectorStream::EndPackedSector()
+{
+  if (rleCount_ >= 2)
+    RleByte(rleExtra_);
+
+  if (!holding_)
+  {
+    //Streamed, too big to compare with the next sector
+    prevValid_ = false;
+    WriteSectorCrc();
+    WriteFrameCrc();
+    return;
+  }
+
+  uint8_t prev = (uint8_t) (holdIdx_ ^ 1);
+  uint16_t len = holdLen_[holdIdx_];
+
+  if (prevValid_ && holdLen_[prev] == len && !memcmp(hold_[prev], hold_[holdIdx_], len))
+  {
+    StartPackedFrame(PACK_SAME);
+  }
+  else if (uniform_)
+  {
+    StartPackedFrame(PACK_UNIFORM);
+    WriteFrameByte(firstByte_);
+  }
+  else
+  {
+    StartPackedFrame(PACK_RLE);
+    for (uint16_t i = 0; i < len; i++)
+      WriteFrameByte(hold_[holdIdx_][i]);
+  }
+  WriteSectorCrc();
+  WriteFrameCrc();
+
+  prevValid_ = true;
+  holdIdx_ = prev;
+  holding_ = false;
+}
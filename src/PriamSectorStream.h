@@ -0,0 +1,167 @@
+#pragma once
+#include "arduino.h"
+#include "PriamSmartCommandResult.h"
+#include "PriamDataSink.h"
+#include "PriamSectorPipeline.h"
+#include "PriamCrc32.h"
+
+//Bytes of packed sector data SectorStream holds back in COMPRESSED mode, twice (current and previous sector)
+//A sector whose packed form fits can be sent as "same as previous", one that does not is sent as RLE as it arrives
+//The default holds whole 512 byte sectors, 2 KB RAM boards only hold fill pattern sectors
+#ifndef PRIAMSMART_COMPRESS_HOLD
+#if defined(RAMEND) && RAMEND < 0x900
+#define PRIAMSMART_COMPRESS_HOLD 64
+#else
+#define PRIAMSMART_COMPRESS_HOLD 520
+#endif
+#endif
+
+namespace Priam
+{
+
+//Sends the data read from the disk to the host, one sector at a time
+//Three output formats:
+//HEXDUMP:    human readable, 16 bytes per line, for debugging with a serial monitor. A "Drive n" line goes
+//            before a transfer from another drive than the one before (drive 0 at the start)
+//BINARY:     one frame per sector with the raw sector data, followed by one status frame per transfer
+//COMPRESSED: as BINARY with PACKED frames instead of DATA frames
+//
+//Binary frame layout (multi byte values MSB first):
+//  SYNC0 SYNC1 TYPE <type specific fields> CRC16
+//  DATA frame:   SYNC0 SYNC1 FRAME_DATA drive head cylMSB cylLSB sector sizeMSB sizeLSB <size data bytes> <sector crc32> crcMSB crcLSB
+//  STATUS frame: SYNC0 SYNC1 FRAME_STATUS drive head cylMSB cylLSB sector count status flags crcMSB crcLSB
+//  CHECKPOINT frame: SYNC0 SYNC1 FRAME_CHECKPOINT drive head cylMSB cylLSB crcMSB crcLSB
+//    sent by a full drive dump after each track, head/cylinder is the next track. Everything before it
+//    is complete, a host that lost the link can keep its data up to the last checkpoint and resume from there
+//  PACKED frame: SYNC0 SYNC1 FRAME_PACKED drive head cylMSB cylLSB sector sizeMSB sizeLSB method <packed data> <sector crc32> crcMSB crcLSB
+//    PACK_UNIFORM: one byte, all size bytes of the sector have this value
+//    PACK_SAME:    no data, the sector is the same as the sector of the previous DATA/PACKED frame
+//                  (never sent as the first sector after a CHECKPOINT frame)
+//    PACK_RLE:     RLE data that decodes to exactly size bytes. Bytes are literal, after two equal bytes
+//                  a count byte follows with the number of further repeats (0-255), then literals again
+//  RESPONSE frame: SYNC0 SYNC1 FRAME_RESPONSE drive head cylMSB cylLSB seq op status flags len <len data bytes> crcMSB crcLSB
+//    answer to a host protocol request, see PriamHostProtocol.h
+//  EVENT frame: SYNC0 SYNC1 FRAME_EVENT drive head cylMSB cylLSB level event value crcMSB crcLSB
+//    library diagnostic message (see PriamLog.h), drive/head/cylinder of the last transfer. One that comes up
+//    inside a sector frame is sent after the STATUS frame of the transfer
+//The CRC is CRC-16/CCITT (poly 0x1021, init 0xFFFF) over all bytes from TYPE up to the last data/field byte
+//The sector crc32 (4 bytes, MSB first, see PriamCrc32.h) is computed over the sector data as it comes off the bus,
+//the host checks it against the unpacked sector. It catches corruption in the pipeline, the packing and the link
+//that the frame CRC misses, and a PACK_SAME that refers to the wrong sector
+//The controller only reports completion status at the end of a command, so the status of all sectors
+//of a transfer is carried in the STATUS frame that follows their DATA frames
+//SectorStream is a data sink, pass it to PriamDrive::ReadData
+//Constructed on a SectorPipeline, the pipeline is pumped while the controller is busy
+class SectorStream : public DataSinkBase
+{
+  public:
+
+  enum OutputMode {HEXDUMP, BINARY, COMPRESSED};
+
+  static const uint8_t SYNC0 = 0xA5;
+  static const uint8_t SYNC1 = 0x5A;
+
+  enum FrameType {
+    FRAME_DATA = 0x01,
+    FRAME_STATUS = 0x02,
+    FRAME_CHECKPOINT = 0x03,
+    FRAME_PACKED = 0x04,
+    FRAME_RESPONSE = 0x05,
+    FRAME_EVENT = 0x06
+    };
+
+  //Packing methods in PACKED frame
+  enum PackMethod {
+    PACK_UNIFORM = 0x01,
+    PACK_SAME = 0x02,
+    PACK_RLE = 0x03
+    };
+
+  //Flags in STATUS frame
+  enum StatusFlags {
+    STATUSFLAG_COMMSERROR = bit(0),
+    STATUSFLAG_SHORTSECTOR = bit(1)
+    };
+
+  SectorStream(Print &out, OutputMode mode = HEXDUMP);
+  SectorStream(SectorPipeline &pipeline, OutputMode mode = HEXDUMP);
+
+  void SetMode(OutputMode mode) {mode_ = mode; prevValid_ = false;}
+  OutputMode GetMode() {return mode_;}
+
+  //Start of a data transfer beginning at head/cylinder/sector, sectorSize bytes per sector (must not be 0)
+  void BeginTransfer(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t sector, uint16_t sectorSize);
+
+  //One byte read from the disk
+  void Put(uint8_t val);
+
+  //End of transfer, status is the command completion status
+  void EndTransfer(TransactionStatus status);
+
+  //Controller busy, send buffered data
+  void Idle()
+  {
+    if (pipeline_)
+      pipeline_->Pump();
+  }
+
+  //Dump progress, binary mode only
+  void Checkpoint(uint8_t drive, uint8_t head, uint16_t cylinder);
+
+  //Answer to a host protocol request, binary mode only. Not during a transfer
+  void Response(uint8_t drive, uint8_t head, uint16_t cylinder, uint8_t seq, uint8_t op, uint8_t status, uint8_t flags,
+                const uint8_t *data, uint8_t len);
+
+  //Library diagnostic message, binary mode only. Only the last one is kept when several come up inside a sector
+  void Event(uint8_t level, uint8_t event, uint8_t value);
+
+  private:
+
+  void WriteFrameByte(uint8_t val);
+  void WriteFrameHeader(uint8_t type);
+  void WriteFrameCrc();
+  void WriteSectorCrc();
+  void WriteEventFrame();
+
+  //COMPRESSED mode
+  void PackByte(uint8_t val);
+  void RleByte(uint8_t val);
+  void StartPackedFrame(uint8_t method);
+  void EndPackedSector();
+
+  Print &out_;
+  SectorPipeline *pipeline_;
+  OutputMode mode_;
+
+  uint8_t drive_;
+  uint8_t head_;
+  uint16_t cylinder_;
+  uint8_t sector_;
+  uint16_t sectorSize_;
+
+  uint8_t firstSector_;
+  uint8_t sectorCount_;
+  uint16_t sectorBytes_;
+  uint32_t transferBytes_;
+  uint16_t crc_;
+  uint32_t sectorCrc_;
+  //Drive of the last HEXDUMP transfer
+  uint8_t hexDrive_;
+  //Level, event and value of an EVENT frame held back until the sector frame is closed
+  bool eventPending_;
+  uint8_t event_[3];
+
+  //COMPRESSED mode state: RLE encoder, uniform sector check, held back packed data of this and the previous sector
+  int16_t rleLast_;
+  uint8_t rleCount_;
+  uint8_t rleExtra_;
+  uint8_t firstByte_;
+  bool uniform_;
+  bool holding_;
+  bool prevValid_;
+  uint8_t holdIdx_;
+  uint16_t holdLen_[2];
+  uint8_t hold_[2][PRIAMSMART_COMPRESS_HOLD];
+};
+
+}
@@ -0,0 +1,74 @@
+#include "PriamSeekProfile.h"
+
+using namespace Priam;
+
+void SeekProfile::Begin(uint8_t driveno, uint16_t cylinders)
+{
+  drive_ = driveno;
+  cylinders_ = cylinders;
+  points_ = 0;
+  valid_ = false;
+
+  if (!cylinders)
+    return;
+
+  uint16_t maxDistance = (uint16_t) (cylinders - 1);
+
+  //0, then powers of two below the full stroke, then the full stroke
+  distance_[points_] = 0;
+  micros_[points_++] = 0;
+  for (uint16_t d = 1; d < maxDistance && points_ < PRIAMSMART_SEEKPROFILE_POINTS - 1; d = (uint16_t) (d << 1))
+  {
+    distance_[points_] = d;
+    micros_[points_++] = 0;
+  }
+  if (maxDistance)
+  {
+    distance_[points_] = maxDistance;
+    micros_[points_++] = 0;
+  }
+}
+
+uint32_t SeekProfile::PredictMicros(uint16_t distance)
+{
+  if (!valid_)
+    return 0;
+
+  for (uint8_t i = 1; i < points_; i++)
+  {
+    if (distance <= distance_[i])
+    {
+      uint16_t d0 = distance_[i - 1];
+      uint16_t d1 = distance_[i];
+      int32_t t0 = (int32_t) micros_[i - 1];
+      int32_t t1 = (int32_t) micros_[i];
+      return (uint32_t) (t0 + (t1 - t0) * (int32_t) (distance - d0) / (int32_t) (d1 - d0));
+    }
+  }
+
+  return micros_[points_ - 1];
+}
+
+void SeekProfile::Dump(Print &out)
+{
+  if (!valid_)
+  {
+    out.println(F("No seek profile"));
+    return;
+  }
+
+  out.print(F("Seek profile drive "));
+  out.print(drive_);
+  out.print(F(", "));
+  out.print(cylinders_);
+  out.println(F(" cylinders"));
+
+  for (uint8_t i = 0; i < points_; i++)
+  {
+    out.print(F("  "));
+    out.print(distance_[i]);
+    out.print(F(" cylinders: "));
+    out.print(micros_[i]);
+    out.println(F(" us"));
+  }
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include "arduino.h"
+
+//Number of seek distances measured by the seek profiler: 0, 1, 2, 4 ... and the full stroke
+//14 points cover drives of up to 4096 cylinders, each point takes 6 bytes of RAM
+#ifndef PRIAMSMART_SEEKPROFILE_POINTS
+#define PRIAMSMART_SEEKPROFILE_POINTS 14
+#endif
+
+namespace Priam
+{
+
+//Seek time against cylinder distance, measured by PriamDrive::ProfileSeeks
+//Times are whole SEEK commands in microseconds, including command overhead
+//Predictions between measured distances are interpolated linearly
+class SeekProfile
+{
+  public:
+  SeekProfile() : drive_(0), cylinders_(0), points_(0), valid_(false) {}
+
+  //Start a new profile for a drive with cylinders cylinders, sets up the distances to measure
+  //The profile is not valid until Finish() is called after all points were measured
+  void Begin(uint8_t driveno, uint16_t cylinders);
+  void Finish() {valid_ = points_ != 0;}
+
+  //Measured distances
+  uint8_t Points() {return points_;}
+  uint16_t Distance(uint8_t point) {return distance_[point];}
+
+  //Store the average seek time measured for a point
+  void SetMicros(uint8_t point, uint32_t micros) {micros_[point] = micros;}
+  uint32_t Micros(uint8_t point) {return micros_[point];}
+
+  //A profile has been measured completely
+  bool Valid() {return valid_;}
+  uint8_t Drive() {return drive_;}
+  uint16_t Cylinders() {return cylinders_;}
+
+  //Predicted seek time in microseconds for a seek over distance cylinders, 0 if there is no valid profile
+  uint32_t PredictMicros(uint16_t distance);
+  //The same for a seek of drive driveno, 0 if the profile was measured on another drive
+  uint32_t PredictMicros(uint8_t driveno, uint16_t fromCylinder, uint16_t toCylinder)
+  {
+    if (driveno != drive_)
+      return 0;
+    return PredictMicros((uint16_t) (fromCylinder > toCylinder ? fromCylinder - toCylinder : toCylinder - fromCylinder));
+  }
+
+  void Invalidate() {points_ = 0; valid_ = false;}
+
+  //Print the curve, one distance per line
+  void Dump(Print &out);
+
+  private:
+  uint8_t drive_;
+  uint16_t cylinders_;
+  uint8_t points_;
+  bool valid_;
+  uint16_t distance_[PRIAMSMART_SEEKPROFILE_POINTS];
+  uint32_t micros_[PRIAMSMART_SEEKPROFILE_POINTS];
+};
+
+}
@@ -0,0 +1,150 @@
+#include "PriamSerialTransport.h"
+
+using namespace Priam;
+
+void SerialTransport::begin(unsigned long baud)
+{
+  baud_ = baud;
+  serial_.begin(baud);
+}
+
+void SerialTransport::SetFlowControl(FlowControl flow)
+{
+  flow_ = flow;
+  stopped_ = false;
+  if (flow == FLOW_CTS)
+    pinMode(CTSLINE, INPUT_PULLUP);
+}
+
+bool SerialTransport::SupportsBaud(unsigned long baud)
+{
+  if (!baud)
+    return false;
+#if defined(F_CPU)
+  //Standard rates up to 115200 are fine on any clock, above that only exact divisors in double speed mode
+  if (baud <= 115200)
+    return true;
+  return (F_CPU % (8UL * baud)) == 0;
+#else
+  return true;
+#endif
+}
+
+void SerialTransport::PollInput()
+{
+  //Leave input in the UART receive buffer when full, so a batch of host requests is not lost.
+  //While stopped keep reading, the host only sends XON then
+  while ((rxCount_ < PRIAMSMART_TRANSPORT_RXBUFFER || stopped_) && serial_.available())
+  {
+    int c = serial_.read();
+    if (c < 0)
+      break;
+
+    if (flow_ == FLOW_XONXOFF && (c == XON || c == XOFF))
+    {
+      stopped_ = (c == XOFF);
+      continue;
+    }
+
+    //Dropped when full while stopped
+    if (rxCount_ < PRIAMSMART_TRANSPORT_RXBUFFER)
+    {
+      rxBuffer_[(rxHead_ + rxCount_) % PRIAMSMART_TRANSPORT_RXBUFFER] = (uint8_t) c;
+      rxCount_++;
+    }
+  }
+}
+
+bool SerialTransport::Stopped()
+{
+  PollInput();
+
+  if (flow_ == FLOW_CTS)
+    return digitalRead(CTSLINE) == HIGH;
+
+  return stopped_;
+}
+
+int SerialTransport::Uart::availableForWrite()
+{
+  if (transport_.Stopped())
+    return 0;
+  return transport_.serial_.availableForWrite();
+}
+
+size_t SerialTransport::Uart::write(uint8_t val)
+{
+  while (transport_.Stopped())
+    ;
+  return transport_.serial_.write(val);
+}
+
+size_t SerialTransport::write(uint8_t val)
+{
+  size_t n = tx_.write(val);
+  tx_.Pump();
+  return n;
+}
+
+void SerialTransport::flush()
+{
+  tx_.flush();
+  serial_.flush();
+}
+
+int SerialTransport::available()
+{
+  tx_.Pump();
+  PollInput();
+  return rxCount_;
+}
+
+int SerialTransport::peek()
+{
+  PollInput();
+  if (!rxCount_)
+    return -1;
+  return rxBuffer_[rxHead_];
+}
+
+int SerialTransport::read()
+{
+  PollInput();
+  if (!rxCount_)
+    return -1;
+
+  uint8_t c = rxBuffer_[rxHead_];
+  rxHead_ = (uint8_t) ((rxHead_ + 1) % PRIAMSMART_TRANSPORT_RXBUFFER);
+  rxCount_--;
+  return c;
+}
+
+bool SerialTransport::NegotiateBaud(unsigned long baud, unsigned long timeout_ms)
+{
+  unsigned long oldBaud = baud_;
+
+  if (!SupportsBaud(baud))
+    return false;
+
+  print(F("BAUD "));
+  println(baud);
+  flush();
+
+  begin(baud);
+
+  //Anything the host sent during the switch is garbage
+  rxCount_ = 0;
+
+  unsigned long start = millis();
+  while (millis() - start < timeout_ms)
+  {
+    if (available() && read() == BAUD_CONFIRM)
+    {
+      println(F("OK"));
+      return true;
+    }
+  }
+
+  begin(oldBaud);
+  return false;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include "arduino.h"
+#include "PriamBoard.h"
+#include "PriamSectorPipeline.h"
+
+//Receive buffer for bytes that are not flow control, the sketch reads menu keys and commands from it
+#ifndef PRIAMSMART_TRANSPORT_RXBUFFER
+#define PRIAMSMART_TRANSPORT_RXBUFFER 16
+#endif
+
+namespace Priam
+{
+
+//Host clear to send input for FLOW_CTS, from the board descriptor (A2 on the Priam shield). LOW = host can receive
+const uint8_t CTSLINE = PRIAMSMART_BOARD::CTSLINE;
+
+//Serial link to the host with flow control and baud rate negotiation
+//All output goes through a transmit ring (a SectorPipeline of PRIAMSMART_PIPELINE_BYTES), so text and sector
+//frames leave in the order they were written. The ring only passes to the UART what it has room for while
+//the host has not stopped us. write() and available() send what fits, a SectorStream constructed on
+//Pipeline() sends while the controller is busy. write() only blocks when the ring is full
+//Flow control:
+//  FLOW_XONXOFF: the host sends XOFF (0x13) to stop and XON (0x11) to resume. Only the host sends them,
+//                so the binary data we send needs no escaping. Host to device data must not contain them
+//  FLOW_CTS:     the host drives CTSLINE high to stop
+//Bytes already in the UART transmit buffer (up to 64) still go out after the host stops us
+//Input has to be read through the transport, so flow control bytes are seen and removed
+//Flow control bytes are only seen when there is room in the receive buffer, read input regularly
+class SerialTransport : public Stream
+{
+  public:
+  enum FlowControl {FLOW_NONE, FLOW_XONXOFF, FLOW_CTS};
+
+  static const uint8_t XON = 0x11;
+  static const uint8_t XOFF = 0x13;
+
+  //Sent by the host at the new baud rate to confirm a baud rate change
+  static const uint8_t BAUD_CONFIRM = 'K';
+
+  SerialTransport(HardwareSerial &serial) :
+  serial_(serial), baud_(0), flow_(FLOW_NONE), stopped_(false), rxHead_(0), rxCount_(0), uart_(*this), tx_(uart_) {}
+
+  void begin(unsigned long baud);
+  unsigned long Baud() {return baud_;}
+
+  void SetFlowControl(FlowControl flow);
+  FlowControl GetFlowControl() {return flow_;}
+
+  //True while the host has stopped us
+  bool Stopped();
+
+  //Check if the UART can run at baud with a small enough error on this CPU clock
+  static bool SupportsBaud(unsigned long baud);
+
+  //Switch to another baud rate together with the host:
+  //sends "BAUD <rate>" as a line at the current rate, switches, then waits up to timeout_ms for the host
+  //to send BAUD_CONFIRM at the new rate and answers "OK". Goes back to the old rate if the host did not confirm
+  bool NegotiateBaud(unsigned long baud, unsigned long timeout_ms = 2000);
+
+  //Print, into the transmit ring
+  size_t write(uint8_t val) override;
+  using Print::write;
+  int availableForWrite() override {return (int) (SectorPipeline::SIZE - tx_.Buffered());}
+  //Send everything, blocks while stopped
+  void flush() override;
+
+  //Send what the UART and the host take without blocking
+  void Pump() {tx_.Pump();}
+
+  //The transmit ring, for a SectorStream that pumps it while the controller is busy
+  SectorPipeline &Pipeline() {return tx_;}
+
+  //Stream, without flow control bytes. available() also sends queued output
+  int available() override;
+  int read() override;
+  int peek() override;
+
+  private:
+  //The UART below the transmit ring, with flow control: no room while stopped, write() waits
+  class Uart : public Print
+  {
+    public:
+    Uart(SerialTransport &transport) : transport_(transport) {}
+    size_t write(uint8_t val) override;
+    using Print::write;
+    int availableForWrite() override;
+
+    private:
+    SerialTransport &transport_;
+  };
+
+  //Move received bytes to the receive buffer, handling XON/XOFF
+  void PollInput();
+
+  HardwareSerial &serial_;
+  unsigned long baud_;
+  FlowControl flow_;
+  bool stopped_;
+  uint8_t rxBuffer_[PRIAMSMART_TRANSPORT_RXBUFFER];
+  uint8_t rxHead_;
+  uint8_t rxCount_;
+  Uart uart_;
+  SectorPipeline tx_;
+};
+
+}
@@ -1,15 +1,20 @@
 #include "Arduino.h"
 #include "PriamSmartInterface.h"
 #include "PriamHighlevelCommands.h"
+#if PRIAMSMART_EEPROM
+#include <EEPROM.h>
+#endif
 
 
 using namespace Priam;
 
-const uint8_t PriamSmart::DBUS0_7_Pins[8]  = {DBUS0, DBUS1, DBUS2, DBUS3, DBUS4, DBUS5, DBUS6, DBUS7};
-const uint8_t PriamSmart::ADBUS0_3_Pins[3]  = {AD0, AD1, AD2};
+const uint8_t PriamSmart::DBUS0_7_Pins[8]  = {Board::Dbus(0), Board::Dbus(1), Board::Dbus(2), Board::Dbus(3),
+                                              Board::Dbus(4), Board::Dbus(5), Board::Dbus(6), Board::Dbus(7)};
+const uint8_t PriamSmart::ADBUS0_3_Pins[3]  = {Board::Addr(0), Board::Addr(1), Board::Addr(2)};
 
 PriamSmart::PriamSmart() :
-state_(PriamSmart::state::NOTOPEN), resultRegisters_{0}
+busDelaySetup_(DEFAULT_BUSDELAY_SETUP), busDelayPulse_(DEFAULT_BUSDELAY_PULSE),
+state_(PriamSmart::state::NOTOPEN), fastBus_(PRIAMSMART_FASTBUS && Board::FASTBUS), dtreqHandshake_(PRIAMSMART_DTREQ), dtreqValidated_(false), dataBlockSize_(0), resetCount_(0), resultRegisters_{0}
 {
   //Constructor
   //This is called too early to setup ports, arduino init will overwrite it
@@ -20,14 +25,15 @@ bool PriamSmart::AssertReset()
 {
   if (state_ == PriamSmart::state::RESETHOLD)
   {
-    Serial.println(F("Assert reset: already in reset hold state!"));
+    PRIAM_LOGERROR(EVT_RESETHOLD, F("Assert reset: already in reset hold state!"));
     return false;
   }
 
-  digitalWrite(RESETLINE, LOW);    // hold interface in reset
-  pinMode(RESETLINE, OUTPUT); //D13 reset line active low
+  digitalWrite(Board::RESETLINE, LOW);    // hold interface in reset
+  pinMode(Board::RESETLINE, OUTPUT); //reset line active low
   
   state_ = PriamSmart::state::RESETHOLD;
+  resetCount_++;
   return true;
 }
 
@@ -35,13 +41,13 @@ bool PriamSmart::ReleaseFromReset()
 {
   if (state_ != PriamSmart::state::RESETHOLD)
   {
-    Serial.println(F("Release from reset: wrong state"));
+    PRIAM_LOGERROR(EVT_RESETSTATE, F("Release from reset: wrong state"));
     return false;
   }
 
-  //digitalWrite(RESETLINE, 1);
+  //digitalWrite(Board::RESETLINE, 1);
   
-  pinMode(RESETLINE, INPUT); //Reset HIGHZ
+  pinMode(Board::RESETLINE, INPUT); //Reset HIGHZ
 
   state_ = PriamSmart::state::WAITBUSREADY;
   return true;
@@ -67,7 +73,7 @@ void PriamSmart::WaitForDriveReady(unsigned long pausebetweenTries_ms, unsigned
     tryCount++;
     if (tryCount > maxtriesBeforeReset && maxtriesBeforeReset != 0)
     {
-      Serial.println(F("Max tries waiting for drive ready exceeded, resetting interface.."));
+      PRIAM_LOGWARN(EVT_DRIVEREADYRESET, F("Max tries waiting for drive ready exceeded, resetting interface.."));
       PulseReset();
       tryCount = 0;
     }
@@ -82,13 +88,12 @@ PriamSmart::state PriamSmart::GetState()
     //If we are waiting for ready, check if interface ready now
     case PriamSmart::state::WAITBUSREADY:
     {
-      uint8_t enastate = (uint8_t) digitalRead(DBUSENA);
-      Serial.print(F("Waiting for interface ready, DBUSENA is "));
-      Serial.println(enastate);
+      uint8_t enastate = (uint8_t) digitalRead(Board::DBUSENA);
+      PRIAM_LOGINFO(EVT_WAITBUSREADY, F("Waiting for interface ready, DBUSENA is"), enastate);
       if (!enastate)
       {
         state_ = PriamSmart::state::WAITINITIALCOMPREQ;
-        Serial.println(F("Interface is ready, waiting for initial completion request"));
+        PRIAM_LOGINFO(EVT_BUSREADY, F("Interface is ready, waiting for initial completion request"));
         //delay(5000); //wait for interface to settle
       }
     }
@@ -97,7 +102,7 @@ PriamSmart::state PriamSmart::GetState()
     //If we are waiting for initial completion request, wait foer it with timeout
     case PriamSmart::state::WAITINITIALCOMPREQ:
     {
-        Serial.println(F("Wait for initial completion request..."));
+        PRIAM_LOGINFO(EVT_WAITINITIALCOMPREQ, F("Wait for initial completion request..."));
 
         //If the controller is in the power-up or reset state, it will issue an initial comppletion request
         //Wait at most 5 seconds for the request
@@ -108,18 +113,19 @@ PriamSmart::state PriamSmart::GetState()
         
         if (!stat.CompletionRequest())
         {
-          Serial.print(F("No completion request, status is 0x"));
-          Serial.println(stat.GetRawStatusVal(), HEX);
-          
+          PRIAM_LOGINFO(EVT_NOINITIALCOMPREQ, F("No completion request, status is"), stat.GetRawStatusVal());
         }
         else
         {
-          Serial.print(F("Completion request, status is 0x"));
-          Serial.println(stat.GetRawStatusVal(), HEX);
-          Serial.println(F("Acknowledge initial completion request"));
+          PRIAM_LOGINFO(EVT_INITIALCOMPREQ, F("Completion request, acknowledging. Status is"), stat.GetRawStatusVal());
           CompletionAcknowledge();
           state_ = PriamSmart::state::READY;
-          Serial.println(F("Initialization complete"));
+          PRIAM_LOGINFO(EVT_INITDONE, F("Initialization complete"));
+
+          //No command runs, DTREQ must be released. Validated again on the first data phase
+          dtreqValidated_ = false;
+          if (dtreqHandshake_ && DataRequestLine())
+            DtreqHandshakeFailed(stat.GetRawStatusVal());
         }
     }
       break;
@@ -151,18 +157,20 @@ bool PriamSmart::Open(bool holdInReset)
     
 
   //Reset line  
-  pinMode(RESETLINE, INPUT); //Reset line HighZ
+  pinMode(Board::RESETLINE, INPUT); //Reset line HighZ
   
 
-  pinMode(DTREQ, INPUT); //A1 DTREQ
-  pinMode(DBUSENA, INPUT); //A0 DUSENA
-  pinMode(16, INPUT); //A2 not used
+  pinMode(Board::DTREQ, INPUT);
+  pinMode(Board::DBUSENA, INPUT);
   
-  digitalWrite(HRD, HIGH);
-  pinMode(HRD, OUTPUT); //17 A3 HRD
+  digitalWrite(Board::HRD, HIGH);
+  pinMode(Board::HRD, OUTPUT);
+
+  digitalWrite(Board::HWR, HIGH);
+  pinMode(Board::HWR, OUTPUT);
 
-  digitalWrite(HWR, HIGH);
-  pinMode(HWR, OUTPUT); //18 A4 HWR
+  //Use calibrated bus timing if there is one
+  LoadBusTiming();
   
   state_ = PriamSmart::state::WAITBUSREADY;
 
@@ -202,7 +210,7 @@ bool PriamSmart::SetGenericBusValue(const uint8_t * pins, uint8_t numpins, uint8
   //Check if value ok for number of pins
   if (value >= (1 << numpins))
   {
-    Serial.print(F("SetGenericBusValue value too large for bus size\n"));
+    PRIAM_LOGERROR(EVT_BUSVALUE, F("SetGenericBusValue value too large for bus size"));
     return false;
   }
 
@@ -264,6 +272,24 @@ bool PriamSmart::OutputADDRBUSValue(uint8_t val)
 }
 
 bool PriamSmart::RegisterRead(PriamSmart::ReadRegister address, uint8_t &value)
+{
+#if PRIAMSMART_FASTBUS
+  if (fastBus_)
+    return FastRegisterRead(address, value);
+#endif
+  return GenericRegisterRead(address, value);
+}
+
+bool PriamSmart::RegisterWrite(PriamSmart::WriteRegister address, uint8_t value)
+{
+#if PRIAMSMART_FASTBUS
+  if (fastBus_)
+    return FastRegisterWrite(address, value);
+#endif
+  return GenericRegisterWrite(address, value);
+}
+
+bool PriamSmart::GenericRegisterRead(PriamSmart::ReadRegister address, uint8_t &value)
 {
   //Bus mode should already be input, but jusţ in case
   SetDBUSMode(INPUT);
@@ -277,14 +303,14 @@ bool PriamSmart::RegisterRead(PriamSmart::ReadRegister address, uint8_t &value)
   SetupDelay();
 
   //Assert HRD, wait
-  digitalWrite(HRD, 0);
+  digitalWrite(Board::HRD, 0);
   PulseDelay();
 
   //Read the bus
   ReadDBUSValue(value);
 
   //Deassert HRD
-  digitalWrite(HRD, 1);
+  digitalWrite(Board::HRD, 1);
 
   //And address bus back to input
   SetADDRBUSMode(INPUT);
@@ -292,7 +318,7 @@ bool PriamSmart::RegisterRead(PriamSmart::ReadRegister address, uint8_t &value)
   return true;
 }
 
-bool PriamSmart::RegisterWrite(PriamSmart::WriteRegister address, uint8_t value)
+bool PriamSmart::GenericRegisterWrite(PriamSmart::WriteRegister address, uint8_t value)
 {
   //First output the address
   //OutputADDRBUSValue will put the address bus in output mode
@@ -308,9 +334,9 @@ bool PriamSmart::RegisterWrite(PriamSmart::WriteRegister address, uint8_t value)
   SetupDelay();
   
   //HWR pulse
-  digitalWrite(HWR, 0);
+  digitalWrite(Board::HWR, 0);
   PulseDelay();
-  digitalWrite(HWR, 1);
+  digitalWrite(Board::HWR, 1);
 
   //Address bus back to input
   SetADDRBUSMode(INPUT);
@@ -321,6 +347,321 @@ bool PriamSmart::RegisterWrite(PriamSmart::WriteRegister address, uint8_t value)
   return true;
 }
 
+#if PRIAMSMART_FASTBUS
+//The fast bus does the same sequence as the generic one, but each step is a single port access
+//Port layout from the board descriptor, see FastBus in PriamBoard.h
+bool PriamSmart::FastRegisterRead(PriamSmart::ReadRegister address, uint8_t &value)
+{
+  typedef FastBus<Board> Bus;
+
+  //Bus mode should already be input, but just in case
+  Bus::DataInput();
+
+  //Output the address
+  Bus::AddrOutput(address);
+
+  //make sure address is stable before asserting HRD, minimum 60ns
+  SetupDelay();
+
+  //Assert HRD, wait
+  Bus::HrdAssert();
+  PulseDelay();
+
+  //Read the bus
+  value = Bus::DataRead();
+
+  //Deassert HRD
+  Bus::HrdRelease();
+
+  //And address bus back to input
+  Bus::AddrInput();
+
+  return true;
+}
+
+bool PriamSmart::FastRegisterWrite(PriamSmart::WriteRegister address, uint8_t value)
+{
+  typedef FastBus<Board> Bus;
+
+  //Output the address
+  Bus::AddrOutput(address);
+
+  //Output the data
+  Bus::DataOutput(value);
+
+  //make sure address and data are stable before asserting HWR, minimum 60ns
+  SetupDelay();
+
+  //HWR pulse
+  Bus::HwrAssert();
+  PulseDelay();
+  Bus::HwrRelease();
+
+  //Address bus back to input
+  Bus::AddrInput();
+
+  //Databus back to input
+  Bus::DataInput();
+
+  return true;
+}
+#endif
+
+bool PriamSmart::UseFastBus(bool enable)
+{
+#if PRIAMSMART_FASTBUS
+  if (!Board::FASTBUS)
+  {
+    fastBus_ = false;
+    return !enable;
+  }
+  fastBus_ = enable;
+  return true;
+#else
+  fastBus_ = false;
+  return !enable;
+#endif
+}
+
+void PriamSmart::DtreqHandshakeFailed(uint8_t status)
+{
+  (void) status;
+  PRIAM_LOGWARN(EVT_DTREQFAILED, F("DTREQ does not follow the status register, data phase handshake turned off. Status is"), status);
+  dtreqHandshake_ = false;
+  dtreqValidated_ = false;
+}
+
+void PriamSmart::DtreqHandshakeValid()
+{
+  PRIAM_LOGINFO(EVT_DTREQVALID, F("DTREQ follows the status register, data phase on DTREQ handshake"));
+  dtreqValidated_ = true;
+}
+
+static const uint8_t BUSTIMING_MAGIC0 = 'P';
+static const uint8_t BUSTIMING_MAGIC1 = 'T';
+
+bool PriamSmart::LoadBusTiming()
+{
+#if PRIAMSMART_EEPROM
+  uint8_t setup = EEPROM.read(EEPROM_BUSTIMING + 2);
+  uint8_t pulse = EEPROM.read(EEPROM_BUSTIMING + 3);
+
+  if (EEPROM.read(EEPROM_BUSTIMING) != BUSTIMING_MAGIC0 || EEPROM.read(EEPROM_BUSTIMING + 1) != BUSTIMING_MAGIC1)
+    return false;
+
+  if (EEPROM.read(EEPROM_BUSTIMING + 4) != (uint8_t) (setup ^ pulse ^ 0xA5))
+    return false;
+
+  SetBusDelays(setup, pulse);
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool PriamSmart::SaveBusTiming()
+{
+#if PRIAMSMART_EEPROM
+  EEPROM.update(EEPROM_BUSTIMING, BUSTIMING_MAGIC0);
+  EEPROM.update(EEPROM_BUSTIMING + 1, BUSTIMING_MAGIC1);
+  EEPROM.update(EEPROM_BUSTIMING + 2, busDelaySetup_);
+  EEPROM.update(EEPROM_BUSTIMING + 3, busDelayPulse_);
+  EEPROM.update(EEPROM_BUSTIMING + 4, (uint8_t) (busDelaySetup_ ^ busDelayPulse_ ^ 0xA5));
+  return true;
+#else
+  return false;
+#endif
+}
+
+bool PriamSmart::TimingTestSeek(uint8_t driveno, uint16_t cylinder, unsigned long timeout_ms)
+{
+  uint8_t testSetup = busDelaySetup_;
+  uint8_t testPulse = busDelayPulse_;
+  uint8_t reg1, reg2;
+  uint8_t res0, res1, res2;
+  InterfaceStatus ifStatus;
+
+  HeadAndCylinderParamHelper headAndCyl(0, cylinder);
+  headAndCyl.ToRegisters(reg1, reg2);
+
+  //Parameters at the timing under test
+  RegisterWrite(PriamSmart::WriteRegister::PARAM0, driveno);
+  RegisterWrite(PriamSmart::WriteRegister::PARAM1, reg1);
+  RegisterWrite(PriamSmart::WriteRegister::PARAM2, reg2);
+
+  //Command with default timing, a corrupted command code could be anything
+  SetBusDelays(DEFAULT_BUSDELAY_SETUP, DEFAULT_BUSDELAY_PULSE);
+  RegisterWrite(PriamSmart::WriteRegister::COMMAND, PriamCommandsByteValues::SEEKWITHRETRY);
+  SetBusDelays(testSetup, testPulse);
+
+  unsigned long start = millis();
+  do
+  {
+    if (!GetInterfaceStatus(ifStatus) || ifStatus.CommandRejected())
+      return false;
+
+    if (millis() - start > timeout_ms)
+      return false;
+
+  } while (!ifStatus.CompletionRequest());
+
+  RegisterRead(PriamSmart::ReadRegister::RESULT0, res0);
+  RegisterRead(PriamSmart::ReadRegister::RESULT1, res1);
+  RegisterRead(PriamSmart::ReadRegister::RESULT2, res2);
+
+  SetBusDelays(DEFAULT_BUSDELAY_SETUP, DEFAULT_BUSDELAY_PULSE);
+  CompletionAcknowledge();
+  SetBusDelays(testSetup, testPulse);
+
+  ResultCylinder res(res0, res1, res2, false);
+  return !res.GetStatus().IsErrorStatus() && res.GetStatus().Drive() == driveno && res.Cylinder() == cylinder;
+}
+
+bool PriamSmart::TestBusTiming(uint8_t driveno, uint16_t cylinders, uint8_t expectedStatus)
+{
+  //Status reads, the interface is idle so the value must not change
+  for (uint8_t i = 0; i < 32; i++)
+  {
+    uint8_t val;
+    if (!RegisterRead(PriamSmart::ReadRegister::IFACESTATUS, val) || val != expectedStatus)
+      return false;
+  }
+
+  //Seeks to cylinders with alternating and walking bit patterns in the parameter and result registers
+  const uint16_t patterns[] = {0x555, 0xAAA, 0x0FF, 0xF00, 0x001, 0x000};
+  for (uint8_t i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++)
+  {
+    uint16_t cyl = (uint16_t) (patterns[i] % cylinders);
+    if (!TimingTestSeek(driveno, cyl, 2000))
+      return false;
+  }
+
+  return true;
+}
+
+void PriamSmart::RecoverAfterTimingTest()
+{
+  InterfaceStatus stat;
+
+  SetBusDelays(DEFAULT_BUSDELAY_SETUP, DEFAULT_BUSDELAY_PULSE);
+
+  unsigned long start = millis();
+  while (millis() - start < 3000)
+  {
+    if (!GetInterfaceStatus(stat))
+      break;
+
+    if (stat.ReadyForCommand())
+      return;
+
+    if (stat.CompletionRequest())
+      CompletionAcknowledge();
+  }
+
+  PRIAM_LOGWARN(EVT_TIMINGSTUCK, F("Bus timing test: interface stuck, resetting"));
+  PulseReset();
+  WaitForDriveReady(100, 50);
+}
+
+bool PriamSmart::CalibrateBusTiming(uint8_t driveno, uint8_t marginPercent)
+{
+  uint8_t oldSetup = busDelaySetup_;
+  uint8_t oldPulse = busDelayPulse_;
+  InterfaceStatus idleStatus;
+
+  if (GetState() != READY)
+  {
+    PRIAM_LOGERROR(EVT_CALNOTREADY, F("Calibrate: Interface not ready!"));
+    return false;
+  }
+
+  //Reference at default timing
+  SetBusDelays(DEFAULT_BUSDELAY_SETUP, DEFAULT_BUSDELAY_PULSE);
+
+  DriveParam drive(driveno);
+  DriveCmd_ReadParams rdpCmd;
+  ResultDriveParams params = rdpCmd.Execute(*this, drive);
+
+  if (params.GetStatus().CommsError() || params.GetStatus().IsErrorStatus() || !params.Cylinders() ||
+      !GetInterfaceStatus(idleStatus) || !idleStatus.ReadyForCommand() ||
+      !TestBusTiming(driveno, params.Cylinders(), idleStatus.GetRawStatusVal()))
+  {
+    PRIAM_LOGERROR(EVT_CALNODRIVE, F("Calibrate: drive not usable at default timing, is it spun up? Drive"), driveno);
+    SetBusDelays(oldSetup, oldPulse);
+    return false;
+  }
+
+  //Step pulse length down with default setup time, then setup time with the pulse length found
+  uint8_t pulse = DEFAULT_BUSDELAY_PULSE;
+  while (pulse > 0)
+  {
+    SetBusDelays(DEFAULT_BUSDELAY_SETUP, (uint8_t) (pulse - 1));
+    if (!TestBusTiming(driveno, params.Cylinders(), idleStatus.GetRawStatusVal()))
+    {
+      RecoverAfterTimingTest();
+      break;
+    }
+    pulse--;
+  }
+
+  uint8_t setup = DEFAULT_BUSDELAY_SETUP;
+  while (setup > 0)
+  {
+    SetBusDelays((uint8_t) (setup - 1), pulse);
+    if (!TestBusTiming(driveno, params.Cylinders(), idleStatus.GetRawStatusVal()))
+    {
+      RecoverAfterTimingTest();
+      break;
+    }
+    setup--;
+  }
+
+  PRIAM_LOGINFO(EVT_CALSETUP, F("Calibrate: shortest working setup delay"), setup);
+  PRIAM_LOGINFO(EVT_CALPULSE, F("Calibrate: shortest working pulse delay"), pulse);
+
+  //Safety margin
+  uint16_t setupWithMargin = (uint16_t) (setup + 1 + (setup * marginPercent) / 100);
+  uint16_t pulseWithMargin = (uint16_t) (pulse + 1 + (pulse * marginPercent) / 100);
+  if (setupWithMargin > DEFAULT_BUSDELAY_SETUP)
+    setupWithMargin = DEFAULT_BUSDELAY_SETUP;
+  if (pulseWithMargin > DEFAULT_BUSDELAY_PULSE)
+    pulseWithMargin = DEFAULT_BUSDELAY_PULSE;
+
+  SetBusDelays((uint8_t) setupWithMargin, (uint8_t) pulseWithMargin);
+
+  //Final check of the setting with margin
+  if (!TestBusTiming(driveno, params.Cylinders(), idleStatus.GetRawStatusVal()))
+  {
+    PRIAM_LOGWARN(EVT_CALMARGINFAILED, F("Calibrate: setting with margin failed, keeping default timing"));
+    RecoverAfterTimingTest();
+    return false;
+  }
+
+  SaveBusTiming();
+  return true;
+}
+
+uint32_t PriamSmart::MeasureRegisterCycleRate(uint16_t numCycles)
+{
+  uint8_t val;
+
+  if (!numCycles)
+    return 0;
+
+  unsigned long start = micros();
+  for (uint16_t i = 0; i < numCycles; i++)
+  {
+    if (!RegisterRead(PriamSmart::ReadRegister::IFACESTATUS, val))
+      return 0;
+  }
+  unsigned long elapsed = micros() - start;
+
+  if (!elapsed)
+    elapsed = 1;
+
+  return (uint32_t) ((1000000ULL * numCycles) / elapsed);
+}
+
 bool PriamSmart::CompletionAcknowledge()
 {
   return RegisterWrite(PriamSmart::WriteRegister::COMMAND, PriamCommandsByteValues::COMPLETIONACK);
@@ -332,7 +673,7 @@ bool PriamSmart::GetInterfaceStatus(InterfaceStatus& stat)
   uint8_t statusval;
   if (!RegisterRead(PriamSmart::ReadRegister::IFACESTATUS, statusval))
     {
-      Serial.println(F("Error reading Interface status register"));
+      PRIAM_LOGERROR(EVT_STATUSREADFAIL, F("Error reading Interface status register"));
       return false;
     }
 
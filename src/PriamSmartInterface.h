@@ -5,38 +5,47 @@
 #include "PriamSmartCommandResult.h"
 //#include "PriamSmartCommandResult.h"
 #include "PriamRegisters.h"
-
-//Priam Smart Interface pin assignment
-const uint8_t DBUS0 = 2;
-const uint8_t DBUS1 = 3;
-const uint8_t DBUS2 = 4;
-const uint8_t DBUS3 = 5;
-const uint8_t DBUS4 = 6;
-const uint8_t DBUS5 = 7;
-const uint8_t DBUS6 = 8;
-const uint8_t DBUS7 = 9;
-
-const uint8_t AD0 = 10;
-const uint8_t AD1 = 11;
-const uint8_t AD2 = 12;
-
-const uint8_t RESETLINE = 13;
-
-const uint8_t DTREQ = 15;
-const uint8_t DBUSENA = 14;
-
-const uint8_t HRD = 17;
-const uint8_t HWR = 18;
+#include "PriamDataSink.h"
+#include "PriamTransactionStats.h"
+#include "PriamEepromLayout.h"
+#include "PriamBoard.h"
+#include "PriamLog.h"
+
+#if defined(__AVR__)
+#include <util/delay_basic.h>
+#endif
+
+//The pin assignment is the board descriptor selected with PRIAMSMART_BOARD, see PriamBoard.h
+
+//Direct port register bus access (fast bus)
+//Built on AVR, used when the board descriptor port layout is valid for the CPU (FASTBUS)
+//Define PRIAMSMART_FASTBUS 0 to force the portable digitalWrite/digitalRead bus
+#ifndef PRIAMSMART_FASTBUS
+#if defined(__AVR__)
+#define PRIAMSMART_FASTBUS 1
+#else
+#define PRIAMSMART_FASTBUS 0
+#endif
+#endif
+
+//Data phase handshake on the DTREQ line, off by default: every data byte waits for a status register read
+//Define PRIAMSMART_DTREQ 1 if DTREQ is connected, see PriamSmart::UseDtreqHandshake
+#ifndef PRIAMSMART_DTREQ
+#define PRIAMSMART_DTREQ 0
+#endif
 
 namespace Priam
 {
 
-
+template <int NUMPARAMS, int NUMRETURNREGS, class SINK> class Transaction;
 
 class PriamSmart
 {
 
 public:
+
+  //Pin assignment
+  typedef PRIAMSMART_BOARD Board;
   
   //Our state
   enum state {NOTOPEN, RESETHOLD, WAITBUSREADY, WAITINITIALCOMPREQ, READY};
@@ -99,11 +108,20 @@ public:
   bool ReleaseFromReset(); 
   //Pulse reset line, duration of pulse as parameter
   virtual bool PulseReset(unsigned long pulseLength_ms = 100);
+  //Counts AssertReset() calls, wraps. Anything cached from the drives is stale when it changed
+  uint8_t ResetCount() {return resetCount_;}
   
   //Execute complete transaction on the interface, templated on number of of parameters and number of return registers
+  //Blocks until the transaction has finished, see Transaction below for the non-blocking version
+  //Data read during the transaction is discarded, data written is 0
   template <int NUMPARAMS, int NUMRETURNREGS>
   RegisterValues<NUMRETURNREGS> TransactNew(CommandInfo<NUMPARAMS, NUMRETURNREGS> cmdInfo, const RegisterValues<NUMPARAMS> &parameters);
 
+  //Execute complete transaction on the interface, data phase bytes are passed to/taken from sink
+  //See PriamDataSink.h for the SINK requirements
+  template <int NUMPARAMS, int NUMRETURNREGS, class SINK>
+  RegisterValues<NUMRETURNREGS> TransactNew(CommandInfo<NUMPARAMS, NUMRETURNREGS> cmdInfo, const RegisterValues<NUMPARAMS> &parameters, SINK &sink);
+
 
   //Read a Smart Interface register
   //Sets HAD, pulses HRD HRD and reads HCBUS. Returns to HAD HIGHZ status when done
@@ -119,6 +137,62 @@ public:
   //Get Transaction status as a TransactionStatus object
   bool GetTransactionStatus(TransactionStatus& stat);
 
+  //Select the bus backend used by RegisterRead/RegisterWrite
+  //true = direct port registers, false = pin by pin digitalWrite/digitalRead
+  //Returns false if the fast bus is not available on this board
+  bool UseFastBus(bool enable);
+
+  //Check which bus backend is in use
+  bool FastBusEnabled() {return fastBus_;}
+
+  //Data phase handshake: after each data register access the DTREQ line is checked, while it stays
+  //asserted the next byte is transferred without reading the status register first, up to the end of the
+  //sector (see SetDataBlockSize). The status register is read again at every sector boundary and at completion
+  //DTREQ is not trusted at once: the first sector after the interface is ready or the handshake is turned on
+  //is read byte by byte with the status register, and DTREQ must follow it. The handshake turns itself off if
+  //it does not, or if DTREQ is asserted while no command runs (line not connected or wrong DTREQ_ACTIVE level
+  //in the board descriptor)
+  void UseDtreqHandshake(bool enable) {dtreqHandshake_ = enable; dtreqValidated_ = false;}
+  bool DtreqHandshakeEnabled() {return dtreqHandshake_;}
+  //DTREQ followed the status register for a whole sector, data bursts are on
+  bool DtreqHandshakeValidated() {return dtreqHandshake_ && dtreqValidated_;}
+
+  //Bytes per sector of the following data commands, DTREQ bursts end at sector boundaries
+  //0 if unknown, every byte then waits for a status register read
+  void SetDataBlockSize(uint16_t bytes) {dataBlockSize_ = bytes;}
+
+  //Per command and phase latency histograms of all transactions
+  TransactionStats &GetStats() {return stats_;}
+
+  //Bus timing
+  //Delays are in units of 4 CPU cycles on AVR (250 ns at 16 MHz), on other boards they are rounded up to whole microseconds
+  uint8_t BusDelaySetup() {return busDelaySetup_;}
+  uint8_t BusDelayPulse() {return busDelayPulse_;}
+  void SetBusDelays(uint8_t setup, uint8_t pulse) {busDelaySetup_ = setup; busDelayPulse_ = pulse;}
+
+  //Load bus timing from EEPROM, keeps the current values and returns false if none stored
+  //Called by Open()
+  bool LoadBusTiming();
+
+  //Store the current bus timing in EEPROM
+  bool SaveBusTiming();
+
+  //Find the shortest reliable bus delays and store them in EEPROM
+  //Steps the delays down from the defaults, verifying status reads and seek parameter writes/result reads
+  //at each step, then adds margin (in percent, at least one unit) to the shortest working setting
+  //Interface must be READY and driveno spun up. Commands are always issued with the default timing,
+  //so a failing step can only corrupt seek parameters and reads, not the command code
+  //Returns false and keeps the current timing if the drive could not be used
+  bool CalibrateBusTiming(uint8_t driveno, uint8_t marginPercent = 50);
+
+  //Default bus delays: 1us setup, 5us pulse
+  static const uint8_t DEFAULT_BUSDELAY_SETUP = 4;
+  static const uint8_t DEFAULT_BUSDELAY_PULSE = 20;
+
+  //Measure bus speed: do numCycles IFACESTATUS register reads and return register cycles per second
+  //Returns 0 on error
+  uint32_t MeasureRegisterCycleRate(uint16_t numCycles);
+
   private:
   
   //Helper routine, set mode on a "bus" passed as an array of arduino pins. First element of array is LSB
@@ -148,14 +222,64 @@ public:
   //Output val on HAD. Changes HAD mode to OUTPUT
   bool OutputADDRBUSValue(uint8_t val);
 
-  //Delay before pulsing HWR/HRD, determined by constant BUSDELAY_SETUP
-  void SetupDelay() {delayMicroseconds(BUSDELAY_SETUP);}
+  //Delay before pulsing HWR/HRD, determined by busDelaySetup_
+  void SetupDelay() {BusDelay(busDelaySetup_);}
+
+  //Delay when HWR/HRD asserted (pulse length), determined by busDelayPulse_
+  void PulseDelay() {BusDelay(busDelayPulse_);}
+
+  static void BusDelay(uint8_t units)
+  {
+    if (!units)
+      return;
+#if defined(__AVR__)
+    _delay_loop_2(units);
+#else
+    delayMicroseconds((unsigned int) ((units + 3) / 4));
+#endif
+  }
 
-  //Delay when HWR/HRD asserted (pulse length), determined by constant BUSDELAY_PULSE
-  void PulseDelay() {delayMicroseconds(BUSDELAY_PULSE);}
+  //One bus timing test step: status reads at the current timing, then seeks to each test cylinder
+  //with parameters written and results read at the current timing
+  bool TestBusTiming(uint8_t driveno, uint16_t cylinders, uint8_t expectedStatus);
+
+  //Seek used by TestBusTiming, command and acknowledge written with default timing. Times out after timeout_ms
+  bool TimingTestSeek(uint8_t driveno, uint16_t cylinder, unsigned long timeout_ms);
+
+  //Get the interface back to ready for command after a failed timing test
+  void RecoverAfterTimingTest();
 
   //Acknowledge end of operation
   bool CompletionAcknowledge();
+
+  //DTREQ line sampled a setup delay after the last bus cycle, true if the interface requests a data transfer
+  bool DataRequestLine()
+  {
+    SetupDelay();
+#if PRIAMSMART_FASTBUS
+    if (fastBus_)
+      return FastBus<Board>::DtreqAsserted();
+#endif
+    return digitalRead(Board::DTREQ) == Board::DTREQ_ACTIVE;
+  }
+
+  //DTREQ did not follow the status register, value: status register
+  void DtreqHandshakeFailed(uint8_t status);
+
+  //DTREQ followed the status register for a whole sector
+  void DtreqHandshakeValid();
+
+  template <int NUMPARAMS, int NUMRETURNREGS, class SINK> friend class Transaction;
+
+  //Pin by pin register access, used when the fast bus is not available or disabled
+  bool GenericRegisterRead(PriamSmart::ReadRegister address, uint8_t &value);
+  bool GenericRegisterWrite(PriamSmart::WriteRegister address, uint8_t value);
+
+#if PRIAMSMART_FASTBUS
+  //Port register access
+  bool FastRegisterRead(PriamSmart::ReadRegister address, uint8_t &value);
+  bool FastRegisterWrite(PriamSmart::WriteRegister address, uint8_t value);
+#endif
   
 
 //Helper variable for setting DBUS
@@ -165,10 +289,10 @@ public:
   static const uint8_t ADBUS0_3_Pins[3];
 
   //Delay to use before asserting HWR or HRD
-  static const uint8_t BUSDELAY_SETUP = 1;
+  uint8_t busDelaySetup_;
 
   //Delay to use for HWR/HRD pulse length
-  static const uint8_t BUSDELAY_PULSE = 5;
+  uint8_t busDelayPulse_;
 
   
 
@@ -176,114 +300,292 @@ public:
 //Our State
   state state_;
 
+  //Bus backend selection
+  bool fastBus_;
+
+  //Data phase handshake on DTREQ
+  bool dtreqHandshake_;
+  bool dtreqValidated_;
+  uint16_t dataBlockSize_;
+
+  uint8_t resetCount_;
+
+  //Transaction latency statistics
+  TransactionStats stats_;
+
   uint8_t resultRegisters_[6];
         
 
 };
 
 
-template <int NUMPARAMS, int NUMRETURNREGS>
-RegisterValues<NUMRETURNREGS> PriamSmart::TransactNew(CommandInfo<NUMPARAMS, NUMRETURNREGS> cmdInfo , const RegisterValues<NUMPARAMS> &parameters)
+//Non-blocking transaction
+//Begin() checks the interface, each Poll() then does as much as can be done without waiting for the
+//controller and returns true once the transaction has finished. Call Poll() from loop() and do other work
+//in between. Finish() polls until the end and returns the result registers (invalid on a comms error)
+//The data phase is passed to/taken from sink, see PriamDataSink.h
+//callback, if not nullptr, is called from Poll() when the transaction finishes
+//TransactionBase allows polling transactions of any command type through one pointer
+class TransactionBase
 {
-  InterfaceStatus stat;
-  uint8_t errRegvals[NUMRETURNREGS] = {0};
-  RegisterValues<NUMRETURNREGS> errorReturn(errRegvals, false);
-  
-  
-  if (GetState() != READY)
+  public:
+  enum Step {IDLE, WAITREADY, RUNNING, DONE, FAILED};
+
+  typedef void (*DoneCallback)(TransactionStatus status, void *context);
+
+  TransactionBase(DoneCallback callback, void *context) : step_(IDLE), callback_(callback), context_(context) {}
+  virtual ~TransactionBase() {}
+
+  virtual bool Poll() = 0;
+
+  Step GetStep() {return step_;}
+  bool Finished() {return step_ == DONE || step_ == FAILED;}
+
+  protected:
+  void Done(Step step, uint8_t statusRegVal)
   {
-    Serial.println(F("Transact: Interface not ready!"));
-    return errorReturn;
+    step_ = step;
+    if (callback_)
+      callback_(TransactionStatus(statusRegVal, step == FAILED), context_);
   }
 
-  if (!GetInterfaceStatus(stat))
-    return errorReturn;
+  Step step_;
 
-  while (!stat.ReadyForCommand())
+  private:
+  DoneCallback callback_;
+  void *context_;
+};
+
+template <int NUMPARAMS, int NUMRETURNREGS, class SINK>
+class Transaction : public TransactionBase
+{
+  public:
+  Transaction(PriamSmart &interface, CommandInfo<NUMPARAMS, NUMRETURNREGS> cmdInfo, const RegisterValues<NUMPARAMS> &parameters,
+              SINK &sink, DoneCallback callback = nullptr, void *context = nullptr) :
+  TransactionBase(callback, context), interface_(interface), cmdInfo_(cmdInfo), parameters_(parameters), sink_(sink),
+  bytesTransferred_(0), blockSize_(0), lastWasData_(false), results_{0} {}
+
+  //Returns false if the interface is not ready, the transaction has then failed
+  //A finished transaction can be started again with Begin()
+  bool Begin();
+
+  //Start again with new parameters
+  bool Begin(const RegisterValues<NUMPARAMS> &parameters) {parameters_ = parameters; return Begin();}
+
+  //Returns true when the transaction is finished
+  bool Poll();
+
+  //Poll until finished, returns the result registers
+  //sink.Idle() is called between polls
+  RegisterValues<NUMRETURNREGS> Finish()
   {
-    Serial.print(F("Transact: Interface not ready for command! Interface status: 0x"));
-    Serial.println(stat.GetRawStatusVal(), HEX);
+    while (!Poll())
+      sink_.Idle();
+    return RegisterValues<NUMRETURNREGS>(results_, step_ == DONE);
+  }
+
+  private:
+  bool PollWaitReady();
+  bool PollRunning();
+  bool Fail() {Done(FAILED, 0); return true;}
+
+  //Bytes of the data phase transferred on DTREQ without a status register read: the rest of the sector,
+  //or 1 while DTREQ is not validated
+  uint16_t BurstBytes()
+  {
+    if (!interface_.DtreqHandshakeValidated() || !blockSize_)
+      return 1;
+    return (uint16_t) (blockSize_ - bytesTransferred_ % blockSize_);
+  }
+
+  PriamSmart &interface_;
+  CommandInfo<NUMPARAMS, NUMRETURNREGS> cmdInfo_;
+  RegisterValues<NUMPARAMS> parameters_;
+  SINK &sink_;
+  TransactionTimer timer_;
+  uint32_t bytesTransferred_;
+  uint16_t blockSize_;
+  bool lastWasData_;
+  uint8_t results_[NUMRETURNREGS];
+};
+
+template <int NUMPARAMS, int NUMRETURNREGS, class SINK>
+bool Transaction<NUMPARAMS, NUMRETURNREGS, SINK>::Begin()
+{
+  timer_ = TransactionTimer();
+  bytesTransferred_ = 0;
+  blockSize_ = interface_.dataBlockSize_;
+  lastWasData_ = false;
+
+  if (interface_.GetState() != PriamSmart::READY)
+  {
+    PRIAM_LOGERROR(EVT_NOTREADY, F("Transact: Interface not ready!"));
+    Fail();
+    return false;
+  }
+
+  step_ = WAITREADY;
+  return true;
+}
+
+template <int NUMPARAMS, int NUMRETURNREGS, class SINK>
+bool Transaction<NUMPARAMS, NUMRETURNREGS, SINK>::Poll()
+{
+  switch (step_)
+  {
+    case IDLE:
+      if (!Begin())
+        return true;
+      return PollWaitReady();
+    case WAITREADY:
+      return PollWaitReady();
+    case RUNNING:
+      return PollRunning();
+    default:
+      return true;
+  }
+}
+
+template <int NUMPARAMS, int NUMRETURNREGS, class SINK>
+bool Transaction<NUMPARAMS, NUMRETURNREGS, SINK>::PollWaitReady()
+{
+  InterfaceStatus stat;
+
+  if (!interface_.GetInterfaceStatus(stat))
+    return Fail();
+
+  if (!stat.ReadyForCommand())
+  {
+    PRIAM_LOGDEBUG(EVT_NOTREADYFORCOMMAND, F("Transact: Interface not ready for command! Interface status:"), stat.GetRawStatusVal());
     
     if (stat.CompletionRequest())
     {
-      Serial.print(F("Transact: Interface is expecting completion ack, acking..."));
-      if (!CompletionAcknowledge())
-        return errorReturn;
+      PRIAM_LOGWARN(EVT_COMPREQACK, F("Transact: Interface is expecting completion ack, acking..."));
+      if (!interface_.CompletionAcknowledge())
+        return Fail();
     }
-    if (!GetInterfaceStatus(stat))
-      return errorReturn;
+    return false;
   }
 
+  timer_.Mark(TransactionTimer::WAITREADY);
+
   //Set parameters
   for (uint8_t i = 0; i < NUMPARAMS; i++)
   {
-    RegisterWrite((PriamSmart::WriteRegister) (PriamSmart::WriteRegister::PARAM0 + i), parameters.GetRegisterValue(i));
+    interface_.RegisterWrite((PriamSmart::WriteRegister) (PriamSmart::WriteRegister::PARAM0 + i), parameters_.GetRegisterValue(i));
   }
   
   //Issue command
-  RegisterWrite(PriamSmart::WriteRegister::COMMAND, cmdInfo.commandRegValue());
+  interface_.RegisterWrite(PriamSmart::WriteRegister::COMMAND, cmdInfo_.commandRegValue());
+
+  timer_.Mark(TransactionTimer::PARAMS);
 
-  //Serial.println(F("Command issued, wait for completion request from interface"));
+  step_ = RUNNING;
+  return PollRunning();
+}
 
-  //Read status register until done or error
+template <int NUMPARAMS, int NUMRETURNREGS, class SINK>
+bool Transaction<NUMPARAMS, NUMRETURNREGS, SINK>::PollRunning()
+{
+  //Read status register until the controller is busy, done or error
+  //A whole data phase request is serviced in one call, returns between sectors when the controller is busy
   InterfaceStatus ifStatus(0);
-  uint32_t bytesRead = 0;
   do
   {
+    if (!interface_.GetInterfaceStatus(ifStatus))
+      return Fail();
 
-    if (!GetInterfaceStatus(ifStatus))
+    if (ifStatus.CommandRejected())
     {
-      return errorReturn;
+      PRIAM_LOGERROR(EVT_REJECTED, F("The interface rejected the command"));
+      return Fail();
     }
 
-    if (ifStatus.CommandRejected())
+    //Time data phase on data request edges only, not per byte
+    if (ifStatus.TransferRequest() != lastWasData_)
     {
-      Serial.println(F("The interface rejected the command"));
-      return errorReturn;
+      lastWasData_ = !lastWasData_;
+      if (!bytesTransferred_)
+        timer_.Mark(TransactionTimer::FIRSTDATA);
+      else
+        timer_.Mark(TransactionTimer::DATA);
     }
 
-    //For now only dump bytes to serial monitor
+    //DTREQ not validated yet: it must be asserted whenever the status register requests data
+    if (ifStatus.TransferRequest() && interface_.dtreqHandshake_ && !interface_.dtreqValidated_ && !interface_.DataRequestLine())
+      interface_.DtreqHandshakeFailed(ifStatus.GetRawStatusVal());
+
+    //Data phase, pass data to/from the sink
+    //With the DTREQ handshake the rest of the sector follows back to back while DTREQ stays asserted
     if (ifStatus.ReadRequest())
     {
-      uint8_t val;
-      char tmp[8];
-      RegisterRead(PriamSmart::ReadRegister::READDISCDATA, val);
-
-      if (!bytesRead)
+      uint16_t burst = BurstBytes();
+      do
       {
-        //Serial.println(F("Drive has data!"));
-      }
-
-      if (bytesRead && !(bytesRead % 16))
-        Serial.print(F("\n"));
-      
-      sprintf(tmp, "%02X ", val);
-      Serial.print(tmp);
-      bytesRead++;
+        uint8_t val;
+        interface_.RegisterRead(PriamSmart::ReadRegister::READDISCDATA, val);
+        sink_.Put(val);
+        bytesTransferred_++;
+      } while (--burst && interface_.DataRequestLine());
+    }
+    else if (ifStatus.WriteRequest())
+    {
+      uint16_t burst = BurstBytes();
+      do
+      {
+        interface_.RegisterWrite(PriamSmart::WriteRegister::WRITEDISCDATA, sink_.Get());
+        bytesTransferred_++;
+      } while (--burst && interface_.DataRequestLine());
     }
     
-  } while (!ifStatus.CompletionRequest());
+  } while (ifStatus.TransferRequest() && !ifStatus.CompletionRequest());
 
-  if (bytesRead)
-    Serial.print("\n");
+  if (!ifStatus.CompletionRequest())
+    return false;
 
-  //Serial.println(F("Completion request signaled"));
+  timer_.Mark(TransactionTimer::COMPLETION);
+
+  //No data transfer is requested at completion, DTREQ must be released
+  //A whole sector with DTREQ following the status register validates the handshake
+  if (interface_.dtreqHandshake_)
+  {
+    if (interface_.DataRequestLine())
+      interface_.DtreqHandshakeFailed(ifStatus.GetRawStatusVal());
+    else if (!interface_.dtreqValidated_ && blockSize_ && bytesTransferred_ >= blockSize_)
+      interface_.DtreqHandshakeValid();
+  }
 
-  
   //Read result registers
-  uint8_t returnValues[NUMRETURNREGS];
   for (uint8_t i = 0; i < NUMRETURNREGS; i++)
   {
-    RegisterRead((PriamSmart::ReadRegister) (PriamSmart::ReadRegister::RESULT0 + i), returnValues[i]);
+    interface_.RegisterRead((PriamSmart::ReadRegister) (PriamSmart::ReadRegister::RESULT0 + i), results_[i]);
   }
-  RegisterValues<NUMRETURNREGS> cmdResult(returnValues, true);
+  timer_.Mark(TransactionTimer::RESULTS);
   
   //Acknowledge
-  CompletionAcknowledge();
+  interface_.CompletionAcknowledge();
+  timer_.Mark(TransactionTimer::ACK);
 
-  //Serial.println(F("Transaction complete"));
-  
-  return cmdResult;
+  interface_.GetStats().Record(cmdInfo_.commandRegValue(), timer_, bytesTransferred_);
+
+  Done(DONE, results_[0]);
+  return true;
+}
+
+template <int NUMPARAMS, int NUMRETURNREGS>
+RegisterValues<NUMRETURNREGS> PriamSmart::TransactNew(CommandInfo<NUMPARAMS, NUMRETURNREGS> cmdInfo , const RegisterValues<NUMPARAMS> &parameters)
+{
+  NullDataSink sink;
+  return TransactNew(cmdInfo, parameters, sink);
+}
+
+template <int NUMPARAMS, int NUMRETURNREGS, class SINK>
+RegisterValues<NUMRETURNREGS> PriamSmart::TransactNew(CommandInfo<NUMPARAMS, NUMRETURNREGS> cmdInfo , const RegisterValues<NUMPARAMS> &parameters, SINK &sink)
+{
+  Transaction<NUMPARAMS, NUMRETURNREGS, SINK> transaction(*this, cmdInfo, parameters, sink);
+
+  transaction.Begin();
+  return transaction.Finish();
 }
 
 
@@ -0,0 +1,164 @@
+#include "PriamTransactionStats.h"
+
+using namespace Priam;
+
+#if PRIAMSMART_STATS
+
+TransactionStats::TransactionStats()
+{
+  Reset();
+}
+
+void TransactionStats::Reset()
+{
+  memset(slots_, 0, sizeof(slots_));
+  usedSlots_ = 0;
+  dropped_ = 0;
+}
+
+uint8_t TransactionStats::Bucket(uint32_t time_us)
+{
+  uint8_t bucket = 0;
+  uint32_t limit = 16;
+
+  while (bucket < NUMBUCKETS - 1 && time_us >= limit)
+  {
+    bucket++;
+    limit <<= 2;
+  }
+
+  return bucket;
+}
+
+void TransactionStats::Record(uint8_t cmdCode, const TransactionTimer &timer, uint32_t dataBytes)
+{
+  Slot *slot = nullptr;
+
+  for (uint8_t i = 0; i < usedSlots_; i++)
+  {
+    if (slots_[i].cmdCode == cmdCode)
+    {
+      slot = &slots_[i];
+      break;
+    }
+  }
+
+  if (!slot)
+  {
+    if (usedSlots_ >= PRIAMSMART_STATS_SLOTS)
+    {
+      if (dropped_ < 0xFFFF)
+        dropped_++;
+      return;
+    }
+    slot = &slots_[usedSlots_++];
+    slot->cmdCode = cmdCode;
+  }
+
+  if (slot->transactions < 0xFFFF)
+    slot->transactions++;
+  slot->dataBytes += dataBytes;
+  uint32_t dataTime = slot->dataTime_us + timer.Time(TransactionTimer::FIRSTDATA) + timer.Time(TransactionTimer::DATA);
+  slot->dataTime_ms += dataTime / 1000;
+  slot->dataTime_us = (uint16_t) (dataTime % 1000);
+
+  if (slot->sampleSkip)
+  {
+    slot->sampleSkip--;
+    return;
+  }
+
+  uint8_t buckets[TransactionTimer::NUMPHASES];
+  bool full = false;
+  for (uint8_t phase = 0; phase < TransactionTimer::NUMPHASES; phase++)
+  {
+    buckets[phase] = Bucket(timer.Time(phase));
+    if (slot->counts[phase][buckets[phase]] == COUNTMAX)
+      full = true;
+  }
+
+  //Halve the histogram and count half as many transactions
+  if (full && slot->shift < MAXSHIFT)
+  {
+    for (uint8_t phase = 0; phase < TransactionTimer::NUMPHASES; phase++)
+      for (uint8_t b = 0; b < NUMBUCKETS; b++)
+        slot->counts[phase][b] = (Count) ((slot->counts[phase][b] + 1) >> 1);
+    slot->shift++;
+  }
+  slot->sampleSkip = (uint8_t) ((1u << slot->shift) - 1);
+
+  for (uint8_t phase = 0; phase < TransactionTimer::NUMPHASES; phase++)
+  {
+    Count &count = slot->counts[phase][buckets[phase]];
+    if (count < COUNTMAX)
+      count++;
+  }
+}
+
+void TransactionStats::Dump(Print &out)
+{
+  static const char phaseNames[TransactionTimer::NUMPHASES][12] PROGMEM = {
+    "waitready", "params", "firstdata", "data", "completion", "results", "ack"};
+
+  out.println(F("Transaction latency histograms, bucket upper limits:"));
+  out.println(F("           <16us <64us <256us <1ms <4ms <16ms <66ms <262ms <1s >=1s"));
+
+  for (uint8_t i = 0; i < usedSlots_; i++)
+  {
+    Slot &slot = slots_[i];
+
+    out.print(F("Command 0x"));
+    out.print(slot.cmdCode, HEX);
+    out.print(F(": "));
+    out.print(slot.transactions);
+    out.print(F(" transactions, "));
+    out.print(slot.dataBytes);
+    out.print(F(" data bytes in "));
+    out.print(slot.dataTime_ms);
+    out.print(F(" ms"));
+    if (slot.shift)
+    {
+      out.print(F(", counts x"));
+      out.print(1u << slot.shift);
+    }
+    out.println();
+
+    for (uint8_t phase = 0; phase < TransactionTimer::NUMPHASES; phase++)
+    {
+      out.print(F("  "));
+      out.print(reinterpret_cast<const __FlashStringHelper *>(phaseNames[phase]));
+      for (uint8_t len = (uint8_t) strlen_P(phaseNames[phase]); len < 10; len++)
+        out.print(' ');
+      for (uint8_t b = 0; b < NUMBUCKETS; b++)
+      {
+        out.print(' ');
+        out.print(slot.counts[phase][b]);
+        //Stopped counting
+        if (slot.counts[phase][b] == COUNTMAX)
+          out.print('+');
+      }
+      out.println();
+    }
+  }
+
+  if (dropped_)
+  {
+    out.print(dropped_);
+    out.println(F(" transactions not recorded, no free command slot"));
+  }
+}
+
+#else
+
+TransactionStats::TransactionStats() {}
+void TransactionStats::Reset() {}
+void TransactionStats::Record(uint8_t cmdCode, const TransactionTimer &timer, uint32_t dataBytes)
+{
+  (void) cmdCode; (void) timer; (void) dataBytes;
+}
+void TransactionStats::Dump(Print &out)
+{
+  out.println(F("Transaction statistics not compiled in (PRIAMSMART_STATS)"));
+}
+
+#endif
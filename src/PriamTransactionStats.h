@@ -0,0 +1,126 @@
+#pragma once
+#include "arduino.h"
+
+//Transaction latency statistics
+//Define PRIAMSMART_STATS 0 to compile the instrumentation out
+#ifndef PRIAMSMART_STATS
+#define PRIAMSMART_STATS 1
+#endif
+
+//Number of different command codes tracked, and the width of the histogram counters (8 or 16 bits, see
+//TransactionStats). A slot takes about 150 bytes of RAM with 16 bit counters, 80 with 8 bit counters
+//Boards with less than 2 KB of RAM get 2 slots of 8 bit counters, the others 4 of 16 bits
+#if defined(RAMEND) && RAMEND < 0x900
+#ifndef PRIAMSMART_STATS_SLOTS
+#define PRIAMSMART_STATS_SLOTS 2
+#endif
+#ifndef PRIAMSMART_STATS_COUNTBITS
+#define PRIAMSMART_STATS_COUNTBITS 8
+#endif
+#endif
+
+#ifndef PRIAMSMART_STATS_SLOTS
+#define PRIAMSMART_STATS_SLOTS 4
+#endif
+#ifndef PRIAMSMART_STATS_COUNTBITS
+#define PRIAMSMART_STATS_COUNTBITS 16
+#endif
+
+namespace Priam
+{
+
+//Per phase timing of one transaction, filled in by PriamSmart::TransactNew
+//Mark(phase) adds the time since the previous mark to phase
+class TransactionTimer
+{
+  public:
+  //Transaction phases
+  enum Phase {
+    WAITREADY = 0,    //Waiting for ReadyForCommand
+    PARAMS = 1,       //Parameter and command register writes
+    FIRSTDATA = 2,    //Command issued to first data request
+    DATA = 3,         //First to last data request, including waits between sectors
+    COMPLETION = 4,   //End of data (or command issued if no data) to completion request
+    RESULTS = 5,      //Result register reads
+    ACK = 6,          //Completion acknowledge
+    NUMPHASES = 7
+    };
+
+#if PRIAMSMART_STATS
+  TransactionTimer() : last_(micros()), times_{0} {}
+
+  void Mark(Phase phase)
+  {
+    unsigned long now = micros();
+    times_[phase] += (uint32_t) (now - last_);
+    last_ = now;
+  }
+
+  uint32_t Time(uint8_t phase) const {return times_[phase];}
+
+  private:
+  unsigned long last_;
+  uint32_t times_[NUMPHASES];
+#else
+  void Mark(Phase phase) {(void) phase;}
+  uint32_t Time(uint8_t phase) const {(void) phase; return 0;}
+#endif
+};
+
+//Fixed bucket latency histograms per command code and phase
+//Bucket i counts times below 16us * 4^i, the last bucket everything above
+//When a counter of a command is full, all its counters are halved and from then on only every second (4th,
+//8th ... up to MAXSHIFT) transaction is counted, so long runs keep the shape of the histogram. Dump() prints
+//the scale. Counters only stop at their maximum once the scale is at its limit
+class TransactionStats
+{
+  public:
+  static const uint8_t NUMBUCKETS = 10;
+
+#if PRIAMSMART_STATS_COUNTBITS == 8
+  typedef uint8_t Count;
+#else
+  typedef uint16_t Count;
+#endif
+  static const Count COUNTMAX = (Count) ~(Count) 0;
+  //Largest histogram scale, one transaction in 2^MAXSHIFT counted
+  static const uint8_t MAXSHIFT = 7;
+
+  TransactionStats();
+
+  //Add one completed transaction
+  void Record(uint8_t cmdCode, const TransactionTimer &timer, uint32_t dataBytes);
+
+  //Clear all histograms
+  void Reset();
+
+  //Print the histograms
+  void Dump(Print &out);
+
+#if PRIAMSMART_STATS
+  private:
+
+  static uint8_t Bucket(uint32_t time_us);
+
+  class Slot
+  {
+    public:
+    uint8_t cmdCode;
+    uint16_t transactions;
+    uint32_t dataBytes;
+    //Data phase time, milliseconds and the microseconds below one millisecond
+    uint32_t dataTime_ms;
+    uint16_t dataTime_us;
+    //Histogram scale: counts are of one transaction in 2^shift, sampleSkip transactions left until the next
+    uint8_t shift;
+    uint8_t sampleSkip;
+    Count counts[TransactionTimer::NUMPHASES][NUMBUCKETS];
+  };
+
+  Slot slots_[PRIAMSMART_STATS_SLOTS];
+  uint8_t usedSlots_;
+  uint16_t dropped_;
+#endif
+};
+
+}